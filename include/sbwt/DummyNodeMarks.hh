@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <sdsl/bit_vectors.hpp>
+#include "globals.hh"
+
+namespace sbwt{
+
+using namespace std;
+
+/*
+
+The marks of the dummy nodes of the SBWT, that is, the nodes whose label is shorter
+than k, with rank support. The rank support stores the number of marks before every
+block of 512 bits, so a rank query reads one sample and at most eight words of the
+marks. This takes 1/8 bits per node on top of the marks. The samples are rebuilt
+on load, and the structure has no pointers, so it is safe to copy and move.
+
+The rank of the marks maps colexicographic ranks of the SBWT to dense k-mer ids:
+the k-mer of node i has id i - rank(i).
+
+*/
+
+class DummyNodeMarks{
+
+private:
+
+    static const int64_t BLOCK_WORDS = 8; // 512 bits per rank sample
+
+    sdsl::bit_vector marks;
+    vector<int64_t> block_ranks; // block_ranks[b] = number of marks before position 512*b
+
+    void build_rank_samples(){
+        const uint64_t* words = marks.data();
+        int64_t n_words = (marks.size() + 63) / 64;
+        block_ranks.assign(n_words / BLOCK_WORDS + 1, 0);
+        int64_t count = 0;
+        for(int64_t w = 0; w < n_words; w++){
+            if(w % BLOCK_WORDS == 0) block_ranks[w / BLOCK_WORDS] = count;
+            uint64_t x = words[w];
+            if(w == n_words - 1 && marks.size() % 64 != 0) x &= ((uint64_t)1 << (marks.size() % 64)) - 1; // Bits past the end
+            count += __builtin_popcountll(x);
+        }
+        if(n_words % BLOCK_WORDS == 0) block_ranks.back() = count;
+    }
+
+public:
+
+    DummyNodeMarks(){}
+
+    explicit DummyNodeMarks(const sdsl::bit_vector& marks) : marks(marks){
+        build_rank_samples();
+    }
+
+    // Number of marks before position pos. pos can be at most the number of nodes.
+    int64_t rank(int64_t pos) const{
+        const uint64_t* words = marks.data();
+        int64_t w = pos >> 6;
+        int64_t r = block_ranks[w / BLOCK_WORDS];
+        for(int64_t i = w / BLOCK_WORDS * BLOCK_WORDS; i < w; i++) r += __builtin_popcountll(words[i]);
+        if(pos & 63) r += __builtin_popcountll(words[w] & (((uint64_t)1 << (pos & 63)) - 1));
+        return r;
+    }
+
+    bool is_dummy(int64_t pos) const {return marks[pos];}
+
+    const sdsl::bit_vector& get_marks() const {return marks;}
+
+    int64_t size() const {return marks.size();}
+
+    // True if the marks were not built or not loaded
+    bool empty() const {return marks.size() == 0;}
+
+    int64_t serialize(ostream& os) const{
+        return marks.serialize(os);
+    }
+
+    void load(istream& is){
+        marks.load(is);
+        build_rank_samples();
+    }
+
+};
+
+}
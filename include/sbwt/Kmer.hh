@@ -227,6 +227,26 @@ public:
         assert(k <= min(max_len, (int64_t)255));
     }
 
+    // Number of bytes written by serialize_packed for k-mers of length at most k
+    static constexpr int64_t packed_size_in_bytes(int64_t k){
+        return (2*k + 7) / 8;
+    }
+
+    // Writes the first n_bytes bytes of the data, most significant bits first, without the length. For k-mers of equal length,
+    // memcmp on the output gives the colexicographic order. `out` must have at least n_bytes bytes of space.
+    void serialize_packed(char* out, int64_t n_bytes) const{
+        assert(n_bytes <= (int64_t)sizeof(data));
+        for(int64_t i = 0; i < n_bytes; i++) out[i] = (data[i/8] >> (56 - 8*(i%8))) & 0xFF;
+    }
+
+    // Load from memory serialized to by member function `serialize_packed`. The length is not stored there, so it is given here.
+    void load_packed(const char* in, int64_t n_bytes, uint8_t k){
+        assert(n_bytes <= (int64_t)sizeof(data) && k <= min(max_len, (int64_t)255));
+        clear();
+        this->k = k;
+        for(int64_t i = 0; i < n_bytes; i++) data[i/8] |= (uint64_t)(uint8_t)in[i] << (56 - 8*(i%8));
+    }
+
 };
 
 // https://stackoverflow.com/questions/2590677/how-do-i-combine-hash-values-in-c0x
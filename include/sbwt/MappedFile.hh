@@ -0,0 +1,138 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <streambuf>
+#include <stdexcept>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+
+Support for loading indexes with mmap. A MappedFile maps a whole file read-only and
+shared, so that all processes that map the same index share one copy of it in the
+page cache. A MappableArray is an array that either owns its memory or is a view
+into a MappedFile. Views keep the mapping alive through a shared pointer, so the
+structures that contain them can be copied and moved freely.
+
+*/
+
+namespace sbwt{
+
+using namespace std;
+
+const int64_t MMAP_PAGE_SIZE = 4096; // Sections that are memory-mapped are aligned to this in the file
+
+class MappedFile{
+
+private:
+
+    const char* ptr = nullptr;
+    int64_t n_bytes = 0;
+
+public:
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Throws if the file can not be opened or mapped
+    MappedFile(const string& filename){
+        int fd = open(filename.c_str(), O_RDONLY);
+        if(fd == -1) throw std::runtime_error("Error opening file: " + filename);
+        struct stat st;
+        if(fstat(fd, &st) == -1){
+            close(fd);
+            throw std::runtime_error("Error reading the size of file: " + filename);
+        }
+        n_bytes = st.st_size;
+        if(n_bytes > 0){
+            void* p = mmap(nullptr, n_bytes, PROT_READ, MAP_SHARED, fd, 0);
+            if(p == MAP_FAILED){
+                close(fd);
+                throw std::runtime_error("Error memory-mapping file: " + filename);
+            }
+            ptr = (const char*)p;
+        }
+        close(fd); // The mapping stays valid after closing the descriptor
+    }
+
+    ~MappedFile(){
+        if(ptr != nullptr) munmap((void*)ptr, n_bytes);
+    }
+
+    const char* data() const {return ptr;}
+    int64_t size() const {return n_bytes;}
+
+};
+
+// Read-only std::streambuf over a range of memory, for parsing small sections of a mapped file with the usual load functions
+class MemoryStreamBuf : public std::streambuf{
+public:
+    MemoryStreamBuf(const char* begin, const char* end){
+        setg((char*)begin, (char*)begin, (char*)end);
+    }
+};
+
+template<typename T>
+class MappableArray{
+
+private:
+
+    vector<T> owned;
+    const T* ptr = nullptr; // Points to owned.data() or into the mapping
+    int64_t n = 0;
+    shared_ptr<const MappedFile> mapping; // Null if the array owns its memory
+
+    void reset_pointer(const MappableArray& other){
+        ptr = mapping ? other.ptr : owned.data();
+    }
+
+public:
+
+    MappableArray(){}
+
+    explicit MappableArray(vector<T>&& v) : owned(std::move(v)), ptr(owned.data()), n(owned.size()){}
+
+    // A view of n elements at the given byte offset of the mapped file. Throws if they do not fit in the file.
+    MappableArray(const shared_ptr<const MappedFile>& file, int64_t offset, int64_t n) : n(n), mapping(file){
+        if(offset < 0 || n < 0 || offset + n * (int64_t)sizeof(T) > file->size())
+            throw std::runtime_error("Error: memory-mapped section is out of bounds of the file");
+        ptr = (const T*)(file->data() + offset);
+    }
+
+    MappableArray(const MappableArray& other) : owned(other.owned), n(other.n), mapping(other.mapping){
+        reset_pointer(other);
+    }
+
+    MappableArray(MappableArray&& other) : owned(std::move(other.owned)), n(other.n), mapping(std::move(other.mapping)){
+        reset_pointer(other);
+    }
+
+    MappableArray& operator=(const MappableArray& other){
+        if(this != &other){
+            owned = other.owned; n = other.n; mapping = other.mapping;
+            reset_pointer(other);
+        }
+        return *this;
+    }
+
+    MappableArray& operator=(MappableArray&& other){
+        if(this != &other){
+            owned = std::move(other.owned); n = other.n; mapping = std::move(other.mapping);
+            reset_pointer(other);
+        }
+        return *this;
+    }
+
+    const T& operator[](int64_t i) const {return ptr[i];}
+    const T* data() const {return ptr;}
+    int64_t size() const {return n;}
+    bool is_mapped() const {return (bool)mapping;}
+
+};
+
+}
@@ -199,16 +199,19 @@ class NodeBOSSInMemoryConstructor{
         sdsl::bit_vector C_bits(nodes.size(), 0);
         sdsl::bit_vector G_bits(nodes.size(), 0);
         sdsl::bit_vector T_bits(nodes.size(), 0);
+        sdsl::bit_vector dummy_marks(nodes.size(), 0);
         for(int64_t i = 0; i < nodes.size(); i++){
             if(nodes[i].has('A')) A_bits[i] = 1;
             if(nodes[i].has('C')) C_bits[i] = 1;
             if(nodes[i].has('G')) G_bits[i] = 1;
             if(nodes[i].has('T')) T_bits[i] = 1;
+            if(nodes[i].kmer.get_k() < k) dummy_marks[i] = 1;
         }
 
         sdsl::bit_vector ssupport;
         if(streaming_support) ssupport = build_streaming_support(nodes, k);
         nodeboss_t constructed(A_bits, C_bits, G_bits, T_bits, ssupport, k, kmers.size(), 0); // No precalc
+        constructed.set_dummy_marks(dummy_marks);
         nodeboss = constructed;
     }
 };
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include "globals.hh"
+
+namespace sbwt{
+
+using namespace std;
+
+/*
+
+A compact table of SBWT intervals for the k-mer prefix precalc. The intervals of all
+strings of length p in colexicographic order have non-decreasing start points, so the
+table stores them in blocks of 64 entries. Every block stores the start of its first
+interval in full, and for each entry the offset of the start from that and the length
+of the interval, bit-packed with the smallest widths that fit the block. An empty
+interval is stored as length 0.
+
+Lookups cost a constant number of word reads. With p chosen so that the number of
+entries is close to the number of nodes, an entry typically takes under 10 bits,
+compared to 128 bits for a vector of pairs of 64-bit integers.
+
+*/
+
+class PrecalcTable{
+
+private:
+
+    static const int64_t BLOCK_SIZE = 64;
+
+    int64_t n_entries = 0;
+    vector<int64_t> block_base; // Start of the first interval in each block
+    vector<int64_t> block_bit_offset; // Bit offset of each block in the packed data
+    vector<uint8_t> block_widths; // Two per block: width of the start offsets, width of the lengths
+    vector<uint64_t> packed;
+    int64_t packed_bits = 0;
+
+    static uint8_t bits_needed(uint64_t x){
+        uint8_t w = 0;
+        while(w < 64 && (x >> w) != 0) w++;
+        return w;
+    }
+
+    void append_bits(uint64_t x, uint8_t width){
+        if(width == 0) return;
+        int64_t word = packed_bits / 64;
+        int64_t offset = packed_bits % 64;
+        while((int64_t)packed.size() <= (packed_bits + width) / 64) packed.push_back(0);
+        packed[word] |= x << offset;
+        if(offset + width > 64) packed[word+1] |= x >> (64 - offset);
+        packed_bits += width;
+    }
+
+    uint64_t read_bits(int64_t bit_pos, uint8_t width) const{
+        if(width == 0) return 0;
+        int64_t word = bit_pos / 64;
+        int64_t offset = bit_pos % 64;
+        uint64_t x = packed[word] >> offset;
+        if(offset + width > 64) x |= packed[word+1] << (64 - offset);
+        if(width < 64) x &= ((uint64_t)1 << width) - 1;
+        return x;
+    }
+
+public:
+
+    PrecalcTable(){}
+
+    // Builds the table from the intervals get_interval(0), ..., get_interval(n_entries-1).
+    // Empty intervals are given as {-1,-1}.
+    PrecalcTable(int64_t n_entries, const std::function<pair<int64_t,int64_t>(int64_t)>& get_interval) : n_entries(n_entries){
+        int64_t n_blocks = (n_entries + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        block_base.reserve(n_blocks);
+        block_bit_offset.reserve(n_blocks);
+        block_widths.reserve(2*n_blocks);
+
+        int64_t prev_end = 0; // One past the end of the last non-empty interval so far
+        vector<int64_t> starts(BLOCK_SIZE), lengths(BLOCK_SIZE);
+        for(int64_t b = 0; b < n_blocks; b++){
+            int64_t block_len = min(BLOCK_SIZE, n_entries - b * BLOCK_SIZE);
+            for(int64_t j = 0; j < block_len; j++){
+                pair<int64_t,int64_t> I = get_interval(b * BLOCK_SIZE + j);
+                if(I.first == -1){
+                    starts[j] = prev_end; lengths[j] = 0;
+                } else{
+                    if(I.first < prev_end) throw std::runtime_error("Bug: precalc intervals are not in increasing order");
+                    starts[j] = I.first; lengths[j] = I.second - I.first + 1;
+                    prev_end = I.second + 1;
+                }
+            }
+
+            uint64_t max_offset = 0, max_length = 0;
+            for(int64_t j = 0; j < block_len; j++){
+                max_offset = max(max_offset, (uint64_t)(starts[j] - starts[0]));
+                max_length = max(max_length, (uint64_t)lengths[j]);
+            }
+            uint8_t offset_width = bits_needed(max_offset);
+            uint8_t length_width = bits_needed(max_length);
+
+            block_base.push_back(starts[0]);
+            block_bit_offset.push_back(packed_bits);
+            block_widths.push_back(offset_width);
+            block_widths.push_back(length_width);
+            for(int64_t j = 0; j < block_len; j++){
+                append_bits(starts[j] - starts[0], offset_width);
+                append_bits(lengths[j], length_width);
+            }
+        }
+    }
+
+    // Returns the interval of entry i, or {-1,-1} if it is empty
+    pair<int64_t,int64_t> operator[](int64_t i) const{
+        int64_t b = i / BLOCK_SIZE;
+        uint8_t offset_width = block_widths[2*b];
+        uint8_t length_width = block_widths[2*b+1];
+        int64_t bit_pos = block_bit_offset[b] + (i % BLOCK_SIZE) * (offset_width + length_width);
+        int64_t length = read_bits(bit_pos + offset_width, length_width);
+        if(length == 0) return {-1,-1};
+        int64_t start = block_base[b] + read_bits(bit_pos, offset_width);
+        return {start, start + length - 1};
+    }
+
+    int64_t size() const {return n_entries;}
+
+    int64_t serialize(ostream& os) const{
+        int64_t written = 0;
+        os.write((char*)&n_entries, sizeof(n_entries));
+        os.write((char*)&packed_bits, sizeof(packed_bits));
+        written += sizeof(n_entries) + sizeof(packed_bits);
+        written += serialize_std_vector(block_base, os);
+        written += serialize_std_vector(block_bit_offset, os);
+        written += serialize_std_vector(block_widths, os);
+        written += serialize_std_vector(packed, os);
+        return written;
+    }
+
+    void load(istream& is){
+        is.read((char*)&n_entries, sizeof(n_entries));
+        is.read((char*)&packed_bits, sizeof(packed_bits));
+        block_base = load_std_vector<int64_t>(is);
+        block_bit_offset = load_std_vector<int64_t>(is);
+        block_widths = load_std_vector<uint8_t>(is);
+        packed = load_std_vector<uint64_t>(is);
+    }
+
+};
+
+}
@@ -6,11 +6,22 @@
 #include "NodeBOSSInMemoryConstructor.hh"
 #include "throwing_streams.hh"
 #include "suffix_group_optimization.hh"
+#include "SuffixGroupStartSupport.hh"
+#include "SmallerValueSupport.hh"
+#include "DummyNodeMarks.hh"
+#include "PrecalcTable.hh"
+#include "dna_encoding.hh"
 #include "kmc_construct.hh"
 #include "globals.hh"
 #include "Kmer.hh"
 #include <map>
 #include <optional>
+#include <iterator>
+#include <type_traits>
+#include <array>
+#include <thread>
+#include <sstream>
+#include <mutex>
 
 /*
 
@@ -25,7 +36,51 @@ using namespace std;
 
 namespace sbwt{
 
-const std::string SBWT_VERSION = "v0.1"; // Update this after breaking changes. This is serialized with the index and checked when loading.
+const std::string SBWT_VERSION = "v0.4"; // Update this after breaking changes. This is serialized with the index and checked when loading.
+const std::string SBWT_VERSION_FLAT = "v0.3"; // Older format without the section table. Can still be loaded.
+const std::string SBWT_VERSION_NO_LCS = "v0.2"; // Older format without the LCS array. Can still be loaded.
+const std::string SBWT_VERSION_UNCOMPRESSED_PRECALC = "v0.1"; // Older format with an uncompressed precalc table. Can still be loaded.
+const std::string SBWT_VERSION_MAPPABLE = "v0.4-mappable"; // Page-aligned layout written by serialize_mappable, for load_mmap.
+
+// Identifiers of the sections of the serialized SBWT. The file has a table of the sections
+// with their offsets and sizes after the version string, so readers can skip sections they
+// do not need. Readers skip sections with unknown identifiers.
+enum class SBWTSection : int64_t {SUBSET_RANK = 1, STREAMING_SUPPORT = 2, C_ARRAY = 3, PRECALC = 4, METADATA = 5, LCS = 6, DUMMY_MARKS = 7, COUNTS = 8};
+
+/**
+ * @brief Which optional components to read in SBWT::load(). Components that are left out are not read from
+ *        the file at all, which saves I/O for jobs that do not need them. Files written by older versions
+ *        and the mappable layout are always loaded in full.
+ */
+struct SBWTLoadConfig{
+    bool streaming_support = true; /**< Load the streaming support. Without it, has_streaming_query_support() is false. */
+    bool precalc = true; /**< Load the k-mer prefix precalc table. Without it, get_precalc_k() is 0 and search does not use a table. */
+    bool lcs = true; /**< Load the LCS array needed by matching_statistics(). */
+    bool dummy_marks = true; /**< Load the dummy node marks needed by search_id() and streaming_search_ids(). */
+    bool counts = true; /**< Load the k-mer abundances needed by get_count(). */
+    int n_threads = 1; /**< Number of sections to read concurrently. Only used when loading from a file name. */
+};
+
+// Detects subset rank structures that store the suffix group starts next to the rank data, such as SubsetInterleavedRank.
+template<typename T, typename = void>
+struct has_suffix_group_start_in_block : std::false_type {};
+
+template<typename T>
+struct has_suffix_group_start_in_block<T, std::void_t<decltype(std::declval<const T&>().suffix_group_start_in_block(int64_t(0)))>> : std::true_type {};
+
+// Detects subset rank structures that can take the character as an index 0..3 without branching on it.
+template<typename T, typename = void>
+struct has_rank_by_char_idx : std::false_type {};
+
+template<typename T>
+struct has_rank_by_char_idx<T, std::void_t<decltype(std::declval<const T&>().rank_by_char_idx(int64_t(0), int64_t(0)))>> : std::true_type {};
+
+// Detects subset rank structures that can be a view into a memory-mapped file, such as SubsetInterleavedRank.
+template<typename T, typename = void>
+struct has_mappable_layout : std::false_type {};
+
+template<typename T>
+struct has_mappable_layout<T, std::void_t<decltype(std::declval<T&>().map_blocks(std::declval<const std::shared_ptr<const MappedFile>&>(), int64_t(0), int64_t(0)))>> : std::true_type {};
 
 // Assumes that a root node always exists
 template <typename subset_rank_t>
@@ -35,15 +90,21 @@ private:
 
     subset_rank_t subset_rank; // The subset rank query implementation
     sdsl::bit_vector suffix_group_starts; // Marks the first column of every suffix group (see paper)
+    SuffixGroupStartSupport suffix_group_start_support; // Constant-time lookup of suffix group starts. Not serialized, rebuilt on load.
     vector<int64_t> C; // The array of cumulative character counts
 
-    vector<pair<int64_t,int64_t> > kmer_prefix_precalc; // SBWT intervals for all p-mers with p = precalc_k.
+    PrecalcTable kmer_prefix_precalc; // SBWT intervals for all p-mers with p = precalc_k.
     int64_t precalc_k = 0;
 
     int64_t n_nodes; // Number of nodes (= columns) in the data structure
     int64_t n_kmers; // Number of k-mers indexed in the data structure
     int64_t k; // The k-mer k
 
+    sdsl::int_vector<> lcs; // Longest common suffix array of the node labels. Empty if not built.
+    SmallerValueSupport lcs_support; // Widens match intervals in matching_statistics. Not serialized, rebuilt with the LCS array.
+    DummyNodeMarks dummy_marks; // Marks the nodes whose label is shorter than k. Empty if not built.
+    sdsl::int_vector<> counts; // counts[id] = abundance of the k-mer with dense id id. Empty if not stored.
+
     static constexpr char alphabet[4] = {'A', 'C', 'G', 'T'};
 
     int64_t get_char_idx(char c) const{
@@ -56,6 +117,59 @@ private:
         }
     }
 
+    // One step of streaming search on an input encoded with encode_DNA. Given the rank of the k-mer
+    // starting at i-1 (or -1 if it was not found or i = 0), returns the rank of the k-mer starting at i.
+    int64_t streaming_search_step(const uint8_t* codes, const uint64_t* invalid_mask, int64_t i, int64_t prev_rank) const;
+
+    // Calls callback(round, chars) for round = 0..k-1, where chars[i] is the character at position k-1-round of the
+    // label of node i, or '$' if the label is shorter. Fills the positions by propagating the incoming characters forward
+    // in the graph with sequential passes over the nodes.
+    template <typename callback_t>
+    void propagate_labels(const callback_t& callback) const;
+
+    // Encodes input[0..len) into the buffers with encode_DNA. Does not shrink the buffers.
+    static void encode_input(const char* input, int64_t len, vector<uint8_t>& codes, vector<uint64_t>& invalid_mask);
+
+    // Subset rank with the character given as an index 0..3 (see DNA_to_char_idx)
+    int64_t rank_char_idx(int64_t pos, int64_t char_idx) const{
+        if constexpr(has_rank_by_char_idx<subset_rank_t>::value) return subset_rank.rank_by_char_idx(pos, char_idx);
+        else return subset_rank.rank(pos, alphabet[char_idx]);
+    }
+
+    // Writes the given section without a header
+    void serialize_section(SBWTSection section, ostream& os) const;
+
+    // Writes the (id, offset, size) entries of the section table for sections of the given sizes
+    void write_section_table(const vector<SBWTSection>& sections, const vector<int64_t>& sizes, ostream& os) const;
+
+    // Loads the given section written by serialize_section
+    void load_section(SBWTSection section, istream& is);
+
+    // Sets the components that were not loaded to their empty state, and rebuilds the derived structures
+    void finish_loading_sections(bool streaming_support_loaded, bool precalc_loaded, bool lcs_loaded, bool dummy_marks_loaded, bool counts_loaded);
+
+    // Section offsets of the mappable layout, as absolute positions in the file
+    struct MappableLayout{
+        int64_t meta_offset, meta_bytes, blocks_offset, blocks_bytes, samples_offset, samples_bytes;
+    };
+
+    // Reads everything except the blocks and the sample words in the mappable layout
+    void load_mappable_meta(istream& is);
+
+    // Loads the rest of the mappable layout from the stream, after the version string starting at file position start
+    void load_mappable(istream& is, int64_t start);
+
+    // Returns the first column of the suffix group of the given column in constant time. Requires streaming support.
+    int64_t get_suffix_group_start(int64_t column) const{
+        if constexpr(has_suffix_group_start_in_block<subset_rank_t>::value){
+            int64_t start = subset_rank.suffix_group_start_in_block(column); // Same cache line as the rank data
+            if(start != -1) return start;
+            return suffix_group_start_support.last_mark_before_word(column >> 6); // The blocks are aligned with the words of the marks
+        } else{
+            return suffix_group_start_support.group_start(suffix_group_starts, column);
+        }
+    }
+
 public:
 
     struct BuildConfig{
@@ -67,9 +181,28 @@ public:
         int max_abundance = 1e9; /**< k-mers occurring more than this many times are discarded */
         int ram_gigas = 2; /**< RAM budget in gigabytes. Not strictly enforced. */
         int precalc_k = 0; /**< We will precalculate and store the SBWT intervals of all DNA-strings of this length */
+        bool store_counts = false; /**< Whether to store the abundances of the k-mers, capped at max_abundance. See get_count(). */
+        bool add_reverse_complements = false; /**< Whether to also add the reverse complements of the k-mers, counted as if the input had the reverse complements of the sequences. */
         string temp_dir = "."; /**< Path to the directory for the temporary files. */
     };
 
+    typedef SBWTLoadConfig LoadConfig; /**< Which optional components to read in load(). */
+
+    /**
+     * @brief Reusable scratch space for queries. Keep one of these per thread and pass it to
+     *        the query functions that take one, so that no memory is allocated per query once
+     *        the buffers have grown to the length of the longest query.
+     */
+    struct QueryContext{
+        string rc_input; /**< Reverse complement of the input. */
+        vector<int64_t> ranks; /**< Ranks of the k-mers of the input. */
+        vector<int64_t> rc_ranks; /**< Ranks of the k-mers of the reverse complement of the input. */
+        vector<uint8_t> codes; /**< Character indices of the input, see encode_DNA(). */
+        vector<uint64_t> invalid_mask; /**< Non-ACGT positions of the input, see encode_DNA(). */
+        vector<uint8_t> rc_codes; /**< Character indices of the reverse complement of the input. */
+        vector<uint64_t> rc_invalid_mask; /**< Non-ACGT positions of the reverse complement of the input. */
+    };
+
     /**
      * @brief Construct an empty SBWT.
      * 
@@ -111,12 +244,15 @@ public:
     const subset_rank_t& get_subset_rank_structure() const {return subset_rank;}
 
     /**
-     * @brief Get a const reference to the internal streaming support bit vector.
+     * @brief Get a const reference to the internal streaming support bit vector. This is empty if
+     *        the index was loaded with load_mmap(). Use has_streaming_query_support() to check for support.
      */
     const sdsl::bit_vector& get_streaming_support() const {return suffix_group_starts;}
 
     /**
-     * @brief Compute and return a bit vector that marks which nodes do not correspond to a full k-mer.
+     * @brief Return a bit vector that marks which nodes do not correspond to a full k-mer. Returns a copy of
+     *        the stored marks if they are available, and otherwise computes them in O(nk) time.
+     * @see has_dummy_marks()
      */
     sdsl::bit_vector compute_dummy_node_marks() const;
 
@@ -128,13 +264,99 @@ public:
     /**
      * @brief Get a const reference to the k-mer prefix precalc
      */
-    const vector<pair<int64_t, int64_t>>& get_precalc() const {return kmer_prefix_precalc;}
+    const PrecalcTable& get_precalc() const {return kmer_prefix_precalc;}
 
     /**
      * @brief Get the precalc k-mer prefix length
      */
     int64_t get_precalc_k() const {return precalc_k;}
 
+    /**
+     * @brief Get a const reference to the longest common suffix array. Empty if it has not been built.
+     * @see build_lcs()
+     */
+    const sdsl::int_vector<>& get_lcs() const {return lcs;}
+
+    /**
+     * @brief Whether the longest common suffix array has been built.
+     */
+    bool has_lcs() const {return lcs.size() > 0;}
+
+    /**
+     * @brief Compute the longest common suffix array of the node labels, needed by matching_statistics().
+     *        lcs[i] is the length of the longest common suffix of the labels of nodes i-1 and i, and lcs[0] = 0.
+     *        Dummy characters are treated as distinct from all DNA characters. Takes O(nk) time and
+     *        requires a subset rank structure that supports contains().
+     */
+    void build_lcs();
+
+    /**
+     * @brief Set the longest common suffix array, for example one computed with build_lcs() on
+     *        another variant of the same SBWT.
+     */
+    void set_lcs(const sdsl::int_vector<>& lcs_array);
+
+    /**
+     * @brief Whether the dummy node marks are stored, which is needed by search_id() and streaming_search_ids().
+     *        They are stored by the constructors that build the SBWT from input sequences.
+     */
+    bool has_dummy_marks() const {return !dummy_marks.empty() || n_nodes == 0;}
+
+    /**
+     * @brief Get a const reference to the stored dummy node marks. Empty if they are not stored.
+     */
+    const sdsl::bit_vector& get_dummy_marks() const {return dummy_marks.get_marks();}
+
+    /**
+     * @brief Compute and store the dummy node marks, for an index that was loaded without them.
+     *        Takes O(nk) time and requires a subset rank structure that supports contains().
+     */
+    void build_dummy_marks();
+
+    /**
+     * @brief Store the given dummy node marks, for example those of another variant of the same SBWT.
+     *        An empty bit vector removes the marks.
+     */
+    void set_dummy_marks(const sdsl::bit_vector& marks);
+
+    /**
+     * @brief Map a colexicographic rank to a dense k-mer id. The ids of the n k-mers of the index are
+     *        0, 1, ..., n-1 in colexicographic order, so that data about k-mers can be stored in arrays
+     *        of length number_of_kmers(). Requires the dummy node marks.
+     * 
+     * @throws std::runtime_error If the dummy node marks are not stored.
+     * @param colex_rank A colexicographic rank, or -1.
+     * @return The id of the k-mer, or -1 if colex_rank is -1 or a dummy node.
+     */
+    int64_t colex_rank_to_id(int64_t colex_rank) const;
+
+    /**
+     * @brief Whether the abundances of the k-mers are stored. They are stored by the KMC-based
+     *        construction if BuildConfig::store_counts is set.
+     */
+    bool has_counts() const {return counts.size() > 0 || n_kmers == 0;}
+
+    /**
+     * @brief Get a const reference to the stored abundances, indexed by dense k-mer id. Empty if they are not stored.
+     * @see colex_rank_to_id()
+     */
+    const sdsl::int_vector<>& get_counts() const {return counts;}
+
+    /**
+     * @brief Store the abundances of the k-mers, indexed by dense k-mer id, for example those of another
+     *        variant of the same SBWT. An empty vector removes the counts.
+     */
+    void set_counts(const sdsl::int_vector<>& counts_array);
+
+    /**
+     * @brief Get the abundance of the k-mer at the given colexicographic rank. Requires the counts and the dummy node marks.
+     * 
+     * @throws std::runtime_error If the counts or the dummy node marks are not stored.
+     * @param colex_rank A colexicographic rank, or -1.
+     * @return The abundance of the k-mer, or 0 if colex_rank is -1 or a dummy node.
+     */
+    int64_t get_count(int64_t colex_rank) const;
+
 
     /**
      * @brief Precalculate all SBWT intervals of all strings of length prefix_length. These will be used in search.
@@ -183,6 +405,47 @@ public:
      */
     int64_t search(const char* kmer) const;
 
+    /**
+     * @brief Search for many independent k-mers at once. The searches are advanced in lockstep in small
+     *        groups, and the memory needed for the next step of every search in the group is prefetched
+     *        before any of them is taken. This hides memory latency on large indexes. The result is the
+     *        same as calling search() on each k-mer.
+     * 
+     * @param kmers Array of n pointers to k-mers. Each k-mer must have at least k characters.
+     * @param n The number of k-mers.
+     * @param out Output array of length n. out[i] is set to the rank of kmers[i] in the data structure, or -1 if it is not in the index.
+     * @see search()
+     */
+    void search_batch(const char* const* kmers, int64_t n, int64_t* out) const;
+
+    /**
+     * @brief Search for a k-mer and return its dense id instead of its colexicographic rank. Requires the dummy node marks.
+     * 
+     * @throws std::runtime_error If the dummy node marks are not stored.
+     * @param kmer The k-mer to search for. Must have at least k characters.
+     * @return The id of the k-mer between 0 and number_of_kmers() - 1, or -1 if the k-mer is not in the index.
+     * @see colex_rank_to_id()
+     */
+    int64_t search_id(const char* kmer) const;
+
+    /**
+     * @brief Search for a k-mer as an std::string and return its dense id. Requires the dummy node marks.
+     * 
+     * @throws std::runtime_error If the dummy node marks are not stored.
+     * @see search_id(const char*)
+     */
+    int64_t search_id(const string& kmer) const;
+
+    /**
+     * @brief Search for a k-mer given as character indices (A=0, C=1, G=2, T=3), for example
+     *        as produced by encode_DNA(). The search loop does not look at characters at all.
+     * 
+     * @param char_indices Array of at least k character indices, all between 0 and 3.
+     * @return The rank of the k-mer in the data structure, or -1 if the k-mer is not in the index.
+     * @see encode_DNA()
+     */
+    int64_t search_char_indices(const uint8_t* char_indices) const;
+
     /**
     * @brief Searches for up to the first len characters of the input. For k-mer lookups, it's
     *        better to use `search` because it uses a precalculated lookup table to speed up the search.
@@ -244,13 +507,150 @@ public:
      */
     vector<int64_t> streaming_search(const char* input, int64_t len) const;
 
+    /**
+     * @brief Query all k-mers of the input C-string and write the results to an output iterator.
+     *        Requires that the streaming support had been built.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built.
+     * @param input The input string 
+     * @param len Length of the input string
+     * @param out Output iterator, for example a pointer to a buffer of at least max(0, len-k+1) elements, or an std::back_insert_iterator.
+     * @return The number of values written, which is max(0, len-k+1). The values are the same as those returned by streaming_search(const char*, int64_t).
+     * @see streaming_search()
+     */
+    template <typename out_iterator_t>
+    int64_t streaming_search(const char* input, int64_t len, out_iterator_t out) const;
+
+    /**
+     * @brief Like streaming_search(const char*, int64_t, out_iterator_t), but the input is encoded into
+     *        the context, so this does not allocate memory if the buffers in the context are already large enough.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built.
+     * @param context Scratch space. Must not be used by another thread at the same time.
+     * @see streaming_search()
+     */
+    template <typename out_iterator_t>
+    int64_t streaming_search(const char* input, int64_t len, out_iterator_t out, QueryContext& context) const;
+
+    /**
+     * @brief Query all k-mers of the input C-string and return their dense ids. Requires that the streaming support
+     *        had been built and that the dummy node marks are stored.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built or the dummy node marks are not stored.
+     * @param input The input string 
+     * @param len Length of the input string
+     * @return vector<int64_t> The ids of the k-mers of the input between 0 and number_of_kmers() - 1, with -1 for those that are not found in the index.
+     * @see colex_rank_to_id()
+     */
+    vector<int64_t> streaming_search_ids(const char* input, int64_t len) const;
+
+    /**
+     * @brief Query all k-mers of the input std::string and return their dense ids.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built or the dummy node marks are not stored.
+     * @see streaming_search_ids(const char*, int64_t)
+     */
+    vector<int64_t> streaming_search_ids(const string& input) const;
+
+    /**
+     * @brief Streaming search that hands the results to a callback one at a time and can stop early.
+     *        Calls callback(i, rank) for the k-mers starting at i = 0, 1, 2... in order, until the
+     *        callback returns false or all k-mers have been processed. Requires that the streaming support had been built.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built.
+     * @param input The input string 
+     * @param len Length of the input string
+     * @param callback A function taking (int64_t position, int64_t rank) and returning bool. The ranks are the same as those of streaming_search().
+     * @return The number of k-mers processed.
+     * @see streaming_search()
+     */
+    template <typename callback_t>
+    int64_t streaming_search_with_callback(const char* input, int64_t len, const callback_t& callback) const;
+
+    /**
+     * @brief Like streaming_search_with_callback(const char*, int64_t, const callback_t&), but the input is
+     *        encoded into the context, so this does not allocate memory if the buffers in the context are already large enough.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built.
+     * @param context Scratch space. Must not be used by another thread at the same time.
+     * @see streaming_search_with_callback()
+     */
+    template <typename callback_t>
+    int64_t streaming_search_with_callback(const char* input, int64_t len, const callback_t& callback, QueryContext& context) const;
+
+    /**
+     * @brief Query all k-mers of the input C-string on both strands. Runs streaming search on the input
+     *        and its reverse complement at the same time, so that the index does not need to contain
+     *        the reverse complements of the k-mers. Requires that the streaming support had been built.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built.
+     * @param input The input string 
+     * @param len Length of the input string
+     * @return vector<int64_t> For each k-mer of the input from left to right, the rank of the k-mer in the data structure if it is found,
+     *         otherwise the rank of the reverse complement of the k-mer if that is found, otherwise -1.
+     * @see streaming_search()
+     */
+    vector<int64_t> streaming_search_both_strands(const char* input, int64_t len) const;
+
+    /**
+     * @brief Query all k-mers of the input std::string on both strands. Requires that the streaming support had been built.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built.
+     * @param input The input string 
+     * @return vector<int64_t> Same as streaming_search_both_strands(const char*, int64_t).
+     * @see streaming_search()
+     */
+    vector<int64_t> streaming_search_both_strands(const string& input) const;
+
+    /**
+     * @brief Query all k-mers of the input C-string on both strands and write the results to an output
+     *        iterator. Does not allocate memory if the buffers in the context are already large enough.
+     *        Requires that the streaming support had been built.
+     * 
+     * @throws std::runtime_error If the streaming support has not been built.
+     * @param input The input string 
+     * @param len Length of the input string
+     * @param out Output iterator, for example a pointer to a buffer of at least max(0, len-k+1) elements, or an std::back_insert_iterator.
+     * @param context Scratch space. Must not be used by another thread at the same time.
+     * @return The number of values written, which is max(0, len-k+1). The values are the same as those returned by streaming_search_both_strands(const char*, int64_t).
+     * @see streaming_search_both_strands()
+     */
+    template <typename out_iterator_t>
+    int64_t streaming_search_both_strands(const char* input, int64_t len, out_iterator_t out, QueryContext& context) const;
+
+    /**
+     * @brief Compute the matching statistics of the input against the k-mers in the index. The value at
+     *        position i is the length of the longest suffix of input[0..i] that occurs as a substring of
+     *        some k-mer in the index, capped at k. Runs in a single left-to-right pass that extends the
+     *        current match with rank queries and shortens it using the LCS array when it can not be extended.
+     *        Non-ACGT characters get the value 0 and end the current match.
+     * 
+     * @throws std::runtime_error If the LCS array has not been built.
+     * @param input The input string 
+     * @param len Length of the input string
+     * @param out Output iterator for len values, for example a pointer to a buffer or an std::back_insert_iterator.
+     * @return The number of values written, which is len.
+     * @see build_lcs()
+     */
+    template <typename out_iterator_t>
+    int64_t matching_statistics(const char* input, int64_t len, out_iterator_t out) const;
+
+    /**
+     * @brief Compute the matching statistics of the input std::string.
+     * 
+     * @throws std::runtime_error If the LCS array has not been built.
+     * @param input The input string 
+     * @return vector<int64_t> The matching statistics, as in matching_statistics(const char*, int64_t, out_iterator_t).
+     */
+    vector<int64_t> matching_statistics(const string& input) const;
+
     /**
      * @brief Whether streaming support is built for the data structure.
      * 
      * @return true If streaming support has been built.
      * @return false If streaming support has not been built.
      */
-    bool has_streaming_query_support() const {return suffix_group_starts.size() > 0;}
+    bool has_streaming_query_support() const {return !suffix_group_start_support.empty();}
     
     /**
      * @brief Write the data structure into the given output stream.
@@ -271,13 +671,59 @@ public:
     int64_t serialize(const string& filename) const; // Returns the number of bytes written
 
     /**
-     * @brief Load the serialized data structure from an input stream.
+     * @brief Write the data structure in a page-aligned layout that can be loaded with load_mmap().
+     *        Only for subset rank structures that support it (the interleaved-matrix variant).
+     *        Sections are aligned by their absolute position in the stream, so the stream must support tellp().
+     * 
+     * @throws std::runtime_error If the subset rank structure does not support the layout.
+     * @param out The output stream.
+     * @return int64_t Number of bytes written.
+     * @see load_mmap()
+     */
+    int64_t serialize_mappable(ostream& out) const;
+
+    /**
+     * @brief Write the data structure in the page-aligned layout into the given file.
+     * 
+     * @param filename The output file.
+     * @return int64_t Number of bytes written.
+     * @see load_mmap()
+     */
+    int64_t serialize_mappable(const string& filename) const;
+
+    /**
+     * @brief Load the data structure by memory-mapping a file written with serialize_mappable(). The
+     *        subset rank blocks and the suffix group start samples are read-only views into the mapping,
+     *        so loading takes almost no time, and all processes that map the same file share the memory.
+     *        The other components (C-array, precalc, LCS, dummy marks, counts) are copied into memory. The
+     *        mapping stays alive as long as this object or any copy of it.
+     * 
+     * @throws std::runtime_error If the file is not in the mappable layout.
+     * @param filename The input file.
+     * @param offset Position of the data structure in the file, for example after a variant name written before it.
+     * @see serialize_mappable()
+     */
+    void load_mmap(const string& filename, int64_t offset = 0);
+
+    /**
+     * @brief Load the serialized data structure from an input stream. Also reads the mappable layout,
+     *        into memory, if the stream supports tellg().
      * 
      * @param in The input stream.
      * @see serialize()
      */
     void load(istream& in);
 
+    /**
+     * @brief Load the serialized data structure from an input stream, leaving out the components that
+     *        are not needed. Sections that are left out are skipped with a seek if the stream supports it.
+     * 
+     * @param in The input stream.
+     * @param config Which components to load.
+     * @see serialize()
+     */
+    void load(istream& in, const LoadConfig& config);
+
     /**
      * @brief Load the serialized data structure from an input file.
      * 
@@ -286,6 +732,17 @@ public:
      */
     void load(const string& filename);
 
+    /**
+     * @brief Load the serialized data structure from an input file, leaving out the components that are
+     *        not needed. With config.n_threads > 1, the sections are read concurrently from separate streams.
+     * 
+     * @param filename The input file.
+     * @param config Which components to load.
+     * @param offset Position of the data structure in the file, for example after a variant name written before it.
+     * @see serialize()
+     */
+    void load(const string& filename, const LoadConfig& config, int64_t offset = 0);
+
     /**
      * @brief Reconstruct all k-mers in the data structure.
      * 
@@ -294,6 +751,20 @@ public:
      */
     string reconstruct_all_kmers() const;
 
+    /**
+     * @brief Reconstruct all k-mers in colexicographic order in chunks of consecutive nodes, without storing all of them at once.
+     *        The chunks are reconstructed in parallel, and the callback is called for them in order from the calling thread.
+     *        Uses n_nodes * log(n_nodes) bits of memory for the predecessor of every node, plus chunk_size * k bytes for each thread.
+     * 
+     * @param chunk_size Maximum number of k-mers in one chunk.
+     * @param n_threads Number of chunks reconstructed at the same time.
+     * @param callback A function taking (int64_t first_colex_rank, int64_t n_kmers, const char* kmers), where kmers is the
+     *        concatenation of the k-mers of nodes first_colex_rank ... first_colex_rank + n_kmers - 1, each of length k.
+     *        Dummy k-mers are padded from the left with '$' characters as in reconstruct_all_kmers().
+     */
+    template<typename callback_t>
+    void reconstruct_kmers_in_chunks(int64_t chunk_size, int64_t n_threads, callback_t callback) const;
+
     /**
      * @brief Retrieve the k-mer with the given colexicographic rank (including dummy k-mers). Has time complexity O(k log n).
      * 
@@ -334,11 +805,17 @@ public:
 
 template <typename subset_rank_t>
 SBWT<subset_rank_t>::SBWT(const sdsl::bit_vector& A_bits, const sdsl::bit_vector& C_bits, const sdsl::bit_vector& G_bits, const sdsl::bit_vector& T_bits, const sdsl::bit_vector& streaming_support, int64_t k, int64_t n_kmers, int64_t precalc_k){
-    subset_rank = subset_rank_t(A_bits, C_bits, G_bits, T_bits);
+    if constexpr(std::is_constructible<subset_rank_t, const sdsl::bit_vector&, const sdsl::bit_vector&, const sdsl::bit_vector&, const sdsl::bit_vector&, const sdsl::bit_vector&>::value){
+        // The subset rank structure stores a copy of the suffix group starts next to the rank data
+        subset_rank = subset_rank_t(A_bits, C_bits, G_bits, T_bits, streaming_support);
+    } else{
+        subset_rank = subset_rank_t(A_bits, C_bits, G_bits, T_bits);
+    }
 
     this->n_nodes = A_bits.size();
     this->k = k;
     this->suffix_group_starts = streaming_support;
+    this->suffix_group_start_support = SuffixGroupStartSupport(suffix_group_starts);
     this->n_kmers = n_kmers;
 
     // Get the C-array
@@ -357,8 +834,7 @@ SBWT<subset_rank_t>::SBWT(const BuildConfig& config){
     string old_temp_dir = get_temp_file_manager().get_dir();
     get_temp_file_manager().set_dir(config.temp_dir);
 
-    NodeBOSSKMCConstructor<SBWT<subset_rank_t>> builder;
-    builder.build(config.input_files, *this, config.k, config.n_threads, config.ram_gigas, config.build_streaming_support, config.min_abundance, config.max_abundance, config.precalc_k);
+    build_with_kmc<SBWT<subset_rank_t>>(config.input_files, *this, config.k, config.n_threads, config.ram_gigas, config.build_streaming_support, config.min_abundance, config.max_abundance, config.precalc_k, config.store_counts, config.add_reverse_complements);
 
     get_temp_file_manager().set_dir(old_temp_dir); // Return the old temporary directory
 
@@ -371,7 +847,7 @@ int64_t SBWT<subset_rank_t>::forward(int64_t node, char c) const{
         throw std::runtime_error("Error: Streaming support required for SBWT::forward");
 
     // Go to start of the suffix group.
-    while(!suffix_group_starts[node]) node--; // Guaranteed to terminate because the first node is always marked
+    node = get_suffix_group_start(node);
 
     int64_t r1 = subset_rank.rank(node, c);
     int64_t r2 = subset_rank.rank(node+1, c);
@@ -414,6 +890,86 @@ int64_t SBWT<subset_rank_t>::search(const char* kmer) const{
     return I.first;
 }
 
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::search_batch(const char* const* kmers, int64_t n, int64_t* out) const{
+    constexpr int64_t group_size = 16; // Number of searches advanced in lockstep
+    pair<int64_t, int64_t> I[group_size];
+
+    for(int64_t group_start = 0; group_start < n; group_start += group_size){
+        int64_t m = min(group_size, n - group_start);
+        const char* const* group = kmers + group_start;
+
+        // Initialize the intervals from the precalc table if available (see search())
+        for(int64_t j = 0; j < m; j++){
+            if(precalc_k > 0){
+                uint64_t precalc_idx = 0;
+                for(int64_t i = 0; i < precalc_k; i++){
+                    int64_t char_idx = DNA_to_char_idx(group[j][precalc_k-1-i]);
+                    if(char_idx == -1){ // non-ACGT character
+                        precalc_idx = -1;
+                        break;
+                    }
+                    precalc_idx = (precalc_idx << 2) | char_idx; // Add the character
+                }
+                I[j] = precalc_idx == (uint64_t)-1 ? pair<int64_t, int64_t>(-1,-1) : kmer_prefix_precalc[precalc_idx];
+            } else I[j] = {0, n_nodes-1};
+        }
+
+        for(int64_t i = precalc_k; i < k; i++){
+            // Prefetch the memory for the next step of all live searches
+            bool any_live = false;
+            for(int64_t j = 0; j < m; j++){
+                if(I[j].first == -1) continue;
+                char c = group[j][i];
+                if(DNA_to_char_idx(c) == -1){ // Invalid character
+                    I[j] = {-1,-1};
+                    continue;
+                }
+                subset_rank.prefetch(I[j].first, c);
+                subset_rank.prefetch(I[j].second+1, c);
+                any_live = true;
+            }
+            if(!any_live) break;
+
+            // Take the step
+            for(int64_t j = 0; j < m; j++){
+                if(I[j].first == -1) continue;
+                char c = group[j][i];
+                int64_t char_idx = DNA_to_char_idx(c);
+                I[j].first = C[char_idx] + rank_char_idx(I[j].first, char_idx);
+                I[j].second = C[char_idx] + rank_char_idx(I[j].second+1, char_idx) - 1;
+                if(I[j].first > I[j].second) I[j] = {-1,-1}; // Not found
+            }
+        }
+
+        for(int64_t j = 0; j < m; j++){
+            if(I[j].first != I[j].second){
+                cerr << "Bug: k-mer search did not give a singleton interval: " << I[j].first << " " << I[j].second << endl;
+                exit(1);
+            }
+            out[group_start + j] = I[j].first;
+        }
+    }
+}
+
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::search_char_indices(const uint8_t* char_indices) const{
+    pair<int64_t, int64_t> I = {0, n_nodes-1};
+    int64_t i = 0;
+    if(precalc_k > 0){
+        I = kmer_prefix_precalc[pack_char_indices(char_indices, precalc_k)];
+        i = precalc_k;
+    }
+
+    for(; i < k && I.first != -1; i++){
+        int64_t char_idx = char_indices[i];
+        I.first = C[char_idx] + rank_char_idx(I.first, char_idx);
+        I.second = C[char_idx] + rank_char_idx(I.second+1, char_idx) - 1;
+        if(I.first > I.second) return -1; // Not found
+    }
+    return I.first;
+}
+
 template<typename subset_rank_t>
 std::pair<int64_t,int64_t> SBWT<subset_rank_t>::update_sbwt_interval(const string& S, pair<int64_t,int64_t> I) const{
     return update_sbwt_interval(S.c_str(), S.size(), I);
@@ -423,12 +979,11 @@ template<typename subset_rank_t>
 std::pair<int64_t,int64_t> SBWT<subset_rank_t>::update_sbwt_interval(const char* S, int64_t S_length, pair<int64_t,int64_t> I) const{
     if(I.first == -1) return I;
     for(int64_t i = 0; i < S_length; i++){
-        char c = toupper(S[i]);
         int64_t char_idx = get_char_idx(S[i]);
         if(char_idx == -1) return {-1,-1}; // Invalid character
 
-        I.first = C[char_idx] + subset_rank.rank(I.first, c);
-        I.second = C[char_idx] + subset_rank.rank(I.second+1, c) - 1;
+        I.first = C[char_idx] + rank_char_idx(I.first, char_idx);
+        I.second = C[char_idx] + rank_char_idx(I.second+1, char_idx) - 1;
 
         if(I.first > I.second) return {-1,-1}; // Not found
     }
@@ -437,27 +992,96 @@ std::pair<int64_t,int64_t> SBWT<subset_rank_t>::update_sbwt_interval(const char*
 }
 
 
-// Utility function: Serialization for a std::vector
-// Returns number of bytes written
-template<typename T>
-int64_t serialize_std_vector(const vector<T>& v, ostream& os){
-    // Write C-array
-    int64_t n_bytes = sizeof(T) * v.size();
-    os.write((char*)&n_bytes, sizeof(n_bytes));
-    os.write((char*)v.data(), n_bytes);
-    return sizeof(n_bytes) + n_bytes;
+
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::serialize_section(SBWTSection section, ostream& os) const{
+    switch(section){
+        case SBWTSection::SUBSET_RANK:
+            subset_rank.serialize(os);
+            break;
+        case SBWTSection::STREAMING_SUPPORT:
+            suffix_group_starts.serialize(os);
+            break;
+        case SBWTSection::C_ARRAY:
+            serialize_std_vector(C, os);
+            break;
+        case SBWTSection::PRECALC:
+            os.write((char*)&precalc_k, sizeof(precalc_k));
+            kmer_prefix_precalc.serialize(os);
+            break;
+        case SBWTSection::METADATA:
+            os.write((char*)&n_nodes, sizeof(n_nodes));
+            os.write((char*)&n_kmers, sizeof(n_kmers));
+            os.write((char*)&k, sizeof(k));
+            break;
+        case SBWTSection::LCS:
+            lcs.serialize(os);
+            break;
+        case SBWTSection::DUMMY_MARKS:
+            dummy_marks.serialize(os);
+            break;
+        case SBWTSection::COUNTS:
+            counts.serialize(os);
+            break;
+    }
 }
 
-template<typename T>
-vector<T> load_std_vector(istream& is){
-    int64_t n_bytes = 0;
-    is.read((char*)&n_bytes, sizeof(n_bytes));
-    assert(n_bytes % sizeof(T) == 0);
-    vector<T> v(n_bytes / sizeof(T));
-    is.read((char*)(v.data()), n_bytes);
-    return v;
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::load_section(SBWTSection section, istream& is){
+    switch(section){
+        case SBWTSection::SUBSET_RANK:
+            subset_rank.load(is);
+            break;
+        case SBWTSection::STREAMING_SUPPORT:
+            suffix_group_starts.load(is);
+            break;
+        case SBWTSection::C_ARRAY:
+            C = load_std_vector<int64_t>(is);
+            break;
+        case SBWTSection::PRECALC:
+            is.read((char*)&precalc_k, sizeof(precalc_k));
+            kmer_prefix_precalc.load(is);
+            break;
+        case SBWTSection::METADATA:
+            is.read((char*)&n_nodes, sizeof(n_nodes));
+            is.read((char*)&n_kmers, sizeof(n_kmers));
+            is.read((char*)&k, sizeof(k));
+            break;
+        case SBWTSection::LCS:
+            lcs.load(is);
+            break;
+        case SBWTSection::DUMMY_MARKS:
+            dummy_marks.load(is);
+            break;
+        case SBWTSection::COUNTS:
+            counts.load(is);
+            break;
+    }
 }
 
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::finish_loading_sections(bool streaming_support_loaded, bool precalc_loaded, bool lcs_loaded, bool dummy_marks_loaded, bool counts_loaded){
+    if(!streaming_support_loaded) suffix_group_starts = sdsl::bit_vector();
+    suffix_group_start_support = SuffixGroupStartSupport(suffix_group_starts);
+    if(!precalc_loaded){
+        kmer_prefix_precalc = PrecalcTable();
+        precalc_k = 0;
+    }
+    if(!lcs_loaded) lcs = sdsl::int_vector<>();
+    lcs_support = SmallerValueSupport(lcs);
+    if(!dummy_marks_loaded) dummy_marks = DummyNodeMarks();
+    if(!counts_loaded) counts = sdsl::int_vector<>();
+}
+
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::write_section_table(const vector<SBWTSection>& sections, const vector<int64_t>& sizes, ostream& os) const{
+    int64_t offset = 0;
+    for(int64_t i = 0; i < (int64_t)sections.size(); i++){
+        int64_t entry[3] = {(int64_t)sections[i], offset, sizes[i]};
+        os.write((char*)entry, sizeof(entry));
+        offset += sizes[i];
+    }
+}
 
 template <typename subset_rank_t>
 int64_t SBWT<subset_rank_t>::serialize(ostream& os) const{
@@ -465,54 +1089,244 @@ int64_t SBWT<subset_rank_t>::serialize(ostream& os) const{
 
     written += serialize_string(SBWT_VERSION, os);
 
-    written += subset_rank.serialize(os);
-    written += suffix_group_starts.serialize(os);
+    vector<SBWTSection> sections = {SBWTSection::METADATA, SBWTSection::C_ARRAY, SBWTSection::SUBSET_RANK, 
+                                    SBWTSection::STREAMING_SUPPORT, SBWTSection::PRECALC, SBWTSection::LCS, SBWTSection::DUMMY_MARKS, SBWTSection::COUNTS};
+
+    // Section table: the number of sections, followed by (id, offset, size) for each section. The
+    // offsets are relative to the end of the table, and the sections are in the order of the table.
+    int64_t n_sections = sections.size();
+    os.write((char*)&n_sections, sizeof(n_sections));
+    written += sizeof(n_sections);
+    vector<int64_t> sizes(n_sections);
+    int64_t table_start = os.tellp();
+    if(table_start != -1){
+        // Write a placeholder table, measure the sections while writing them, and patch the table
+        vector<int64_t> table(3 * n_sections, 0);
+        os.write((char*)table.data(), table.size() * sizeof(int64_t));
+        for(int64_t i = 0; i < n_sections; i++){
+            int64_t start = os.tellp();
+            serialize_section(sections[i], os);
+            sizes[i] = (int64_t)os.tellp() - start;
+        }
+        int64_t end = os.tellp();
+        os.seekp(table_start);
+        write_section_table(sections, sizes, os);
+        os.seekp(end);
+    } else{
+        // The stream is not seekable: buffer each section to know its size
+        vector<string> buffers(n_sections);
+        for(int64_t i = 0; i < n_sections; i++){
+            stringstream buffer;
+            serialize_section(sections[i], buffer);
+            buffers[i] = buffer.str();
+            sizes[i] = buffers[i].size();
+        }
+        write_section_table(sections, sizes, os);
+        for(const string& buffer : buffers) os.write(buffer.data(), buffer.size());
+    }
+    if(!os.good()) throw std::runtime_error("Error writing the SBWT");
+    written += 3 * n_sections * sizeof(int64_t);
+    for(int64_t size : sizes) written += size;
 
-    written += serialize_std_vector(C, os);
+    return written;
+}
 
-    // Write precalc
-    written += serialize_std_vector(kmer_prefix_precalc, os);
-    os.write((char*)&precalc_k, sizeof(precalc_k));
-    written += sizeof(precalc_k);
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::serialize(const string& filename) const{
+    throwing_ofstream out(filename, ios::binary);
+    return serialize(out.stream);
+}
 
-    // Write number of nodes
-    os.write((char*)&n_nodes, sizeof(n_nodes));
-    written += sizeof(n_nodes);
 
-    // Write number of k-mers
-    os.write((char*)&n_kmers, sizeof(n_kmers));
-    written += sizeof(n_kmers);
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::serialize_mappable(ostream& os) const{
+    if constexpr(has_mappable_layout<subset_rank_t>::value){
+        int64_t start = os.tellp();
+        if(start < 0) throw std::runtime_error("Error: the mappable layout needs an output stream that supports tellp");
+
+        // The small parts go to the meta section
+        stringstream meta;
+        serialize_std_vector(C, meta);
+        kmer_prefix_precalc.serialize(meta);
+        meta.write((char*)&precalc_k, sizeof(precalc_k));
+        meta.write((char*)&n_nodes, sizeof(n_nodes));
+        meta.write((char*)&n_kmers, sizeof(n_kmers));
+        meta.write((char*)&k, sizeof(k));
+        lcs.serialize(meta);
+        dummy_marks.serialize(meta);
+        counts.serialize(meta);
+        suffix_group_start_support.serialize_header(meta);
+        string meta_bytes = meta.str();
+
+        auto page_align = [](int64_t x){return (x + MMAP_PAGE_SIZE - 1) / MMAP_PAGE_SIZE * MMAP_PAGE_SIZE;};
+        MappableLayout L;
+        L.meta_offset = start + (int64_t)(sizeof(int64_t) + SBWT_VERSION_MAPPABLE.size()) + (int64_t)sizeof(L);
+        L.meta_bytes = meta_bytes.size();
+        L.blocks_offset = page_align(L.meta_offset + L.meta_bytes);
+        L.blocks_bytes = subset_rank.blocks_size_in_bytes();
+        L.samples_offset = page_align(L.blocks_offset + L.blocks_bytes);
+        L.samples_bytes = suffix_group_start_support.words_size_in_bytes();
+
+        auto pad_to = [&os](int64_t pos){
+            string zeros(pos - (int64_t)os.tellp(), '\0');
+            os.write(zeros.data(), zeros.size());
+        };
+
+        serialize_string(SBWT_VERSION_MAPPABLE, os);
+        os.write((char*)&L, sizeof(L));
+        os.write(meta_bytes.data(), meta_bytes.size());
+        pad_to(L.blocks_offset);
+        subset_rank.serialize_blocks(os);
+        pad_to(L.samples_offset);
+        suffix_group_start_support.serialize_words(os);
+        return L.samples_offset + L.samples_bytes - start;
+    } else{
+        throw std::runtime_error("Error: the memory-mappable layout is not supported by this SBWT variant");
+    }
+}
 
-    // Write k
-    os.write((char*)&k, sizeof(k));
-    written += sizeof(k);
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::serialize_mappable(const string& filename) const{
+    throwing_ofstream out(filename, ios::binary);
+    return serialize_mappable(out.stream);
+}
 
-    return written;
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::load_mappable_meta(istream& is){
+    C = load_std_vector<int64_t>(is);
+    kmer_prefix_precalc.load(is);
+    is.read((char*)&precalc_k, sizeof(precalc_k));
+    is.read((char*)&n_nodes, sizeof(n_nodes));
+    is.read((char*)&n_kmers, sizeof(n_kmers));
+    is.read((char*)&k, sizeof(k));
+    lcs.load(is);
+    lcs_support = SmallerValueSupport(lcs);
+    dummy_marks.load(is);
+    counts.load(is);
+    suffix_group_start_support.load_header(is);
 }
 
 template <typename subset_rank_t>
-int64_t SBWT<subset_rank_t>::serialize(const string& filename) const{
-    throwing_ofstream out(filename, ios::binary);
-    return serialize(out.stream);
+void SBWT<subset_rank_t>::load_mappable(istream& is, int64_t start){
+    if constexpr(has_mappable_layout<subset_rank_t>::value){
+        if(start < 0) throw std::runtime_error("Error: loading the mappable layout needs an input stream that supports tellg");
+        MappableLayout L;
+        is.read((char*)&L, sizeof(L));
+        load_mappable_meta(is);
+        // Skip the padding before the sections
+        int64_t pos = is.tellg();
+        is.ignore(L.blocks_offset - pos);
+        subset_rank.load_blocks(is, n_nodes);
+        pos = is.tellg();
+        is.ignore(L.samples_offset - pos);
+        suffix_group_start_support.load_words(is, L.samples_bytes);
+
+        suffix_group_starts = sdsl::bit_vector();
+        if(has_streaming_query_support()) suffix_group_starts = subset_rank.get_suffix_group_starts();
+    } else{
+        throw std::runtime_error("Error: the index is in the memory-mappable layout, which is not supported by this SBWT variant");
+    }
 }
 
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::load_mmap(const string& filename, int64_t offset){
+    if constexpr(has_mappable_layout<subset_rank_t>::value){
+        auto file = std::make_shared<const MappedFile>(filename);
+        if(offset < 0 || offset > file->size()) throw std::runtime_error("Error: invalid offset for loading " + filename);
+        MemoryStreamBuf buf(file->data() + offset, file->data() + file->size());
+        istream is(&buf);
+        is.exceptions(istream::failbit | istream::badbit); // Truncated file
+
+        string version = load_string(is);
+        if(version != SBWT_VERSION_MAPPABLE)
+            throw std::runtime_error("Error: " + filename + " is not in the memory-mappable layout. Write the index with serialize_mappable (sbwt build --mappable).");
+        MappableLayout L;
+        is.read((char*)&L, sizeof(L));
+        load_mappable_meta(is);
+
+        subset_rank.map_blocks(file, L.blocks_offset, n_nodes);
+        suffix_group_start_support.map_words(file, L.samples_offset, L.samples_bytes);
+        suffix_group_starts = sdsl::bit_vector(); // The marks are in the blocks
+    } else{
+        throw std::runtime_error("Error: memory-mapped loading is not supported by this SBWT variant");
+    }
+}
 
 template <typename subset_rank_t>
 void SBWT<subset_rank_t>::load(istream& is){
+    load(is, LoadConfig());
+}
+
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::load(istream& is, const LoadConfig& config){
+    int64_t start = is.tellg();
     string version = load_string(is);
-    if(version != SBWT_VERSION){
+    if(version == SBWT_VERSION_MAPPABLE){
+        load_mappable(is, start);
+        return;
+    }
+    if(version == SBWT_VERSION){
+        int64_t n_sections = 0;
+        is.read((char*)&n_sections, sizeof(n_sections));
+        vector<array<int64_t, 3>> table(n_sections); // (id, offset, size)
+        for(int64_t i = 0; i < n_sections; i++) is.read((char*)table[i].data(), 3 * sizeof(int64_t));
+        if(!is.good()) throw std::runtime_error("Error: Corrupt index file: could not read the section table");
+
+        bool seekable = is.tellg() != -1;
+        int64_t pos = 0; // Relative to the end of the table
+        bool loaded[9] = {false, false, false, false, false, false, false, false, false};
+        for(auto [id, offset, size] : table){
+            bool wanted = (id == (int64_t)SBWTSection::SUBSET_RANK || id == (int64_t)SBWTSection::C_ARRAY || id == (int64_t)SBWTSection::METADATA)
+                       || (id == (int64_t)SBWTSection::STREAMING_SUPPORT && config.streaming_support)
+                       || (id == (int64_t)SBWTSection::PRECALC && config.precalc)
+                       || (id == (int64_t)SBWTSection::LCS && config.lcs)
+                       || (id == (int64_t)SBWTSection::DUMMY_MARKS && config.dummy_marks)
+                       || (id == (int64_t)SBWTSection::COUNTS && config.counts);
+            if(!wanted) continue; // Also skips unknown sections
+            if(offset != pos){ // Skip to the section
+                if(seekable) is.seekg(offset - pos, ios::cur);
+                else is.ignore(offset - pos);
+            }
+            load_section((SBWTSection)id, is);
+            loaded[id] = true;
+            pos = offset + size;
+        }
+        if(!loaded[(int64_t)SBWTSection::SUBSET_RANK] || !loaded[(int64_t)SBWTSection::C_ARRAY] || !loaded[(int64_t)SBWTSection::METADATA])
+            throw std::runtime_error("Error: Corrupt index file: a required section is missing");
+        finish_loading_sections(loaded[(int64_t)SBWTSection::STREAMING_SUPPORT], loaded[(int64_t)SBWTSection::PRECALC], loaded[(int64_t)SBWTSection::LCS], loaded[(int64_t)SBWTSection::DUMMY_MARKS], loaded[(int64_t)SBWTSection::COUNTS]);
+        return;
+    }
+
+    // Older formats without the section table
+    if(version != SBWT_VERSION_FLAT && version != SBWT_VERSION_NO_LCS && version != SBWT_VERSION_UNCOMPRESSED_PRECALC){
         throw std::runtime_error("Error: Corrupt index file, or the index was constructed with an incompatible version of SBWT.");
     }
 
     subset_rank.load(is);
     suffix_group_starts.load(is);
+    suffix_group_start_support = SuffixGroupStartSupport(suffix_group_starts);
     C = load_std_vector<int64_t>(is);
-    kmer_prefix_precalc = load_std_vector<pair<int64_t, int64_t>>(is);
+    if(version == SBWT_VERSION_UNCOMPRESSED_PRECALC){
+        // Compress the old table while reading it, without loading it all into memory
+        int64_t n_bytes = 0;
+        is.read((char*)&n_bytes, sizeof(n_bytes));
+        kmer_prefix_precalc = PrecalcTable(n_bytes / sizeof(pair<int64_t, int64_t>), [&](int64_t i){
+            pair<int64_t, int64_t> I;
+            is.read((char*)&I, sizeof(I));
+            return I;
+        });
+    } else kmer_prefix_precalc.load(is);
     is.read((char*)&precalc_k, sizeof(precalc_k));
     is.read((char*)&n_nodes, sizeof(n_nodes));
     is.read((char*)&n_kmers, sizeof(n_kmers));
     is.read((char*)&k, sizeof(k));
 
+    if(version == SBWT_VERSION_FLAT) lcs.load(is);
+    else lcs = sdsl::int_vector<>(); // Older formats do not have the LCS array
+    lcs_support = SmallerValueSupport(lcs);
+    dummy_marks = DummyNodeMarks(); // Older formats do not store the dummy marks
+    counts = sdsl::int_vector<>(); // or the counts
+
 }
 
 template <typename subset_rank_t>
@@ -521,6 +1335,67 @@ void SBWT<subset_rank_t>::load(const string& filename){
     load(in.stream);
 }
 
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::load(const string& filename, const LoadConfig& config, int64_t offset){
+    throwing_ifstream in(filename, ios::binary);
+    in.stream.seekg(offset);
+    if(config.n_threads <= 1){
+        load(in.stream, config);
+        return;
+    }
+
+    // Read the section table and then each wanted section in its own thread from its own stream
+    int64_t start = in.stream.tellg();
+    string version = load_string(in.stream);
+    if(version != SBWT_VERSION){ // Older formats must be read sequentially
+        in.stream.seekg(start);
+        load(in.stream, config);
+        return;
+    }
+    int64_t n_sections = 0;
+    in.stream.read((char*)&n_sections, sizeof(n_sections));
+    vector<array<int64_t, 3>> table(n_sections); // (id, offset, size)
+    for(int64_t i = 0; i < n_sections; i++) in.stream.read((char*)table[i].data(), 3 * sizeof(int64_t));
+    if(!in.stream.good()) throw std::runtime_error("Error: Corrupt index file: could not read the section table");
+    int64_t data_start = in.stream.tellg();
+
+    vector<SBWTSection> to_load = {SBWTSection::SUBSET_RANK, SBWTSection::C_ARRAY, SBWTSection::METADATA};
+    if(config.streaming_support) to_load.push_back(SBWTSection::STREAMING_SUPPORT);
+    if(config.precalc) to_load.push_back(SBWTSection::PRECALC);
+    if(config.lcs) to_load.push_back(SBWTSection::LCS);
+    if(config.dummy_marks) to_load.push_back(SBWTSection::DUMMY_MARKS);
+    if(config.counts) to_load.push_back(SBWTSection::COUNTS);
+
+    bool loaded[9] = {false, false, false, false, false, false, false, false, false};
+    vector<std::thread> threads;
+    std::mutex error_mutex;
+    string error;
+    for(auto [id, section_offset, size] : table){
+        if(std::find(to_load.begin(), to_load.end(), (SBWTSection)id) == to_load.end()) continue;
+        loaded[id] = true;
+        threads.emplace_back([&, id = id, section_offset = section_offset](){
+            try{
+                throwing_ifstream section_in(filename, ios::binary);
+                section_in.stream.seekg(data_start + section_offset);
+                load_section((SBWTSection)id, section_in.stream); // Sections are independent members
+            } catch(const std::exception& e){
+                std::lock_guard<std::mutex> lock(error_mutex);
+                error = e.what();
+            }
+        });
+        if((int64_t)threads.size() >= config.n_threads){ // Wait for the batch to finish
+            for(std::thread& t : threads) t.join();
+            threads.clear();
+        }
+    }
+    for(std::thread& t : threads) t.join();
+    if(error != "") throw std::runtime_error(error);
+
+    if(!loaded[(int64_t)SBWTSection::SUBSET_RANK] || !loaded[(int64_t)SBWTSection::C_ARRAY] || !loaded[(int64_t)SBWTSection::METADATA])
+        throw std::runtime_error("Error: Corrupt index file: a required section is missing");
+    finish_loading_sections(loaded[(int64_t)SBWTSection::STREAMING_SUPPORT], loaded[(int64_t)SBWTSection::PRECALC], loaded[(int64_t)SBWTSection::LCS], loaded[(int64_t)SBWTSection::DUMMY_MARKS], loaded[(int64_t)SBWTSection::COUNTS]);
+}
+
 
 template <typename subset_rank_t>
 std::pair<std::pair<int64_t, int64_t>, int64_t> SBWT<subset_rank_t>::partial_search(const char* input, int64_t len) const{
@@ -542,44 +1417,148 @@ std::pair<std::pair<int64_t, int64_t>, int64_t> SBWT<subset_rank_t>::partial_sea
 }
 
 template <typename subset_rank_t>
-vector<int64_t> SBWT<subset_rank_t>::streaming_search(const char* input, int64_t len) const{
-    if(suffix_group_starts.size() == 0)
+void SBWT<subset_rank_t>::encode_input(const char* input, int64_t len, vector<uint8_t>& codes, vector<uint64_t>& invalid_mask){
+    // resize does not reallocate if the capacity is large enough
+    if((int64_t)codes.size() < len) codes.resize(len);
+    if((int64_t)invalid_mask.size() < (len + 63) / 64) invalid_mask.resize((len + 63) / 64);
+    encode_DNA(input, len, codes.data(), invalid_mask.data());
+}
+
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::streaming_search_step(const uint8_t* codes, const uint64_t* invalid_mask, int64_t i, int64_t prev_rank) const{
+    if(i == 0 || prev_rank == -1){
+        // Need to search from scratch
+        if(has_invalid_chars(invalid_mask, i, i + k)) return -1;
+        return search_char_indices(codes + i);
+    }
+
+    // Got to the start of the suffix group and do one search iteration
+    int64_t column = get_suffix_group_start(prev_rank);
+
+    if(has_invalid_chars(invalid_mask, i + k - 1, i + k)) return -1; // Not found
+    int64_t char_idx = codes[i+k-1];
+
+    int64_t node_left = column;
+    int64_t node_right = column;
+    node_left = C[char_idx] + rank_char_idx(node_left, char_idx);
+    node_right = C[char_idx] + rank_char_idx(node_right+1, char_idx) - 1;
+    if(node_left == node_right) return node_left;
+    else return -1;
+    // Todo: could save one subset rank query if we have fast access to the SBWT columns
+}
+
+template <typename subset_rank_t>
+template <typename out_iterator_t>
+int64_t SBWT<subset_rank_t>::streaming_search(const char* input, int64_t len, out_iterator_t out) const{
+    QueryContext context;
+    return streaming_search(input, len, out, context);
+}
+
+template <typename subset_rank_t>
+template <typename out_iterator_t>
+int64_t SBWT<subset_rank_t>::streaming_search(const char* input, int64_t len, out_iterator_t out, QueryContext& context) const{
+    if(!has_streaming_query_support())
         throw std::runtime_error("Error: streaming search support not built");
-    
+
+    if(len < k) return 0;
+
+    encode_input(input, len, context.codes, context.invalid_mask);
+    int64_t prev_rank = -1;
+    for(int64_t i = 0; i < len - k + 1; i++){
+        prev_rank = streaming_search_step(context.codes.data(), context.invalid_mask.data(), i, prev_rank);
+        *out = prev_rank;
+        ++out;
+    }
+    return len - k + 1;
+}
+
+template <typename subset_rank_t>
+template <typename callback_t>
+int64_t SBWT<subset_rank_t>::streaming_search_with_callback(const char* input, int64_t len, const callback_t& callback) const{
+    QueryContext context;
+    return streaming_search_with_callback(input, len, callback, context);
+}
+
+template <typename subset_rank_t>
+template <typename callback_t>
+int64_t SBWT<subset_rank_t>::streaming_search_with_callback(const char* input, int64_t len, const callback_t& callback, QueryContext& context) const{
+    if(!has_streaming_query_support())
+        throw std::runtime_error("Error: streaming search support not built");
+
+    if(len < k) return 0;
+
+    encode_input(input, len, context.codes, context.invalid_mask);
+    int64_t prev_rank = -1;
+    for(int64_t i = 0; i < len - k + 1; i++){
+        prev_rank = streaming_search_step(context.codes.data(), context.invalid_mask.data(), i, prev_rank);
+        if(!callback(i, prev_rank)) return i + 1;
+    }
+    return len - k + 1;
+}
+
+template <typename subset_rank_t>
+vector<int64_t> SBWT<subset_rank_t>::streaming_search(const char* input, int64_t len) const{
     vector<int64_t> ans;
-    if(len < k) return ans;
+    ans.reserve(max(len - k + 1, (int64_t)0));
+    streaming_search(input, len, std::back_inserter(ans));
+    return ans;
+}
 
-    // Search the first k-mer
-    const char* first_kmer_start = input;
-    ans.push_back(search(first_kmer_start)); 
+template <typename subset_rank_t>
+template <typename out_iterator_t>
+int64_t SBWT<subset_rank_t>::streaming_search_both_strands(const char* input, int64_t len, out_iterator_t out, QueryContext& context) const{
+    if(!has_streaming_query_support())
+        throw std::runtime_error("Error: streaming search support not built");
 
-    for(int64_t i = 1; i < len - k + 1; i++){
-        if(ans.back() == -1){
-            // Need to search from scratch
-            ans.push_back(search(first_kmer_start + i));
-        } else{
-            // Got to the start of the suffix group and do one search iteration
-            int64_t column = ans.back();
-            while(suffix_group_starts[column] == 0) column--; // can not go negative because the first column is always marked
-
-            char c = toupper(input[i+k-1]);
-            int64_t char_idx = get_char_idx(c);
-        
-            if(char_idx == -1) ans.push_back(-1); // Not found
-            else{
-                int64_t node_left = column;
-                int64_t node_right = column;
-                node_left = C[char_idx] + subset_rank.rank(node_left, c);
-                node_right = C[char_idx] + subset_rank.rank(node_right+1, c) - 1;
-                if(node_left == node_right) ans.push_back(node_left);
-                else ans.push_back(-1);
-                // Todo: could save one subset rank query if we have fast access to the SBWT columns
-            }
-        }
+    if(len < k) return 0;
+    int64_t n_kmers = len - k + 1;
+
+    // resize does not reallocate if the capacity is large enough
+    context.rc_input.resize(len);
+    context.ranks.resize(n_kmers);
+    context.rc_ranks.resize(n_kmers);
+
+    for(int64_t i = 0; i < len; i++) context.rc_input[i] = get_rc(input[len-1-i]);
+    encode_input(input, len, context.codes, context.invalid_mask);
+    encode_input(context.rc_input.c_str(), len, context.rc_codes, context.rc_invalid_mask);
+    const uint8_t* codes = context.codes.data();
+    const uint64_t* invalid_mask = context.invalid_mask.data();
+    const uint8_t* rc_codes = context.rc_codes.data();
+    const uint64_t* rc_invalid_mask = context.rc_invalid_mask.data();
+
+    // The k-mer starting at i in the reverse complement is the reverse complement
+    // of the k-mer starting at n_kmers-1-i in the input.
+    int64_t prev_rank = -1;
+    int64_t prev_rc_rank = -1;
+    for(int64_t i = 0; i < n_kmers; i++){
+        prev_rank = streaming_search_step(codes, invalid_mask, i, prev_rank);
+        prev_rc_rank = streaming_search_step(rc_codes, rc_invalid_mask, i, prev_rc_rank);
+        context.ranks[i] = prev_rank;
+        context.rc_ranks[n_kmers-1-i] = prev_rc_rank;
+    }
+
+    for(int64_t i = 0; i < n_kmers; i++){
+        *out = context.ranks[i] != -1 ? context.ranks[i] : context.rc_ranks[i];
+        ++out;
     }
+
+    return n_kmers;
+}
+
+template <typename subset_rank_t>
+vector<int64_t> SBWT<subset_rank_t>::streaming_search_both_strands(const char* input, int64_t len) const{
+    QueryContext context;
+    vector<int64_t> ans;
+    ans.reserve(max(len - k + 1, (int64_t)0));
+    streaming_search_both_strands(input, len, std::back_inserter(ans), context);
     return ans;
 }
 
+template <typename subset_rank_t>
+vector<int64_t> SBWT<subset_rank_t>::streaming_search_both_strands(const string& input) const{
+    return streaming_search_both_strands(input.c_str(), input.size());
+}
+
 template <typename subset_rank_t>
 vector<int64_t> SBWT<subset_rank_t>::streaming_search(const string& input) const{
     return streaming_search(input.c_str(), input.size());
@@ -587,26 +1566,24 @@ vector<int64_t> SBWT<subset_rank_t>::streaming_search(const string& input) const
 
 template <typename subset_rank_t>
 sdsl::bit_vector SBWT<subset_rank_t>::compute_dummy_node_marks() const{
-    int64_t count = 0;
-    vector<pair<int64_t,int64_t>> dfs_stack; // pairs (node, depth)
-    dfs_stack.push_back({0, 0}); // Root node
-    // dfs to depth k-1
-    // the dummy part is a tree so no visited-list is required
+    if(!dummy_marks.empty()) return dummy_marks.get_marks();
 
-    string ACGT = "ACGT";
+    // The dummy nodes are the nodes at depth less than k from the root, and they form a tree,
+    // so no visited-list is required. A dummy node is the colexicographically first node of its
+    // suffix group, so its out-edges are stored at the node itself and can be followed with plain
+    // rank queries, without the streaming support.
+    vector<pair<int64_t,int64_t>> dfs_stack; // pairs (node, depth)
+    if(n_nodes > 0) dfs_stack.push_back({0, 0}); // Root node
     sdsl::bit_vector marks(n_nodes, 0);
     int64_t v,d; // node,depth
     while(!dfs_stack.empty()){
         tie(v,d) = dfs_stack.back();
         dfs_stack.pop_back();
-        if(d < k){
-            count++;
-            marks[v] = 1;
-        }
+        marks[v] = 1;
         if(d < k-1){ // Push children
-            for(char c : ACGT){
-                int64_t u = forward(v, c);
-                if(u != -1) dfs_stack.push_back({u,d+1});
+            for(int64_t c = 0; c < 4; c++){
+                int64_t r = rank_char_idx(v, c);
+                if(rank_char_idx(v+1, c) > r) dfs_stack.push_back({C[c] + r, d+1});
             }
         }
     }
@@ -617,84 +1594,270 @@ template <typename subset_rank_t>
 void SBWT<subset_rank_t>::do_kmer_prefix_precalc(int64_t prefix_length){
     if(prefix_length == 0) return;
     if(prefix_length > 20){
-        throw std::runtime_error("Error: Can't precalc longer than 20-mers (would take over 4^20 = 2^40 bytes");
+        throw std::runtime_error("Error: Can't precalc longer than 20-mers (would take over 4^20 = 2^40 table entries)");
     }
 
     if(prefix_length > k)
         throw std::runtime_error("Error: Precalc length is longer than k (" + to_string(prefix_length) + " > " + to_string(k) + ")");
     
-    uint64_t n_kmers_to_precalc = 1 << (2*prefix_length); // Four to the power prefix_length
-
-    // Initialize member variables
-    kmer_prefix_precalc.resize(n_kmers_to_precalc);
-    this->precalc_k = prefix_length;
+    uint64_t n_kmers_to_precalc = (uint64_t)1 << (2*prefix_length); // Four to the power prefix_length
 
-    uint64_t data = 0; // K-mer packed 2 bits per nucleotide
     string prefix(prefix_length, '\0');
 
-    while(n_kmers_to_precalc--){
+    // The table is built in order of the packed k-mers. Entry data has the i-th character
+    // of the prefix in bits 2i and 2i+1, so the order is colexicographic.
+    kmer_prefix_precalc = PrecalcTable(n_kmers_to_precalc, [&](int64_t data){
         for(int64_t i = 0; i < prefix_length; i++){
             char c = char_idx_to_DNA((data >> (2*i)) & 0x3); // Decode the i-th character
             prefix[i] = c;
         }
-
-        kmer_prefix_precalc[data] = update_sbwt_interval(prefix, {0, n_nodes-1});
-        data++;
-    }
+        return update_sbwt_interval(prefix, {0, n_nodes-1});
+    });
+    this->precalc_k = prefix_length;
 
 }
 
 template <typename subset_rank_t>
-string SBWT<subset_rank_t>::reconstruct_all_kmers() const {
-
-    int64_t n_nodes = this->number_of_subsets(); 
-    vector<int64_t> C_array(4);
-
+template <typename callback_t>
+void SBWT<subset_rank_t>::propagate_labels(const callback_t& callback) const{
     vector<char> last; // last[i] = incoming character to node i
     last.push_back('$');
+    for(char c : alphabet)
+        for(int64_t i = 0; i < n_nodes; i++) if(subset_rank.contains(i,c)) last.push_back(c);
 
-    C_array[0] = last.size();
-    for(int64_t i = 0; i < n_nodes; i++) if(subset_rank.contains(i,'A')) last.push_back('A');
+    if((int64_t)last.size() != n_nodes)
+        throw std::runtime_error("Error: the number of incoming edges does not match the number of nodes");
 
-    C_array[1] = last.size();
-    for(int64_t i = 0; i < n_nodes; i++) if(subset_rank.contains(i,'C')) last.push_back('C');
-
-    C_array[2] = last.size();
-    for(int64_t i = 0; i < n_nodes; i++) if(subset_rank.contains(i,'G')) last.push_back('G');
-    
-    C_array[3] = last.size();
-    for(int64_t i = 0; i < n_nodes; i++) if(subset_rank.contains(i,'T')) last.push_back('T');
+    vector<char> propagated(n_nodes);
+    for(int64_t round = 0; round < k; round++){
+        callback(round, last);
 
-    if(last.size() != n_nodes){
-        cerr << "BUG " << last.size() << " " << n_nodes << endl;
-        exit(1);
+        // Propagate the labels one step forward in the graph
+        std::fill(propagated.begin(), propagated.end(), '$');
+        int64_t ptr[4] = {C[0], C[1], C[2], C[3]};
+        for(int64_t i = 0; i < n_nodes; i++){
+            for(int64_t c = 0; c < 4; c++)
+                if(subset_rank.contains(i, alphabet[c])) propagated[ptr[c]++] = last[i];
+        }
+        last.swap(propagated);
     }
+}
 
+template <typename subset_rank_t>
+string SBWT<subset_rank_t>::reconstruct_all_kmers() const {
+    // All labels are in memory anyway, so they are filled one character position at a time
     string kmers_concat(n_nodes * k, '\0');
+    propagate_labels([&](int64_t round, const vector<char>& chars){
+        int64_t pos = k-1-round;
+        for(int64_t i = 0; i < n_nodes; i++) kmers_concat[i*k + pos] = chars[i];
+    });
+    return kmers_concat;
+}
 
-    for(int64_t round = 0; round < k; round++){
-        //cerr << "round " << round << "/" << k-1 << endl;
-        for(int64_t i = 0; i < n_nodes; i++){
+template <typename subset_rank_t>
+template <typename callback_t>
+void SBWT<subset_rank_t>::reconstruct_kmers_in_chunks(int64_t chunk_size, int64_t n_threads, callback_t callback) const{
+    if(chunk_size < 1 || n_threads < 1) throw std::invalid_argument("Chunk size and number of threads must be positive");
+
+    // pred[i] = the node with an edge to node i. The root has no incoming edge and is its own predecessor,
+    // so that walking back from a dummy node stays at the root, which has the label '$'.
+    uint8_t width = 1;
+    while(width < 64 && ((uint64_t)1 << width) < (uint64_t)n_nodes) width++;
+    sdsl::int_vector<> pred(n_nodes, 0, width);
+    int64_t ptr[4] = {C[0], C[1], C[2], C[3]};
+    for(int64_t i = 0; i < n_nodes; i++){
+        for(int64_t c = 0; c < 4; c++)
+            if(subset_rank.contains(i, alphabet[c])) pred[ptr[c]++] = i;
+    }
+    if(n_nodes > 0 && ptr[3] != n_nodes)
+        throw std::runtime_error("Error: the number of incoming edges does not match the number of nodes");
+
+    // The last character of the label of node v
+    auto incoming_char = [&](int64_t v){
+        if(v == 0) return '$';
+        int64_t c = 3;
+        while(C[c] > v) c--;
+        return alphabet[c];
+    };
+
+    // Walks back from all nodes of the chunk one step at a time, so that the memory accesses
+    // of different nodes are independent of each other.
+    auto reconstruct_chunk = [&](int64_t begin, int64_t end, vector<char>& buf, vector<int64_t>& nodes){
+        int64_t m = end - begin;
+        buf.resize(m * k);
+        nodes.resize(m);
+        for(int64_t j = 0; j < m; j++) nodes[j] = begin + j;
+        for(int64_t round = 0; round < k; round++){
             int64_t pos = k-1-round;
-            kmers_concat[i*k + pos] = last[i];
+            for(int64_t j = 0; j < m; j++){
+                buf[j*k + pos] = incoming_char(nodes[j]);
+                nodes[j] = pred[nodes[j]];
+            }
         }
+    };
 
-        // Propagate the labels one step forward in the graph
-        vector<char> propagated(n_nodes, '$');
-        int64_t A_ptr = C_array[0];
-        int64_t C_ptr = C_array[1];
-        int64_t G_ptr = C_array[2];
-        int64_t T_ptr = C_array[3];
-        for(int64_t i = 0; i < n_nodes; i++){
-            if(subset_rank.contains(i,'A')) propagated[A_ptr++] = last[i];
-            if(subset_rank.contains(i,'C')) propagated[C_ptr++] = last[i];
-            if(subset_rank.contains(i,'G')) propagated[G_ptr++] = last[i];
-            if(subset_rank.contains(i,'T')) propagated[T_ptr++] = last[i];
+    vector<vector<char>> bufs(n_threads);
+    vector<vector<int64_t>> node_bufs(n_threads);
+    for(int64_t batch_start = 0; batch_start < n_nodes; batch_start += chunk_size * n_threads){
+        int64_t n_chunks = min(n_threads, (n_nodes - batch_start + chunk_size - 1) / chunk_size);
+        auto chunk_begin = [&](int64_t t){return batch_start + t * chunk_size;};
+        auto chunk_end = [&](int64_t t){return min(n_nodes, batch_start + (t+1) * chunk_size);};
+        if(n_chunks == 1) reconstruct_chunk(chunk_begin(0), chunk_end(0), bufs[0], node_bufs[0]);
+        else{
+            vector<std::thread> threads;
+            for(int64_t t = 0; t < n_chunks; t++)
+                threads.emplace_back([&, t](){reconstruct_chunk(chunk_begin(t), chunk_end(t), bufs[t], node_bufs[t]);});
+            for(std::thread& thread : threads) thread.join();
         }
-        last = propagated;
+        for(int64_t t = 0; t < n_chunks; t++) callback(chunk_begin(t), chunk_end(t) - chunk_begin(t), (const char*)bufs[t].data());
     }
+}
 
-    return kmers_concat;
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::build_lcs(){
+    // Same label propagation as in reconstruct_all_kmers, but instead of storing the labels
+    // we only compare the characters of adjacent nodes in each round.
+    uint8_t width = 1;
+    while(width < 64 && ((uint64_t)1 << width) <= (uint64_t)k) width++;
+    sdsl::int_vector<> new_lcs(n_nodes, k, width); // Adjacent labels that never differ would share all k characters
+    sdsl::bit_vector decided(n_nodes, 0);
+    if(n_nodes > 0){
+        new_lcs[0] = 0;
+        decided[0] = 1;
+    }
+
+    propagate_labels([&](int64_t round, const vector<char>& chars){
+        for(int64_t i = 1; i < n_nodes; i++){
+            if(!decided[i] && chars[i] != chars[i-1]){
+                new_lcs[i] = round;
+                decided[i] = 1;
+            }
+        }
+    });
+
+    lcs = new_lcs;
+    lcs_support = SmallerValueSupport(lcs);
+}
+
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::set_lcs(const sdsl::int_vector<>& lcs_array){
+    if(lcs_array.size() != 0 && (int64_t)lcs_array.size() != n_nodes)
+        throw std::runtime_error("Error: LCS array length does not match the number of nodes");
+    lcs = lcs_array;
+    lcs_support = SmallerValueSupport(lcs);
+}
+
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::build_dummy_marks(){
+    dummy_marks = DummyNodeMarks(); // Otherwise compute_dummy_node_marks would return the stored marks
+    set_dummy_marks(compute_dummy_node_marks());
+}
+
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::set_dummy_marks(const sdsl::bit_vector& marks){
+    if(marks.size() != 0 && (int64_t)marks.size() != n_nodes)
+        throw std::runtime_error("Error: dummy mark vector length does not match the number of nodes");
+    dummy_marks = DummyNodeMarks(marks);
+    if(marks.size() != 0 && n_nodes - dummy_marks.rank(n_nodes) != n_kmers)
+        throw std::runtime_error("Error: the number of unmarked nodes does not match the number of k-mers");
+}
+
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::colex_rank_to_id(int64_t colex_rank) const{
+    if(!has_dummy_marks())
+        throw std::runtime_error("Error: dummy node marks not available");
+    if(colex_rank == -1 || dummy_marks.is_dummy(colex_rank)) return -1;
+    return colex_rank - dummy_marks.rank(colex_rank);
+}
+
+template <typename subset_rank_t>
+void SBWT<subset_rank_t>::set_counts(const sdsl::int_vector<>& counts_array){
+    if(counts_array.size() != 0 && (int64_t)counts_array.size() != n_kmers)
+        throw std::runtime_error("Error: count array length does not match the number of k-mers");
+    counts = counts_array;
+}
+
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::get_count(int64_t colex_rank) const{
+    if(!has_counts())
+        throw std::runtime_error("Error: k-mer counts not available");
+    int64_t id = colex_rank_to_id(colex_rank);
+    return id == -1 ? 0 : (int64_t)counts[id];
+}
+
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::search_id(const char* kmer) const{
+    return colex_rank_to_id(search(kmer));
+}
+
+template <typename subset_rank_t>
+int64_t SBWT<subset_rank_t>::search_id(const string& kmer) const{
+    return search_id(kmer.c_str());
+}
+
+template <typename subset_rank_t>
+vector<int64_t> SBWT<subset_rank_t>::streaming_search_ids(const char* input, int64_t len) const{
+    if(!has_dummy_marks())
+        throw std::runtime_error("Error: dummy node marks not available");
+    vector<int64_t> ans = streaming_search(input, len);
+    for(int64_t& x : ans) x = colex_rank_to_id(x);
+    return ans;
+}
+
+template <typename subset_rank_t>
+vector<int64_t> SBWT<subset_rank_t>::streaming_search_ids(const string& input) const{
+    return streaming_search_ids(input.c_str(), input.size());
+}
+
+template <typename subset_rank_t>
+template <typename out_iterator_t>
+int64_t SBWT<subset_rank_t>::matching_statistics(const char* input, int64_t len, out_iterator_t out) const{
+    if(!has_lcs())
+        throw std::runtime_error("Error: LCS array not built");
+
+    // Invariant: [l,r] is the colexicographic interval of the nodes whose labels end with
+    // the last d characters of the input processed so far.
+    int64_t l = 0, r = n_nodes-1, d = 0;
+    for(int64_t i = 0; i < len; i++){
+        int64_t char_idx = DNA_to_char_idx(input[i]);
+        if(char_idx == -1){
+            l = 0; r = n_nodes-1; d = 0;
+        } else{
+            while(true){
+                if(d < k){
+                    // Try to extend the match with the character
+                    int64_t new_l = C[char_idx] + rank_char_idx(l, char_idx);
+                    int64_t new_r = C[char_idx] + rank_char_idx(r+1, char_idx) - 1;
+                    if(new_l <= new_r){
+                        l = new_l; r = new_r; d++;
+                        break;
+                    }
+                    if(d == 0) break; // The character does not occur in the index
+                }
+
+                // Drop the first character of the match. The interval of the shorter suffix
+                // is the maximal run around [l,r] of nodes that share at least d-1 characters.
+                d--;
+                if(d == 0){
+                    l = 0; r = n_nodes-1;
+                } else{
+                    l = max((int64_t)0, lcs_support.prev_smaller(lcs, l, d));
+                    r = lcs_support.next_smaller(lcs, r+1, d) - 1;
+                }
+            }
+        }
+        *out = d;
+        ++out;
+    }
+    return len;
+}
+
+template <typename subset_rank_t>
+vector<int64_t> SBWT<subset_rank_t>::matching_statistics(const string& input) const{
+    vector<int64_t> ans;
+    ans.reserve(input.size());
+    matching_statistics(input.c_str(), input.size(), std::back_inserter(ans));
+    return ans;
 }
 
 template <typename subset_rank_t>
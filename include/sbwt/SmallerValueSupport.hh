@@ -0,0 +1,88 @@
+#pragma once
+
+#include <sdsl/int_vector.hpp>
+
+namespace sbwt{
+
+using namespace std;
+
+/*
+
+Previous and next smaller value queries on an integer array, used to widen the interval of a
+match in the LCS array. The array is split into blocks of 64 values, and the minima of the
+blocks are stored in the leaves of a complete binary tree where every internal node holds
+the minimum of its children. A query scans the block of the queried position, then walks
+the tree to the nearest block that has a smaller value, and scans that block. This takes
+O(log n) time and about 2 * width / 64 bits per value.
+
+The structure does not point to the array, so it is safe to copy and move along with it.
+
+*/
+
+class SmallerValueSupport{
+
+private:
+
+    static constexpr int64_t block_size = 64;
+
+    sdsl::int_vector<> tree; // tree[1] is the root, the leaves are at [n_leaves, 2*n_leaves). tree[0] is unused.
+    int64_t n_leaves = 0;
+
+public:
+
+    SmallerValueSupport(){}
+
+    SmallerValueSupport(const sdsl::int_vector<>& A){
+        int64_t n_blocks = (A.size() + block_size - 1) / block_size;
+        n_leaves = 1;
+        while(n_leaves < n_blocks) n_leaves *= 2;
+
+        // One more bit than in A, so that the padding leaves are larger than every value
+        uint8_t width = min(64, A.width() + 1);
+        uint64_t padding = width == 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+        tree = sdsl::int_vector<>(2 * n_leaves, padding, width);
+        for(int64_t i = 0; i < (int64_t)A.size(); i++){
+            int64_t leaf = n_leaves + i / block_size;
+            if(A[i] < tree[leaf]) tree[leaf] = A[i];
+        }
+        for(int64_t v = n_leaves - 1; v >= 1; v--) tree[v] = min(tree[2*v], tree[2*v+1]);
+    }
+
+    // Returns the largest j <= i such that A[j] < x, or -1 if there is none. A must be
+    // the array that this structure was built from.
+    int64_t prev_smaller(const sdsl::int_vector<>& A, int64_t i, uint64_t x) const{
+        int64_t block_start = i / block_size * block_size;
+        for(int64_t j = i; j >= block_start; j--) if(A[j] < x) return j;
+
+        // Find the last block before this one whose minimum is smaller than x
+        int64_t v = n_leaves + i / block_size;
+        while(v > 1 && !(v % 2 == 1 && tree[v-1] < x)) v /= 2;
+        if(v == 1) return -1;
+        v--;
+        while(v < n_leaves) v = tree[2*v+1] < x ? 2*v+1 : 2*v;
+
+        int64_t block_end = min((v - n_leaves + 1) * block_size, (int64_t)A.size());
+        for(int64_t j = block_end - 1; ; j--) if(A[j] < x) return j;
+    }
+
+    // Returns the smallest j >= i such that A[j] < x, or the length of A if there is none.
+    // A must be the array that this structure was built from.
+    int64_t next_smaller(const sdsl::int_vector<>& A, int64_t i, uint64_t x) const{
+        int64_t n = A.size();
+        if(i >= n) return n;
+        int64_t block_end = min((i / block_size + 1) * block_size, n);
+        for(int64_t j = i; j < block_end; j++) if(A[j] < x) return j;
+
+        // Find the first block after this one whose minimum is smaller than x
+        int64_t v = n_leaves + i / block_size;
+        while(v > 1 && !(v % 2 == 0 && tree[v+1] < x)) v /= 2;
+        if(v == 1) return n;
+        v++;
+        while(v < n_leaves) v = tree[2*v] < x ? 2*v : 2*v+1;
+
+        for(int64_t j = (v - n_leaves) * block_size; ; j++) if(A[j] < x) return j;
+    }
+
+};
+
+}
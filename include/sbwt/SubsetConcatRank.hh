@@ -31,6 +31,10 @@ class SubsetConcatRank{
         return r1 != r2;
     }
 
+    // Hint that rank(pos, c) will be called soon. This representation has
+    // no single memory location to prefetch, so this does nothing.
+    void prefetch(int64_t pos, char c) const{}
+
     SubsetConcatRank(){}
 
     SubsetConcatRank(const sdsl::bit_vector& A_bits, const sdsl::bit_vector& C_bits, const sdsl::bit_vector& G_bits, const sdsl::bit_vector& T_bits){
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <vector>
+#include <sdsl/bit_vectors.hpp>
+#include "globals.hh"
+#include "MappedFile.hh"
+
+namespace sbwt{
+
+using namespace std;
+
+/*
+
+A subset rank structure where the bits of all four characters and their rank counters
+are stored interleaved in cache-line sized blocks. Every block covers 64 consecutive
+sets and is laid out in 8 64-bit words as follows:
+
+  words 0-2: Four 48-bit counters. Counter c is the number of sets before the block that contain character c.
+  words 3-6: The bits of characters A, C, G and T for the 64 sets of the block, one word per character.
+  word 7:    The suffix group start marks of the 64 sets of the block, if they were given.
+
+A rank query for any character then needs to read only one block, which costs about one cache miss.
+The space is 8 bits per set, including the suffix group starts. The blocks can also be
+a read-only view into a memory-mapped file (see map_blocks).
+
+*/
+
+class SubsetInterleavedRank{
+
+    public:
+
+    struct alignas(64) Block{
+        uint64_t words[8];
+    };
+
+    private:
+
+    static const int64_t BITS_WORD = 3; // Index of the first character bit word in a block
+    static const int64_t GROUP_START_WORD = 7; // Index of the suffix group start word in a block
+    static const uint64_t COUNTER_MASK = ((uint64_t)1 << 48) - 1;
+
+    MappableArray<Block> blocks; // One extra block at the end so that rank(n) works for all n
+    int64_t n = 0; // Number of sets
+
+    static int64_t char_to_idx(char c){
+        switch(c){
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            default: return -1;
+        }
+    }
+
+    // Number of sets before block b that contain the character with index char_idx
+    static uint64_t get_counter(const Block& b, int64_t char_idx){
+        int64_t bit = 48 * char_idx;
+        int64_t word = bit / 64;
+        int64_t offset = bit % 64;
+        uint64_t x = b.words[word] >> offset;
+        if(offset > 16) x |= b.words[word+1] << (64 - offset); // Counter crosses a word boundary
+        return x & COUNTER_MASK;
+    }
+
+    static void set_counter(Block& b, int64_t char_idx, uint64_t value){
+        for(int64_t i = 0; i < 48; i++){
+            int64_t bit = 48 * char_idx + i;
+            uint64_t mask = (uint64_t)1 << (bit % 64);
+            if((value >> i) & 1) b.words[bit / 64] |= mask;
+            else b.words[bit / 64] &= ~mask;
+        }
+    }
+
+    void build(const sdsl::bit_vector& A_bits, const sdsl::bit_vector& C_bits, const sdsl::bit_vector& G_bits, const sdsl::bit_vector& T_bits, const sdsl::bit_vector* suffix_group_starts){
+        assert(A_bits.size() == C_bits.size() && C_bits.size() == G_bits.size() && G_bits.size() == T_bits.size());
+        n = A_bits.size();
+        if((uint64_t)n > COUNTER_MASK) throw std::runtime_error("Too many sets for the interleaved subset rank structure");
+
+        vector<Block> new_blocks(n / 64 + 1, Block{{0,0,0,0,0,0,0,0}});
+
+        const sdsl::bit_vector* bits[4] = {&A_bits, &C_bits, &G_bits, &T_bits};
+        uint64_t counts[4] = {0,0,0,0};
+        for(int64_t b = 0; b < (int64_t)new_blocks.size(); b++){
+            for(int64_t c = 0; c < 4; c++) set_counter(new_blocks[b], c, counts[c]);
+            for(int64_t i = b*64; i < min(n, (b+1)*64); i++){
+                uint64_t mask = (uint64_t)1 << (i % 64);
+                for(int64_t c = 0; c < 4; c++){
+                    if((*bits[c])[i]){
+                        new_blocks[b].words[BITS_WORD + c] |= mask;
+                        counts[c]++;
+                    }
+                }
+                if(suffix_group_starts != nullptr && (*suffix_group_starts)[i])
+                    new_blocks[b].words[GROUP_START_WORD] |= mask;
+            }
+        }
+        blocks = MappableArray<Block>(std::move(new_blocks));
+    }
+
+    public:
+
+    SubsetInterleavedRank(){}
+
+    SubsetInterleavedRank(const sdsl::bit_vector& A_bits, const sdsl::bit_vector& C_bits, const sdsl::bit_vector& G_bits, const sdsl::bit_vector& T_bits){
+        build(A_bits, C_bits, G_bits, T_bits, nullptr);
+    }
+
+    // Also stores the suffix group starts in the blocks. The vector can be empty, in which case it is not stored.
+    SubsetInterleavedRank(const sdsl::bit_vector& A_bits, const sdsl::bit_vector& C_bits, const sdsl::bit_vector& G_bits, const sdsl::bit_vector& T_bits, const sdsl::bit_vector& suffix_group_starts){
+        assert(suffix_group_starts.size() == 0 || suffix_group_starts.size() == A_bits.size());
+        build(A_bits, C_bits, G_bits, T_bits, suffix_group_starts.size() == 0 ? nullptr : &suffix_group_starts);
+    }
+
+    // Count of character c in subsets up to pos, not including pos
+    int64_t rank(int64_t pos, char c) const{
+        int64_t char_idx = char_to_idx(c);
+        if(char_idx == -1) return 0;
+        return rank_by_char_idx(pos, char_idx);
+    }
+
+    // Same as rank, but with the character given as an index 0..3 (A=0, C=1, G=2, T=3)
+    int64_t rank_by_char_idx(int64_t pos, int64_t char_idx) const{
+        const Block& b = blocks[pos >> 6];
+        uint64_t mask = ((uint64_t)1 << (pos & 63)) - 1; // Bits before pos in the block
+        return get_counter(b, char_idx) + __builtin_popcountll(b.words[BITS_WORD + char_idx] & mask);
+    }
+
+    bool contains(int64_t pos, char c) const{
+        // Returns true if the set with index pos contains character c
+        int64_t char_idx = char_to_idx(c);
+        if(char_idx == -1) return false;
+        return (blocks[pos >> 6].words[BITS_WORD + char_idx] >> (pos & 63)) & 1;
+    }
+
+    // Hint that rank(pos, c) will be called soon by prefetching the block of pos
+    void prefetch(int64_t pos, char c) const{
+        __builtin_prefetch(&blocks[pos >> 6]);
+    }
+
+    // Returns the largest position p <= pos in the same block as pos that is marked as a
+    // suffix group start, or -1 if there is no such position. Requires that the suffix
+    // group starts were given at construction.
+    int64_t suffix_group_start_in_block(int64_t pos) const{
+        int64_t b = pos >> 6;
+        uint64_t w = blocks[b].words[GROUP_START_WORD] & (~(uint64_t)0 >> (63 - (pos & 63))); // Marks up to pos in the block
+        if(w == 0) return -1;
+        return b * 64 + 63 - __builtin_clzll(w);
+    }
+
+    // Returns the suffix group start marks stored in the blocks
+    sdsl::bit_vector get_suffix_group_starts() const{
+        sdsl::bit_vector marks(n, 0);
+        for(int64_t i = 0; i < n; i++) marks[i] = (blocks[i >> 6].words[GROUP_START_WORD] >> (i & 63)) & 1;
+        return marks;
+    }
+
+    int64_t blocks_size_in_bytes() const {return blocks.size() * sizeof(Block);}
+
+    // Writes only the blocks, without the number of sets. Used for the memory-mappable layout of the SBWT.
+    int64_t serialize_blocks(ostream& os) const{
+        os.write((char*)blocks.data(), blocks_size_in_bytes());
+        return blocks_size_in_bytes();
+    }
+
+    // Makes this a read-only view of n sets whose blocks were written by serialize_blocks at the given offset of the file
+    void map_blocks(const std::shared_ptr<const MappedFile>& file, int64_t offset, int64_t n){
+        this->n = n;
+        blocks = MappableArray<Block>(file, offset, n / 64 + 1);
+    }
+
+    // Reads n sets whose blocks were written by serialize_blocks into memory
+    void load_blocks(istream& is, int64_t n){
+        this->n = n;
+        vector<Block> new_blocks(n / 64 + 1);
+        is.read((char*)new_blocks.data(), new_blocks.size() * sizeof(Block));
+        blocks = MappableArray<Block>(std::move(new_blocks));
+    }
+
+    int64_t serialize(ostream& os) const{
+        int64_t written = 0;
+        int64_t n_blocks = blocks.size();
+        os.write((char*)&n, sizeof(n));
+        os.write((char*)&n_blocks, sizeof(n_blocks));
+        os.write((char*)blocks.data(), n_blocks * sizeof(Block));
+        written += sizeof(n) + sizeof(n_blocks) + n_blocks * sizeof(Block);
+
+        write_log("InterleavedRank blocks total " + to_string((double)written/n*8) + " bits per node", LogLevel::MINOR);
+        return written;
+    }
+
+    void load(istream& is){
+        int64_t n_blocks = 0;
+        is.read((char*)&n, sizeof(n));
+        is.read((char*)&n_blocks, sizeof(n_blocks));
+        vector<Block> new_blocks(n_blocks);
+        is.read((char*)new_blocks.data(), n_blocks * sizeof(Block));
+        blocks = MappableArray<Block>(std::move(new_blocks));
+    }
+
+};
+
+}
@@ -5,6 +5,7 @@
 #include <sdsl/rank_support_v.hpp>
 #include "globals.hh"
 #include <map>
+#include <type_traits>
 
 namespace sbwt{
 
@@ -36,6 +37,14 @@ class SubsetMatrixRank{
         return 0;
     }
 
+    // Same as rank, but with the character given as an index 0..3 (A=0, C=1, G=2, T=3).
+    // Selects the rank structure through a table instead of comparing characters.
+    int64_t rank_by_char_idx(int64_t pos, int64_t char_idx) const{
+        static constexpr rank_support_t SubsetMatrixRank::* rank_supports[4] = 
+            {&SubsetMatrixRank::A_bits_rs, &SubsetMatrixRank::C_bits_rs, &SubsetMatrixRank::G_bits_rs, &SubsetMatrixRank::T_bits_rs};
+        return (this->*rank_supports[char_idx]).rank(pos);
+    }
+
     bool contains(int64_t pos, char c) const{
         // Returns true if the set with index pos contains character c
         switch(c){
@@ -47,6 +56,22 @@ class SubsetMatrixRank{
         }
     }
 
+    // Hint that rank(pos, c) will be called soon by prefetching the bit vector
+    // word containing position pos. Only does something for plain bit vectors.
+    void prefetch(int64_t pos, char c) const{
+        if constexpr(std::is_same<bitvector_t, sdsl::bit_vector>::value){
+            const uint64_t* words = nullptr;
+            switch(c){
+                case 'A': words = A_bits.data(); break;
+                case 'C': words = C_bits.data(); break;
+                case 'G': words = G_bits.data(); break;
+                case 'T': words = T_bits.data(); break;
+                default: return;
+            }
+            __builtin_prefetch(words + (pos >> 6));
+        }
+    }
+
     SubsetMatrixRank(){}
 
     SubsetMatrixRank(const sdsl::bit_vector& A_bits, const sdsl::bit_vector& C_bits, const sdsl::bit_vector& G_bits, const sdsl::bit_vector& T_bits)
@@ -190,6 +190,10 @@ public:
         return r1 != r2;
     }
 
+    // Hint that rank(pos, c) will be called soon. This representation has
+    // no single memory location to prefetch, so this does nothing.
+    void prefetch(int64_t pos, char c) const{}
+
 };
 
 }
\ No newline at end of file
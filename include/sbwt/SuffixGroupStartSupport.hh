@@ -0,0 +1,121 @@
+#pragma once
+
+#include <sdsl/bit_vectors.hpp>
+#include "MappedFile.hh"
+
+namespace sbwt{
+
+using namespace std;
+
+/*
+
+Constant-time lookup of the start of the suffix group of a column. The marks of the
+suffix group starts are stored in a plain bit vector owned by the caller. This class
+stores, for every 64-bit word of the marks, the position of the last mark before the
+word. A query then looks at the word of the queried column first, and if there is
+no mark at or before the column in that word, returns the sample of the word.
+
+This takes ceil(log2(n))/64 bits per column and at most two memory accesses per
+query, independent of the size of the suffix groups. The structure does not
+point to the marks, so it is safe to copy and move along with them. The samples
+are bit-packed into 64-bit words that can also be a view into a memory-mapped file.
+
+*/
+
+class SuffixGroupStartSupport{
+
+private:
+
+    // Sample b is the position of the last mark before column 64*b, or 0 if none. Sample b
+    // is stored in bits [b*width, (b+1)*width) of the words.
+    MappableArray<uint64_t> prev_mark_words;
+    uint8_t width = 0;
+    int64_t n_samples = 0;
+
+public:
+
+    SuffixGroupStartSupport(){}
+
+    SuffixGroupStartSupport(const sdsl::bit_vector& marks){
+        int64_t n = marks.size();
+        int64_t n_words = (n + 63) / 64;
+        uint8_t width = 1;
+        while(width < 64 && ((uint64_t)1 << width) <= (uint64_t)n) width++;
+        vector<uint64_t> packed((n_words * width + 63) / 64 + 1, 0); // One padding word so that reading a sample never goes past the end
+
+        const uint64_t* words = marks.data();
+        int64_t last = 0;
+        for(int64_t b = 0; b < n_words; b++){
+            uint64_t bit = (uint64_t)b * width;
+            packed[bit >> 6] |= (uint64_t)last << (bit & 63);
+            if((bit & 63) + width > 64) packed[(bit >> 6) + 1] |= (uint64_t)last >> (64 - (bit & 63));
+            uint64_t w = words[b];
+            if(b == n_words - 1 && n % 64 != 0) w &= ((uint64_t)1 << (n % 64)) - 1; // Bits past the end
+            if(w != 0) last = b * 64 + 63 - __builtin_clzll(w);
+        }
+
+        prev_mark_words = MappableArray<uint64_t>(std::move(packed));
+        this->width = width;
+        this->n_samples = n_words;
+    }
+
+    // Returns the largest position p <= pos such that marks[p] = 1. The marks must be the
+    // same bit vector that this structure was built from, and marks[0] must be 1.
+    int64_t group_start(const sdsl::bit_vector& marks, int64_t pos) const{
+        int64_t b = pos >> 6;
+        uint64_t w = marks.data()[b] & (~(uint64_t)0 >> (63 - (pos & 63))); // Marks up to pos in the word
+        if(w != 0) return b * 64 + 63 - __builtin_clzll(w);
+        return last_mark_before_word(b);
+    }
+
+    // Returns the position of the last mark before column 64*b.
+    int64_t last_mark_before_word(int64_t b) const{
+        uint64_t bit = (uint64_t)b * width;
+        const uint64_t* w = prev_mark_words.data() + (bit >> 6);
+        uint64_t x = w[0] >> (bit & 63);
+        if((bit & 63) + width > 64) x |= w[1] << (64 - (bit & 63));
+        return x & (((uint64_t)1 << width) - 1); // width < 64
+    }
+
+    // True if this was built from an empty bit vector or not built at all
+    bool empty() const {return n_samples == 0;}
+
+    // Writes the width and the number of samples
+    int64_t serialize_header(ostream& os) const{
+        int64_t w = width;
+        os.write((char*)&w, sizeof(w));
+        os.write((char*)&n_samples, sizeof(n_samples));
+        return sizeof(w) + sizeof(n_samples);
+    }
+
+    void load_header(istream& is){
+        int64_t w = 0;
+        is.read((char*)&w, sizeof(w));
+        is.read((char*)&n_samples, sizeof(n_samples));
+        width = w;
+    }
+
+    // Number of bytes in the packed words
+    int64_t words_size_in_bytes() const {return prev_mark_words.size() * sizeof(uint64_t);}
+
+    // Writes the packed words. Used with serialize_header for the memory-mappable layout of the SBWT.
+    int64_t serialize_words(ostream& os) const{
+        os.write((char*)prev_mark_words.data(), words_size_in_bytes());
+        return words_size_in_bytes();
+    }
+
+    // Makes the samples a view into the mapped file. The header must have been loaded first.
+    void map_words(const std::shared_ptr<const MappedFile>& file, int64_t offset, int64_t n_bytes){
+        prev_mark_words = MappableArray<uint64_t>(file, offset, n_bytes / sizeof(uint64_t));
+    }
+
+    // Reads the packed words into memory. The header must have been loaded first.
+    void load_words(istream& is, int64_t n_bytes){
+        vector<uint64_t> words(n_bytes / sizeof(uint64_t));
+        is.read((char*)words.data(), n_bytes);
+        prev_mark_words = MappableArray<uint64_t>(std::move(words));
+    }
+
+};
+
+}
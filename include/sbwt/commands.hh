@@ -7,5 +7,9 @@ std::vector<std::string> get_available_variants();
 
 int build_main(int argc, char** argv);
 int search_main(int argc, char** argv);
+int matching_statistics_main(int argc, char** argv);
 int build_from_plain_main(int argc, char** argv);
 int ascii_export_main(int argc, char** argv);
+int dump_kmers_main(int argc, char** argv);
+int serve_main(int argc, char** argv);
+int client_main(int argc, char** argv);
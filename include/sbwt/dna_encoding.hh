@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "globals.hh"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+
+Encoding of DNA strings into 2-bit character indices (A=0, C=1, G=2, T=3, the same
+as DNA_to_char_idx), so that search loops can work on small integers instead of
+calling a character lookup on every step. Only uppercase ACGT are valid characters.
+
+The encoder uses AVX2 or SSE2 if the compiler targets them, and a lookup table
+otherwise. The vectorized versions use the fact that for the ASCII codes of ACGT,
+bits 1 and 2 are 00, 01, 11 and 10 respectively, which becomes the character index
+after xoring the low bit with the high bit.
+
+*/
+
+namespace sbwt{
+
+namespace dna_encoding_internal{
+
+#if defined(__AVX2__)
+inline void encode_block_32(const char* S, uint8_t* codes, uint64_t* invalid_mask, int64_t pos){
+    __m256i v = _mm256_loadu_si256((const __m256i*)S);
+    __m256i valid = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('C'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('T'))));
+    __m256i x = _mm256_and_si256(_mm256_srli_epi16(v, 1), _mm256_set1_epi8(3)); // Bits 1 and 2 of each byte
+    __m256i code = _mm256_xor_si256(x, _mm256_and_si256(_mm256_srli_epi16(x, 1), _mm256_set1_epi8(1)));
+    _mm256_storeu_si256((__m256i*)codes, _mm256_and_si256(code, valid)); // Invalid characters get code 0
+    uint64_t invalid = ~(uint64_t)(uint32_t)_mm256_movemask_epi8(valid) & 0xFFFFFFFF;
+    invalid_mask[pos / 64] |= invalid << (pos % 64); // pos is a multiple of 32
+}
+#endif
+
+#if defined(__SSE2__)
+inline void encode_block_16(const char* S, uint8_t* codes, uint64_t* invalid_mask, int64_t pos){
+    __m128i v = _mm_loadu_si128((const __m128i*)S);
+    __m128i valid = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('A')), _mm_cmpeq_epi8(v, _mm_set1_epi8('C'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('G')), _mm_cmpeq_epi8(v, _mm_set1_epi8('T'))));
+    __m128i x = _mm_and_si128(_mm_srli_epi16(v, 1), _mm_set1_epi8(3)); // Bits 1 and 2 of each byte
+    __m128i code = _mm_xor_si128(x, _mm_and_si128(_mm_srli_epi16(x, 1), _mm_set1_epi8(1)));
+    _mm_storeu_si128((__m128i*)codes, _mm_and_si128(code, valid)); // Invalid characters get code 0
+    uint64_t invalid = ~(uint64_t)_mm_movemask_epi8(valid) & 0xFFFF;
+    invalid_mask[pos / 64] |= invalid << (pos % 64); // pos is a multiple of 16
+}
+#endif
+
+} // namespace dna_encoding_internal
+
+// Encodes S[0..len) into character indices codes[0..len). Non-ACGT characters get code 0
+// and their positions are marked with one-bits in invalid_mask, which must have space for
+// (len + 63) / 64 words.
+inline void encode_DNA(const char* S, int64_t len, uint8_t* codes, uint64_t* invalid_mask){
+    memset(invalid_mask, 0, sizeof(uint64_t) * ((len + 63) / 64));
+    int64_t i = 0;
+    #if defined(__AVX2__)
+    for(; i + 32 <= len; i += 32) dna_encoding_internal::encode_block_32(S + i, codes + i, invalid_mask, i);
+    #endif
+    #if defined(__SSE2__)
+    for(; i + 16 <= len; i += 16) dna_encoding_internal::encode_block_16(S + i, codes + i, invalid_mask, i);
+    #endif
+    for(; i < len; i++){
+        int64_t char_idx = DNA_to_char_idx(S[i]);
+        codes[i] = char_idx == -1 ? 0 : char_idx;
+        if(char_idx == -1) invalid_mask[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+}
+
+// Returns true if any of the positions [begin, end) are marked in the invalid mask from encode_DNA
+inline bool has_invalid_chars(const uint64_t* invalid_mask, int64_t begin, int64_t end){
+    while(begin < end){
+        int64_t word_end = min(end, (begin / 64 + 1) * 64);
+        uint64_t bits = invalid_mask[begin / 64] >> (begin % 64);
+        int64_t n_bits = word_end - begin;
+        if(n_bits < 64) bits &= ((uint64_t)1 << n_bits) - 1;
+        if(bits) return true;
+        begin = word_end;
+    }
+    return false;
+}
+
+// Packs len <= 32 character indices into a 64-bit integer with codes[i] in bits 2i and 2i+1.
+// This is the same layout that the precalc table uses.
+inline uint64_t pack_char_indices(const uint8_t* codes, int64_t len){
+    uint64_t x = 0;
+    for(int64_t i = len - 1; i >= 0; i--) x = (x << 2) | codes[i];
+    return x;
+}
+
+}
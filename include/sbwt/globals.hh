@@ -9,6 +9,8 @@ namespace sbwt{
 
 using namespace std;
 
+// The KMC construction uses the narrowest k-mer type that fits k, but the in-memory construction
+// and the tests use Kmer<MAX_KMER_LENGTH>, so the default stays at one 64-bit word
 #ifndef MAX_KMER_LENGTH
 #define MAX_KMER_LENGTH 32
 #endif
@@ -80,6 +82,26 @@ Temp_File_Manager& get_temp_file_manager();
 int64_t serialize_string(const string& S, ostream& out); // Returns the number of bytes written
 string load_string(istream& in); // Loads string serialized by serialize_string
 
+// Utility function: Serialization for a std::vector
+// Returns number of bytes written
+template<typename T>
+int64_t serialize_std_vector(const vector<T>& v, ostream& os){
+    int64_t n_bytes = sizeof(T) * v.size();
+    os.write((char*)&n_bytes, sizeof(n_bytes));
+    os.write((char*)v.data(), n_bytes);
+    return sizeof(n_bytes) + n_bytes;
+}
+
+template<typename T>
+vector<T> load_std_vector(istream& is){
+    int64_t n_bytes = 0;
+    is.read((char*)&n_bytes, sizeof(n_bytes));
+    assert(n_bytes % sizeof(T) == 0);
+    vector<T> v(n_bytes / sizeof(T));
+    is.read((char*)(v.data()), n_bytes);
+    return v;
+}
+
 class Progress_printer{
 
     public:
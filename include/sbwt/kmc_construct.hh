@@ -7,225 +7,756 @@
 #include "EM_sort/EM_sort.hh"
 #include "kmc_construct_helper_classes.hh"
 #include "run_kmc.hh"
+#include "throwing_streams.hh"
 #include <set>
 #include <unordered_map>
 #include <stdexcept>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 namespace sbwt{
 
-template <typename nodeboss_t>
+// The k-mers are handled as Kmer<max_len> during the construction, so max_len must be at least k.
+// A smaller max_len makes the construction faster. build_with_kmc picks the smallest one that fits.
+template <typename nodeboss_t, int64_t max_len = MAX_KMER_LENGTH>
 class NodeBOSSKMCConstructor{
 
-typedef KMC_construction_helper_classes::Disk_Instream Disk_Instream;
+typedef KMC_construction_helper_classes::Disk_Instream<max_len> Disk_Instream;
 typedef KMC_construction_helper_classes::Argv Argv;
-typedef KMC_construction_helper_classes::Kmer_stream_from_KMC_DB Kmer_stream_from_KMC_DB;
-typedef KMC_construction_helper_classes::kmer_t kmer_t;
-typedef KMC_construction_helper_classes::Node Node;
-typedef KMC_construction_helper_classes::Node_stream_merger Node_stream_merger;
-typedef KMC_construction_helper_classes::SimpleSortedKmerDB SimpleSortedKmerDB;
+typedef KMC_construction_helper_classes::Kmer_stream_from_KMC_DB<max_len> Kmer_stream_from_KMC_DB;
+typedef Kmer<max_len> kmer_t;
+typedef KMC_construction_helper_classes::Node<max_len> Node;
+typedef KMC_construction_helper_classes::Node_stream_merger<max_len> Node_stream_merger;
+typedef KMC_construction_helper_classes::SimpleSortedKmerDB<max_len> SimpleSortedKmerDB;
+typedef KMC_construction_helper_classes::SortedKMCDatabase<max_len> SortedKMCDatabase;
+typedef KMC_construction_helper_classes::InMemorySortedKmerDB<max_len> InMemorySortedKmerDB;
+typedef KMC_construction_helper_classes::TempRecordFormat<max_len> TempRecordFormat;
+
+// Merges the nodes of the k-mers with the sorted dummy nodes in memory, like Node_stream_merger does
+// for files. Starts with an empty node, like the file streams.
+class InMemoryNodeMerger{
+
+    const vector<kmer_t>& kmers;
+    const vector<char>& edge_flags;
+    const vector<Node>& dummies;
+    int64_t i = 0, j = 0;
+    bool root_done = false;
 
 public:
 
-    // Appends the prefixes of x to nodes
-    void add_prefixes(kmer_t z, seq_io::Buffered_ofstream<>& out, char* buf){
+    InMemoryNodeMerger(const vector<kmer_t>& kmers, const vector<char>& edge_flags, const vector<Node>& dummies) : kmers(kmers), edge_flags(edge_flags), dummies(dummies) {}
+
+    bool stream_done() const {return root_done && i == (int64_t)kmers.size() && j == (int64_t)dummies.size();}
+
+    Node stream_next(){
+        if(!root_done){
+            root_done = true;
+            return Node();
+        }
+        if(i < (int64_t)kmers.size()){
+            Node x(kmers[i]);
+            x.edge_flags = edge_flags[i];
+            if(j == (int64_t)dummies.size() || x < dummies[j]){
+                i++;
+                return x;
+            }
+        }
+        return dummies[j++];
+    }
+
+};
+
+public:
+
+    // Expands the canonical k-mers counted by KMC to both orientations. Both get the count of the canonical k-mer,
+    // which is what counting the input together with its reverse complement gives. KMC counts a palindrome only once
+    // per occurrence, so its count is doubled. The abundance filter is applied to the counts after the expansion.
+    class ReverseComplementExpansion{
+
+        int64_t min_abundance, max_abundance;
+
+    public:
+
+        ReverseComplementExpansion(int64_t min_abundance, int64_t max_abundance) : min_abundance(min_abundance), max_abundance(max_abundance) {}
+
+        // The minimum abundance for KMC that keeps every k-mer that passes the filter after the expansion.
+        // Only even k have palindromes.
+        static int64_t kmc_min_abundance(int64_t min_abundance, int64_t k){
+            return k % 2 == 0 ? (min_abundance + 1) / 2 : min_abundance;
+        }
+
+        // Calls f(kmer, count) for x and its reverse complement, or once if x is a palindrome
+        template<typename callback_t>
+        void operator()(const kmer_t& x, int64_t count, const callback_t& f) const{
+            kmer_t rc = reverse_complement(x);
+            if(rc == x) count *= 2;
+            if(count < min_abundance || count > max_abundance) return;
+            uint32_t capped_count = min(count, (int64_t)UINT32_MAX);
+            f(x, capped_count);
+            if(rc != x) f(rc, capped_count);
+        }
+    };
+
+    // The k-mers are stored reversed, and the reverse of the reverse complement is the reverse complement of the reverse
+    static kmer_t reverse_complement(const kmer_t& x){
+        kmer_t rc((uint8_t)x.get_k());
+        for(int64_t i = 0; i < x.get_k(); i++) rc.set(x.get_k() - 1 - i, get_rc(x.get(i)));
+        return rc;
+    }
+
+    bool in_memory_fast_path = true; // Build without temporary files after KMC if the k-mers fit in the RAM budget
+
+    // The records of the temp files of the nodes and of the k-mers that need dummies have length k. The dummies are shorter.
+    static TempRecordFormat kmer_file_format(int64_t k) {return TempRecordFormat(k, false);}
+    static TempRecordFormat dummy_file_format(int64_t k) {return TempRecordFormat(max(k - 1, (int64_t)0), true);}
+
+    // Calls f(node) for the proper prefixes of z of length at least min_length as nodes with the out-edge to the next longer prefix
+    template<typename callback_t>
+    void for_each_prefix_node(kmer_t z, const callback_t& f, int64_t min_length = 0){
         kmer_t prefix = z.copy();
-        while(prefix.get_k() > 0){
+        while(prefix.get_k() > min_length){
             char edge_char = prefix.last();
             prefix.dropright();
             Node node(prefix);
             node.set(edge_char);
-            node.serialize(buf);
-            out.write(buf, Node::size_in_bytes());
+            f(node);
+        }
+    }
+
+    static bool lex_less(const kmer_t& a, const kmer_t& b){
+        int64_t n = min(a.get_k(), b.get_k());
+        for(int64_t i = 0; i < n; i++){
+            if(a.get(i) != b.get(i)) return a.get(i) < b.get(i);
+        }
+        return a.get_k() < b.get_k();
+    }
+
+    static int64_t longest_common_prefix(const kmer_t& a, const kmer_t& b){
+        int64_t n = min(a.get_k(), b.get_k());
+        int64_t i = 0;
+        while(i < n && a.get(i) == b.get(i)) i++;
+        return i;
+    }
+
+    // The dummy nodes of z of length less than the longest common prefix with the previous k-mer in
+    // lexicographic order are dummy nodes of the previous k-mer too. So calling this for lexicographically
+    // sorted k-mers gives every dummy node once, which is far fewer nodes than k-1 per k-mer on read sets.
+    template<typename callback_t>
+    void for_each_new_prefix_node(const kmer_t& z, const kmer_t& prev, const callback_t& f){
+        for_each_prefix_node(z, f, longest_common_prefix(z, prev));
+    }
+
+    // Writes the distinct dummy nodes of the k-mers in the lexicographically sorted file of k-mers
+    void write_distinct_dummies(const string& sorted_sources_file, const string& dummies_outfile, int64_t k){
+        TempRecordFormat in_format = kmer_file_format(k);
+        TempRecordFormat out_format = dummy_file_format(k);
+        seq_io::Buffered_ifstream<> in(sorted_sources_file, ios::binary);
+        seq_io::Buffered_ofstream<> out(dummies_outfile, ios::binary);
+        vector<char> kmer_buf(in_format.kmer_size_in_bytes());
+        vector<char> node_buf(out_format.node_size_in_bytes());
+        kmer_t prev;
+        while(true){
+            in.read(kmer_buf.data(), in_format.kmer_size_in_bytes());
+            if(in.eof()) break;
+            kmer_t z = in_format.load_kmer(kmer_buf.data());
+            for_each_new_prefix_node(z, prev, [&](Node& node){
+                out_format.serialize_node(node, node_buf.data());
+                out.write(node_buf.data(), out_format.node_size_in_bytes());
+            });
+            prev = z;
         }
     }
 
     // The result is written to the given sdsl bit vectors. The bits vectors will be resized to fit all the bits.
+    // dummy_marks_sdsl marks the columns of the nodes that come from the dummy stream, that is, whose label is shorter than k.
     void build_bit_vectors_from_sorted_streams(const string& nodefile, const string& dummyfile,
-            sdsl::bit_vector& A_bits_sdsl, sdsl::bit_vector& C_bits_sdsl, sdsl::bit_vector& G_bits_sdsl, sdsl::bit_vector& T_bits_sdsl, sdsl::bit_vector& suffix_group_starts_sdsl, int64_t k){
-        vector<bool> A_bits, C_bits, G_bits, T_bits, suffix_group_starts;
+            sdsl::bit_vector& A_bits_sdsl, sdsl::bit_vector& C_bits_sdsl, sdsl::bit_vector& G_bits_sdsl, sdsl::bit_vector& T_bits_sdsl, sdsl::bit_vector& suffix_group_starts_sdsl, sdsl::bit_vector& dummy_marks_sdsl, int64_t k){
+
+        // Every record of the streams is at most one column, so the number of records bounds the number of columns
+        int64_t max_columns = std::filesystem::file_size(nodefile) / kmer_file_format(k).node_size_in_bytes()
+                            + std::filesystem::file_size(dummyfile) / dummy_file_format(k).node_size_in_bytes() + 2; // + the empty nodes at the starts of the streams
 
         // These streams are such that the always start with an empty k-mer and an empty edge set.
         // This will always add the empty string to the graph even if the graph is cyclic. This is
         // intentional to ensure that the root node in the SBWT graph always exists - otherwise the
         // search would need a special case for cyclic graphs.
-        Disk_Instream nodes_in(nodefile);
-        Disk_Instream dummies_in(dummyfile);
+        Disk_Instream nodes_in(nodefile, kmer_file_format(k));
+        Disk_Instream dummies_in(dummyfile, dummy_file_format(k));
 
         Node_stream_merger merger(nodes_in, dummies_in);
+        build_bit_vectors_from_merger(merger, max_columns, A_bits_sdsl, C_bits_sdsl, G_bits_sdsl, T_bits_sdsl, suffix_group_starts_sdsl, dummy_marks_sdsl, k);
+    }
+
+    // Builds the bit vectors from a sorted stream of nodes with at most max_columns distinct k-mers. The vectors are
+    // allocated at the bound and the bits are written in place, which is cheaper than growing them, and they are
+    // shrunk to the number of columns at the end.
+    template<typename merger_t>
+    void build_bit_vectors_from_merger(merger_t& merger, int64_t max_columns,
+            sdsl::bit_vector& A_bits_sdsl, sdsl::bit_vector& C_bits_sdsl, sdsl::bit_vector& G_bits_sdsl, sdsl::bit_vector& T_bits_sdsl, sdsl::bit_vector& suffix_group_starts_sdsl, sdsl::bit_vector& dummy_marks_sdsl, int64_t k){
+
+        for(sdsl::bit_vector* v : {&A_bits_sdsl, &C_bits_sdsl, &G_bits_sdsl, &T_bits_sdsl, &suffix_group_starts_sdsl, &dummy_marks_sdsl})
+            *v = sdsl::bit_vector(max_columns, 0);
 
         Node prev_node;
-        bool first = true;
+        int64_t column = -1;
         while(!merger.stream_done()){
             Node x = merger.stream_next();
-            if(first || x.kmer != prev_node.kmer){
+            if(column == -1 || x.kmer != prev_node.kmer){
                 // New column
-                A_bits.push_back(0);
-                C_bits.push_back(0);
-                G_bits.push_back(0);
-                T_bits.push_back(0);
+                column++;
 
                 // Figure out if this is a suffix group start
                 bool is_start = false;
-                is_start |= first;
+                is_start |= (column == 0);
                 kmer_t a = prev_node.kmer.copy();
                 kmer_t b = x.kmer.copy();
                 if(a.get_k() == k) a.dropleft();
                 if(b.get_k() == k) b.dropleft();
                 is_start |= (a != b);
-                suffix_group_starts.push_back(is_start);
-                first = false;
+                suffix_group_starts_sdsl[column] = is_start;
+                dummy_marks_sdsl[column] = (x.kmer.get_k() < k);
             }
-            if(x.has('A')) A_bits.back() = 1;
-            if(x.has('C')) C_bits.back() = 1;
-            if(x.has('G')) G_bits.back() = 1;
-            if(x.has('T')) T_bits.back() = 1;
+            if(x.has('A')) A_bits_sdsl[column] = 1;
+            if(x.has('C')) C_bits_sdsl[column] = 1;
+            if(x.has('G')) G_bits_sdsl[column] = 1;
+            if(x.has('T')) T_bits_sdsl[column] = 1;
             prev_node = x;
             
         }
 
-        // Copy to sdsl vectors
-        A_bits_sdsl.resize(A_bits.size());
-        C_bits_sdsl.resize(C_bits.size());
-        G_bits_sdsl.resize(G_bits.size());
-        T_bits_sdsl.resize(T_bits.size());
-        suffix_group_starts_sdsl.resize(suffix_group_starts.size());
-        for(int64_t i = 0; i < A_bits.size(); i++){
-            A_bits_sdsl[i] = A_bits[i];
-            C_bits_sdsl[i] = C_bits[i];
-            G_bits_sdsl[i] = G_bits[i];
-            T_bits_sdsl[i] = T_bits[i];
-            suffix_group_starts_sdsl[i] = suffix_group_starts[i];
-        }        
-    }
-
-    // This deletes the KMC database on disk after use
-    void write_nodes_and_dummies(const string& KMC_db_path, const string& nodes_outfile, const string& dummies_outfile, int64_t n_kmers){
-        char node_serialize_buffer[Node::size_in_bytes()];
+        for(sdsl::bit_vector* v : {&A_bits_sdsl, &C_bits_sdsl, &G_bits_sdsl, &T_bits_sdsl, &suffix_group_starts_sdsl, &dummy_marks_sdsl})
+            v->resize(column + 1); // Reallocates, so the unused space is released
+    }
+
+    // The k-mers in all_stream[x_begin..x_end) and, for each character c, the k-mers ending in c in
+    // all_stream[z_begin[c]..z_end[c]) that are compared against their out-neighbors. x_begin must be
+    // the start of a suffix group.
+    struct KmerRange{
+        int64_t x_begin, x_end;
+        int64_t z_begin[4], z_end[4];
+    };
+
+    // Writes the nodes of the k-mers of the range, and the k-mers in the z-ranges that are not the
+    // out-neighbor of any k-mer of the range, which are the k-mers that need dummy prefixes. Calls
+    // progress(n) after every n processed k-mers. If counts is not null, the abundances of the k-mers
+    // of the range are written to their colex positions in it.
+    template<typename kmer_db_t, typename progress_callback_t>
+    void write_nodes_and_sources_in_range(const kmer_db_t& all_kmers, const KmerRange& range, const string& nodes_outfile, const string& sources_outfile, int64_t k, const progress_callback_t& progress, vector<uint32_t>* counts){
+        TempRecordFormat format = kmer_file_format(k);
+        vector<char> node_serialize_buffer(format.node_size_in_bytes());
+        vector<char> kmer_serialize_buffer(format.kmer_size_in_bytes());
         
         seq_io::Buffered_ofstream nodes_out(nodes_outfile, ios::binary);
-        seq_io::Buffered_ofstream dummies_out(dummies_outfile, ios::binary);
-
-        // These streams are assumed to give k-mers in colex order
-        Kmer_stream_from_KMC_DB kmc_db(KMC_db_path, false); // No reverse complements
-        write_log("Uncompressing KMC database to disk", LogLevel::MAJOR);
-        string uncompressed_db_filename = get_temp_file_manager().create_filename();
-        SimpleSortedKmerDB all_stream(kmc_db, uncompressed_db_filename);
-
-        // Delete the KMC database files. The temp file manager can not do this because
-        // KMC appends suffixes to the filename and the manager does not know about that.
-        std::filesystem::remove(KMC_db_path + ".kmc_pre");
-        std::filesystem::remove(KMC_db_path + ".kmc_suf");
-
-        vector<SimpleSortedKmerDB*> char_streams(255); // A k-mer database stream for each character ACGT
+        seq_io::Buffered_ofstream sources_out(sources_outfile, ios::binary);
+
+        auto node_callback = [&](int64_t x_idx, Node& node){
+            format.serialize_node(node, node_serialize_buffer.data());
+            nodes_out.write(node_serialize_buffer.data(), format.node_size_in_bytes());
+        };
+        auto source_callback = [&](const kmer_t& z){
+            format.serialize_kmer(z, kmer_serialize_buffer.data());
+            sources_out.write(kmer_serialize_buffer.data(), format.kmer_size_in_bytes());
+        };
+        generate_nodes_and_sources_in_range(all_kmers, range, node_callback, source_callback, progress, counts);
+    }
 
+    // Calls node_callback(i, node) for the node of every k-mer i of the range in order, and
+    // source_callback(z) for the k-mers z that need dummy prefixes. See write_nodes_and_sources_in_range.
+    template<typename kmer_db_t, typename node_callback_t, typename source_callback_t, typename progress_callback_t>
+    void generate_nodes_and_sources_in_range(const kmer_db_t& all_kmers, const KmerRange& range, const node_callback_t& node_callback, const source_callback_t& source_callback, const progress_callback_t& progress, vector<uint32_t>* counts){
         string ACGT = "ACGT";
-        for(char c : ACGT){
-            char_streams[c] = new SimpleSortedKmerDB(all_stream);
-            char_streams[c]->seek_to_char_block(c);
+        kmer_db_t x_stream(all_kmers);
+        x_stream.seek(range.x_begin);
+        vector<kmer_db_t> char_streams(4, all_kmers); // A stream of the k-mers ending in each character ACGT
+        kmer_t cur_kmers[4]; // cur_kmers[c] = the colex-smallest k-mer that ends in c that has not been seen yet
+        bool has_cur[4]; // Whether cur_kmers[c] is in the z-range of c
+        auto advance = [&](int64_t c){
+            has_cur[c] = char_streams[c].get_cursor() < range.z_end[c];
+            if(has_cur[c]) cur_kmers[c] = char_streams[c].next();
+        };
+        for(int64_t c = 0; c < 4; c++){
+            char_streams[c].seek(range.z_begin[c]);
+            advance(c);
         }
 
-        map<char, Kmer<MAX_KMER_LENGTH>> cur_kmers; // cur_kmers[c] = the colex-smallest k-mer that ends in c that has not been seen yet
-        set<char> all_processed; // K-mers ending in these characters have all been processed
-
-        // Initialize first k-mer of each character block
-        for(char c : ACGT){
-            if(char_streams[c]->done()){
-                // This character is not the last character of any k-mer in the data
-                all_processed.insert(c);
-                break;
-            }
-            cur_kmers[c] = char_streams[c]->next();
-        }
-        
         kmer_t prev_x;
-        int64_t x_idx = 0;
-
-        write_log("Streaming",LogLevel::MAJOR);
-        Progress_printer pp2(n_kmers, 100);
+        int64_t n_unreported = 0;
         // Figure out out-edges and which nodes need dummy prefixes
-        while(!all_stream.done()){
-            kmer_t x = all_stream.next();
+        for(int64_t x_idx = range.x_begin; x_idx < range.x_end; x_idx++){
+            kmer_t x = x_stream.next();
+            if(counts != nullptr) (*counts)[x_idx] = x_stream.get_last_count();
 
             bool suffix_group_start = false;
-            if(x_idx == 0 || x.copy().dropleft() != prev_x.copy().dropleft())
+            if(x_idx == range.x_begin || x.copy().dropleft() != prev_x.copy().dropleft())
                 suffix_group_start = true;
 
             Node x_node(x);            
             if(suffix_group_start){
-                for(char c : ACGT){
-                    if(all_processed.count(c)) continue;
-                    kmer_t y = x.copy().dropleft().appendright(c);
-                    kmer_t z = cur_kmers[c];
-
-                    while(y > z){
-                        add_prefixes(z,dummies_out,node_serialize_buffer);
-                        if(char_streams[c]->done()){
-                            all_processed.insert(c);
-                            break;
-                        } else{
-                            z = char_streams[c]->next();
-                            cur_kmers[c] = z;
-                        }
+                for(int64_t c = 0; c < 4; c++){
+                    kmer_t y = x.copy().dropleft().appendright(ACGT[c]);
+                    while(has_cur[c] && y > cur_kmers[c]){
+                        source_callback(cur_kmers[c]);
+                        advance(c);
                     }
-                    if(y == z){
-                        x_node.set(c);
-
-                        // Advance pointer
-                        if(char_streams[c]->done()){
-                            all_processed.insert(c);
-                            break;
-                        } else{
-                            cur_kmers[c] = char_streams[c]->next();
-                        }
+                    if(has_cur[c] && y == cur_kmers[c]){
+                        x_node.set(ACGT[c]);
+                        advance(c);
                     }
                 }
             }
-            x_node.serialize(node_serialize_buffer);
-            nodes_out.write(node_serialize_buffer, Node::size_in_bytes());
-            x_idx++;
+            node_callback(x_idx, x_node);
             prev_x = x;
-            pp2.job_done();
+            if(++n_unreported == 4096){
+                progress(n_unreported);
+                n_unreported = 0;
+            }
         }
+        progress(n_unreported);
 
         // Process the remaining k-mers
-        for(char c : ACGT){
-            if(all_processed.count(c)) continue;
-            while(cur_kmers[c].last() == c){
-                add_prefixes(cur_kmers[c], dummies_out, node_serialize_buffer);
-                if(char_streams[c]->done()) break;
-                else cur_kmers[c] = char_streams[c]->next();
+        for(int64_t c = 0; c < 4; c++){
+            while(has_cur[c]){
+                source_callback(cur_kmers[c]);
+                advance(c);
+            }
+        }
+    }
+
+    // Splits the k-mers into at most n_ranges ranges of roughly equal size that start at suffix group boundaries
+    template<typename kmer_db_t>
+    vector<KmerRange> split_into_ranges(kmer_db_t& all_kmers, int64_t n_ranges){
+        int64_t n = all_kmers.size();
+        string ACGT = "ACGT";
+
+        vector<int64_t> boundaries = {0};
+        for(int64_t i = 1; i < n_ranges; i++){
+            int64_t b = max(n * i / n_ranges, boundaries.back() + 1);
+            if(b >= n) break;
+            all_kmers.seek(b-1);
+            kmer_t prev = all_kmers.next();
+            while(b < n){ // Move to the start of the next suffix group. Suffix groups have at most four k-mers.
+                kmer_t x = all_kmers.next();
+                if(x.copy().dropleft() != prev.copy().dropleft()) break;
+                prev = x;
+                b++;
+            }
+            if(b >= n) break;
+            boundaries.push_back(b);
+        }
+        boundaries.push_back(n);
+
+        // The z-ranges start where the out-neighbors of the first k-mer of the range would be.
+        // Only the first range takes the k-mers before that.
+        vector<KmerRange> ranges(boundaries.size() - 1);
+        for(int64_t r = 0; r < (int64_t)ranges.size(); r++){
+            ranges[r].x_begin = boundaries[r];
+            ranges[r].x_end = boundaries[r+1];
+            kmer_t x;
+            if(r > 0){
+                all_kmers.seek(boundaries[r]);
+                x = all_kmers.next();
+            }
+            for(int64_t c = 0; c < 4; c++){
+                int64_t block_begin = all_kmers.get_char_block_start(ACGT[c]);
+                int64_t block_end = all_kmers.get_char_block_end(ACGT[c]);
+                block_begin = min(block_begin, block_end); // Empty block
+                if(r == 0){
+                    ranges[r].z_begin[c] = block_begin;
+                } else{
+                    // Binary search for the first k-mer that is not smaller than the out-neighbor
+                    kmer_t y = x.copy().dropleft().appendright(ACGT[c]);
+                    int64_t lo = block_begin, hi = block_end;
+                    while(lo < hi){
+                        int64_t mid = lo + (hi - lo) / 2;
+                        all_kmers.seek(mid);
+                        if(all_kmers.next() < y) lo = mid + 1;
+                        else hi = mid;
+                    }
+                    ranges[r].z_begin[c] = lo;
+                    ranges[r-1].z_end[c] = lo;
+                }
+                if(r == (int64_t)ranges.size() - 1) ranges[r].z_end[c] = block_end;
+            }
+        }
+        return ranges;
+    }
+
+    // Appends the files to the output file in order and deletes them
+    void concatenate_files(const vector<string>& infiles, const string& outfile){
+        throwing_ofstream out(outfile, ios::binary);
+        for(const string& f : infiles){
+            {
+                throwing_ifstream in(f, ios::binary);
+                if(std::filesystem::file_size(f) > 0) out.stream << in.stream.rdbuf();
+            }
+            get_temp_file_manager().delete_file(f);
+        }
+    }
+
+    // Processes the k-mers of the database in n_threads ranges in parallel
+    template<typename kmer_db_t>
+    void write_nodes_and_sources_from_db(kmer_db_t& all_kmers, const string& nodes_outfile, const string& sources_outfile, int64_t n_kmers, int64_t n_threads, int64_t k, vector<uint32_t>* counts){
+        vector<KmerRange> ranges = split_into_ranges(all_kmers, max(n_threads, (int64_t)1));
+
+        write_log("Streaming",LogLevel::MAJOR);
+        Progress_printer pp2(n_kmers, 100);
+        std::mutex progress_mutex;
+        auto progress = [&](int64_t n_done){
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            for(int64_t i = 0; i < n_done; i++) pp2.job_done();
+        };
+
+        if(ranges.size() == 1){
+            write_nodes_and_sources_in_range(all_kmers, ranges[0], nodes_outfile, sources_outfile, k, progress, counts);
+        } else{
+            vector<string> range_nodes_files, range_sources_files;
+            vector<std::thread> threads;
+            for(const KmerRange& range : ranges){
+                range_nodes_files.push_back(get_temp_file_manager().create_filename());
+                range_sources_files.push_back(get_temp_file_manager().create_filename());
+                threads.emplace_back([&, range, nodes_file = range_nodes_files.back(), sources_file = range_sources_files.back()](){
+                    write_nodes_and_sources_in_range(all_kmers, range, nodes_file, sources_file, k, progress, counts);
+                });
+            }
+            for(std::thread& t : threads) t.join();
+            concatenate_files(range_nodes_files, nodes_outfile);
+            concatenate_files(range_sources_files, sources_outfile); // The k-mers are sorted later anyway
+        }
+    }
+
+    // Writes the nodes of the k-mers in colex order, and the k-mers that need dummy prefixes in no particular order.
+    // This deletes the KMC database on disk after use. If counts is not null, the abundances of the k-mers are stored there in colexicographic order.
+    // The k-mers are split into n_threads ranges by suffix that are processed in parallel.
+    void write_nodes_and_sources(const string& KMC_db_path, const string& nodes_outfile, const string& sources_outfile, int64_t n_kmers, int64_t n_threads, int64_t k, vector<uint32_t>* counts = nullptr){
+        // Read the sorted KMC database in place if its layout is recognized. Otherwise, or if the
+        // k-mers do not agree with what the KMC API lists, fall back to an uncompressed copy.
+        std::unique_ptr<SortedKMCDatabase> kmc_db;
+        try{
+            kmc_db = std::make_unique<SortedKMCDatabase>(KMC_db_path);
+            if(kmc_db->size() != n_kmers || !kmc_db->matches_kmc_listing(KMC_db_path, 1 << 16)) kmc_db.reset();
+        } catch(const std::runtime_error& e){
+            kmc_db.reset();
+        }
+
+        // Delete the KMC database files. The temp file manager can not do this because
+        // KMC appends suffixes to the filename and the manager does not know about that.
+        auto delete_kmc_db = [&](){
+            std::filesystem::remove(KMC_db_path + ".kmc_pre");
+            std::filesystem::remove(KMC_db_path + ".kmc_suf");
+        };
+
+        if(kmc_db){
+            write_log("Reading the sorted KMC database directly", LogLevel::MINOR);
+            if(counts != nullptr) counts->resize(n_kmers);
+            write_nodes_and_sources_from_db(*kmc_db, nodes_outfile, sources_outfile, n_kmers, n_threads, k, counts);
+            kmc_db.reset();
+            delete_kmc_db();
+        } else{
+            // These streams are assumed to give k-mers in colex order
+            std::unique_ptr<Kmer_stream_from_KMC_DB> kmc_stream = std::make_unique<Kmer_stream_from_KMC_DB>(KMC_db_path, false); // No reverse complements
+            write_log("Uncompressing KMC database to disk", LogLevel::MAJOR);
+            string uncompressed_db_filename = get_temp_file_manager().create_filename();
+            SimpleSortedKmerDB all_stream(*kmc_stream, uncompressed_db_filename, k, counts != nullptr);
+            kmc_stream.reset();
+            delete_kmc_db();
+            if(counts != nullptr) counts->resize(n_kmers);
+            write_nodes_and_sources_from_db(all_stream, nodes_outfile, sources_outfile, n_kmers, n_threads, k, counts);
+            get_temp_file_manager().delete_file(uncompressed_db_filename);
+        }
+    }
+
+    // Like write_nodes_and_sources, but the KMC database has canonical k-mers. They are expanded to both orientations
+    // and sorted on disk first. Returns the number of k-mers after the expansion.
+    int64_t write_nodes_and_sources_with_reverse_complements(const string& KMC_db_path, const string& nodes_outfile, const string& sources_outfile, int64_t n_threads, int64_t ram_gigas, int64_t k, const ReverseComplementExpansion& expansion, vector<uint32_t>* counts = nullptr){
+        write_log("Adding reverse complements on disk", LogLevel::MAJOR);
+        TempRecordFormat format = kmer_file_format(k);
+        int64_t record_size = format.kmer_size_in_bytes() + sizeof(uint32_t); // K-mer and count
+        string expanded_file = get_temp_file_manager().create_filename();
+        {
+            Kmer_stream_from_KMC_DB kmc_stream(KMC_db_path, false); // The reverse complements are added with the counts below
+            seq_io::Buffered_ofstream<> out(expanded_file);
+            vector<char> buf(record_size);
+            while(!kmc_stream.done()){
+                kmer_t x = kmc_stream.next();
+                expansion(x, kmc_stream.get_last_count(), [&](const kmer_t& y, uint32_t count){
+                    format.serialize_kmer(y, buf.data());
+                    memcpy(buf.data() + format.kmer_size_in_bytes(), &count, sizeof(uint32_t));
+                    out.write(buf.data(), record_size);
+                });
+            }
+            out.flush();
+        }
+        std::filesystem::remove(KMC_db_path + ".kmc_pre");
+        std::filesystem::remove(KMC_db_path + ".kmc_suf");
+
+        write_log("Sorting k-mers on disk", LogLevel::MAJOR);
+        string sorted_file = get_temp_file_manager().create_filename();
+        EM_sort_constant_binary(expanded_file, sorted_file,
+            [&format](const char* A, const char* B){
+                return format.kmer_less(A, B); // Colex order
+            }, ram_gigas * ((int64_t)1 << 30), record_size, n_threads);
+        get_temp_file_manager().delete_file(expanded_file);
+
+        int64_t n_kmers = 0;
+        {
+            SimpleSortedKmerDB all_stream(sorted_file, format, record_size, true);
+            n_kmers = all_stream.size();
+            if(counts != nullptr) counts->resize(n_kmers);
+            write_nodes_and_sources_from_db(all_stream, nodes_outfile, sources_outfile, n_kmers, n_threads, k, counts);
+        }
+        get_temp_file_manager().delete_file(sorted_file);
+        return n_kmers;
+    }
+
+    // Reads the k-mers of the KMC database into memory in colex order, in parallel if the layout of the database is
+    // recognized. If counts is not null, the abundances of the k-mers are stored there in the same order.
+    void read_kmers_into_memory(const string& KMC_db_path, int64_t n_kmers, int64_t n_threads, vector<kmer_t>& kmers, vector<uint32_t>* counts){
+        std::unique_ptr<SortedKMCDatabase> kmc_db;
+        try{
+            kmc_db = std::make_unique<SortedKMCDatabase>(KMC_db_path);
+            if(kmc_db->size() != n_kmers || !kmc_db->matches_kmc_listing(KMC_db_path, 1 << 16)) kmc_db.reset();
+        } catch(const std::runtime_error& e){
+            kmc_db.reset();
+        }
+
+        if(kmc_db){
+            write_log("Reading the sorted KMC database directly", LogLevel::MINOR);
+            kmers.resize(n_kmers);
+            if(counts != nullptr) counts->resize(n_kmers);
+            n_threads = max((int64_t)1, min(n_threads, n_kmers));
+            vector<std::thread> threads;
+            for(int64_t t = 0; t < n_threads; t++){
+                threads.emplace_back([&, t](){
+                    SortedKMCDatabase db(*kmc_db);
+                    int64_t begin = n_kmers * t / n_threads;
+                    int64_t end = n_kmers * (t+1) / n_threads;
+                    db.seek(begin);
+                    for(int64_t i = begin; i < end; i++){
+                        kmers[i] = db.next();
+                        if(counts != nullptr) (*counts)[i] = db.get_last_count();
+                    }
+                });
+            }
+            for(std::thread& t : threads) t.join();
+        } else{
+            Kmer_stream_from_KMC_DB kmc_stream(KMC_db_path, false); // No reverse complements
+            kmers.reserve(n_kmers);
+            while(!kmc_stream.done()){
+                kmers.push_back(kmc_stream.next());
+                if(counts != nullptr) counts->push_back(kmc_stream.get_last_count());
             }
         }
+    }
+
+    // Reads the canonical k-mers of the KMC database into memory and expands them to both orientations in colex order.
+    // Each thread expands and sorts a part of the k-mers, and the parts are merged. The counts are stored if counts is not null.
+    void read_expanded_kmers_into_memory(const string& KMC_db_path, int64_t n_kmers, int64_t n_threads, const ReverseComplementExpansion& expansion, vector<kmer_t>& kmers, vector<uint32_t>* counts){
+        vector<kmer_t> canonical;
+        vector<uint32_t> canonical_counts;
+        read_kmers_into_memory(KMC_db_path, n_kmers, n_threads, canonical, &canonical_counts);
+
+        n_threads = max((int64_t)1, min(n_threads, n_kmers));
+        vector<vector<pair<kmer_t, uint32_t>>> parts(n_threads);
+        vector<std::thread> threads;
+        for(int64_t t = 0; t < n_threads; t++){
+            threads.emplace_back([&, t](){
+                int64_t begin = n_kmers * t / n_threads;
+                int64_t end = n_kmers * (t+1) / n_threads;
+                for(int64_t i = begin; i < end; i++){
+                    expansion(canonical[i], canonical_counts[i], [&](const kmer_t& x, uint32_t count){parts[t].push_back({x, count});});
+                }
+                std::sort(parts[t].begin(), parts[t].end());
+            });
+        }
+        for(std::thread& t : threads) t.join();
+        vector<kmer_t>().swap(canonical);
+        vector<uint32_t>().swap(canonical_counts);
+
+        vector<pair<kmer_t, uint32_t>> expanded = merge_sorted_in_memory(std::move(parts));
+        kmers.resize(expanded.size());
+        if(counts != nullptr) counts->resize(expanded.size());
+        for(int64_t i = 0; i < (int64_t)expanded.size(); i++){
+            kmers[i] = expanded[i].first;
+            if(counts != nullptr) (*counts)[i] = expanded[i].second;
+        }
+    }
 
-        // Clean up
-        for(char c : ACGT) delete char_streams[c];
-        get_temp_file_manager().delete_file(uncompressed_db_filename);
+    // Merges sorted vectors in parallel rounds of pairwise merges
+    template<typename T>
+    vector<T> merge_sorted_in_memory(vector<vector<T>> parts){
+        if(parts.empty()) return {};
+        while(parts.size() > 1){
+            vector<vector<T>> merged((parts.size() + 1) / 2);
+            vector<std::thread> threads;
+            for(int64_t i = 0; i < (int64_t)merged.size(); i++){
+                threads.emplace_back([&, i](){
+                    if(2*i + 1 == (int64_t)parts.size()){
+                        merged[i] = std::move(parts[2*i]);
+                        return;
+                    }
+                    merged[i].resize(parts[2*i].size() + parts[2*i+1].size());
+                    std::merge(parts[2*i].begin(), parts[2*i].end(), parts[2*i+1].begin(), parts[2*i+1].end(), merged[i].begin());
+                    vector<T>().swap(parts[2*i]);
+                    vector<T>().swap(parts[2*i+1]);
+                });
+            }
+            for(std::thread& t : threads) t.join();
+            parts = std::move(merged);
+        }
+        return std::move(parts[0]);
     }
 
-    // Construct the given nodeboss from the given input strings
-    void build(const vector<string>& input_files, nodeboss_t& nodeboss, int64_t k, int64_t n_threads, int64_t ram_gigas, bool streaming_support, int64_t min_abundance, int64_t max_abundance, int64_t precalc_k){
+    // Builds the bit vectors without temporary files: the k-mers are read into memory, the nodes and dummies are
+    // generated in parallel over suffix ranges like in write_nodes_and_sources, and the dummies are sorted in memory.
+    // The result is the same as with the disk-based pipeline. If expansion is not null, the KMC database has canonical
+    // k-mers that are expanded to both orientations. Returns the number of k-mers and deletes the KMC database. If the
+    // k-mers, the k-mers that need dummies and the dummies do not fit in ram_bytes, returns -1 instead and leaves the
+    // KMC database for the disk-based pipeline.
+    int64_t build_bit_vectors_in_memory(const string& KMC_db_path, int64_t n_kmers, int64_t n_threads, vector<uint32_t>* counts,
+            sdsl::bit_vector& A_bits, sdsl::bit_vector& C_bits, sdsl::bit_vector& G_bits, sdsl::bit_vector& T_bits, sdsl::bit_vector& suffix_group_starts, sdsl::bit_vector& dummy_marks, int64_t k,
+            int64_t ram_bytes, const ReverseComplementExpansion* expansion = nullptr){
+
+        write_log("Reading k-mers into memory", LogLevel::MAJOR);
+        vector<kmer_t> kmers;
+        if(expansion != nullptr) read_expanded_kmers_into_memory(KMC_db_path, n_kmers, n_threads, *expansion, kmers, counts);
+        else read_kmers_into_memory(KMC_db_path, n_kmers, n_threads, kmers, counts);
+        n_kmers = kmers.size();
+
+        write_log("Generating nodes and dummies in memory", LogLevel::MAJOR);
+        InMemorySortedKmerDB all_kmers(kmers, counts);
+        vector<KmerRange> ranges = split_into_ranges(all_kmers, max(n_threads, (int64_t)1));
+        Progress_printer pp(n_kmers, 100);
+        std::mutex progress_mutex;
+        auto progress = [&](int64_t n_done){
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            for(int64_t i = 0; i < n_done; i++) pp.job_done();
+        };
+
+        vector<char> edge_flags(kmers.size());
+
+        // The memory of the k-mers that need dummies and of the dummies is counted as the vectors grow.
+        // There can be many more of them than k-mers, so the build gives up if they go over the budget.
+        int64_t fixed_bytes = kmers.size() * (sizeof(kmer_t) + 1) + (counts != nullptr ? counts->size() * sizeof(uint32_t) : 0);
+        std::atomic<int64_t> extra_bytes{0};
+        std::atomic<bool> over_budget{false};
+        auto push_within_budget = [&](auto& v, const auto& x){
+            if(v.size() == v.capacity()){ // The vector doubles
+                extra_bytes += max((int64_t)v.capacity(), (int64_t)1) * (int64_t)sizeof(x);
+                if(fixed_bytes + extra_bytes > ram_bytes) over_budget = true;
+            }
+            if(!over_budget) v.push_back(x);
+        };
+
+        vector<vector<Node>> range_dummies(ranges.size());
+        vector<std::thread> threads;
+        for(int64_t r = 0; r < (int64_t)ranges.size(); r++){
+            threads.emplace_back([&, r](){
+                vector<kmer_t> sources;
+                generate_nodes_and_sources_in_range(all_kmers, ranges[r],
+                    [&](int64_t x_idx, Node& node){edge_flags[x_idx] = node.edge_flags;},
+                    [&](const kmer_t& z){push_within_budget(sources, z);},
+                    progress, nullptr); // The counts are already in colex order
+
+                // Dummies shared with another range are merged when the bit vectors are built
+                std::sort(sources.begin(), sources.end(), lex_less);
+                vector<Node>& dummies = range_dummies[r];
+                for(int64_t i = 0; i < (int64_t)sources.size() && !over_budget; i++){
+                    for_each_new_prefix_node(sources[i], i > 0 ? sources[i-1] : kmer_t(), [&](Node& node){push_within_budget(dummies, node);});
+                }
+                extra_bytes -= (int64_t)(sources.capacity() * sizeof(kmer_t));
+                vector<kmer_t>().swap(sources);
+                std::sort(dummies.begin(), dummies.end());
+                dummies.erase(std::unique(dummies.begin(), dummies.end()), dummies.end());
+            });
+        }
+        for(std::thread& t : threads) t.join();
+
+        // Merging holds two copies of the dummies
+        int64_t n_dummies = 0;
+        for(const vector<Node>& v : range_dummies) n_dummies += v.size();
+        if(over_budget || fixed_bytes + 2 * n_dummies * (int64_t)sizeof(Node) > ram_bytes){
+            write_log("The dummy nodes do not fit in the RAM budget: building on disk instead", LogLevel::MAJOR);
+            return -1;
+        }
+        std::filesystem::remove(KMC_db_path + ".kmc_pre");
+        std::filesystem::remove(KMC_db_path + ".kmc_suf");
+
+        write_log("Merging sorted dummies in memory", LogLevel::MAJOR);
+        vector<Node> dummies = merge_sorted_in_memory(std::move(range_dummies));
+
+        InMemoryNodeMerger merger(kmers, edge_flags, dummies);
+        build_bit_vectors_from_merger(merger, kmers.size() + dummies.size() + 1, A_bits, C_bits, G_bits, T_bits, suffix_group_starts, dummy_marks, k); // + the root
+        return n_kmers;
+    }
 
+    // Construct the given nodeboss from the given input strings. If store_counts is true, the KMC abundances
+    // of the k-mers are stored in the nodeboss. They are capped at max_abundance. If add_reverse_complements is true,
+    // the reverse complements of the k-mers are added, as if the input also had the reverse complements of the sequences.
+    void build(const vector<string>& input_files, nodeboss_t& nodeboss, int64_t k, int64_t n_threads, int64_t ram_gigas, bool streaming_support, int64_t min_abundance, int64_t max_abundance, int64_t precalc_k, bool store_counts = false, bool add_reverse_complements = false){
+        if(k > max_len) throw std::runtime_error("The k-mer length " + to_string(k) + " is larger than the maximum " + to_string(max_len));
+
+        // KMC caps the counts at 255 by default. When the counts are kept, let them go as high as the abundance filter allows.
+        // With reverse complements, the counts are also needed for the abundance filter after the expansion.
+        int64_t counter_max = store_counts || add_reverse_complements ? min(max_abundance, (int64_t)UINT32_MAX) : 255;
+        ReverseComplementExpansion expansion(min_abundance, max_abundance);
+        int64_t kmc_min_abundance = add_reverse_complements ? ReverseComplementExpansion::kmc_min_abundance(min_abundance, k) : min_abundance;
         string KMC_db_path; int64_t n_kmers;
-        std::tie(KMC_db_path, n_kmers) = run_kmc(input_files, k, n_threads, ram_gigas, min_abundance, max_abundance);
-
-        string nodes_outfile = get_temp_file_manager().create_filename();
-        string dummies_outfile = get_temp_file_manager().create_filename();
-
-        write_log("Writing nodes and dummies to disk", LogLevel::MAJOR);
-        write_nodes_and_dummies(KMC_db_path, nodes_outfile, dummies_outfile, n_kmers);
-
-        write_log("Sorting dummies on disk", LogLevel::MAJOR);
-        string dummies_sortedfile = get_temp_file_manager().create_filename();
-        EM_sort_constant_binary(dummies_outfile, dummies_sortedfile, 
-            [](const char* A, const char* B){
-                Node Ax; Ax.load(A);
-                Node Bx; Bx.load(B);
-                return Ax < Bx;
-            }, ram_gigas * ((int64_t)1 <<30), Node::size_in_bytes(), n_threads);
-        
-        write_log("Merging sorted streams", LogLevel::MAJOR);
-        sdsl::bit_vector A_bits, C_bits, G_bits, T_bits, suffix_group_starts;
-        build_bit_vectors_from_sorted_streams(nodes_outfile, dummies_sortedfile, A_bits, C_bits, G_bits, T_bits, suffix_group_starts, k);
+        std::tie(KMC_db_path, n_kmers) = run_kmc(input_files, k, n_threads, ram_gigas, kmc_min_abundance, max_abundance, counter_max, add_reverse_complements);
+
+        vector<uint32_t> counts;
+        sdsl::bit_vector A_bits, C_bits, G_bits, T_bits, suffix_group_starts, dummy_marks;
+
+        // The k-mers and their edge flags take n_kmers * (sizeof(kmer_t) + 1) bytes in memory. The rest of the
+        // budget is left for the dummies, which are usually far fewer than the k-mers, and for merging them.
+        // If the dummies turn out not to fit, the in-memory build gives up and the disk-based pipeline is used.
+        int64_t n_expanded_kmers = add_reverse_complements ? 2 * n_kmers : n_kmers; // At most
+        bool built_in_memory = false;
+        if(in_memory_fast_path && n_expanded_kmers * (int64_t)(sizeof(kmer_t) + 1) * 4 <= ram_gigas * ((int64_t)1 << 30)){
+            write_log("The k-mers fit in the RAM budget: building in memory", LogLevel::MAJOR);
+            int64_t n_built = build_bit_vectors_in_memory(KMC_db_path, n_kmers, n_threads, store_counts ? &counts : nullptr, A_bits, C_bits, G_bits, T_bits, suffix_group_starts, dummy_marks, k,
+                ram_gigas * ((int64_t)1 << 30), add_reverse_complements ? &expansion : nullptr);
+            if(n_built != -1){
+                n_kmers = n_built;
+                built_in_memory = true;
+            } else vector<uint32_t>().swap(counts);
+        }
+        if(!built_in_memory){
+            string nodes_outfile = get_temp_file_manager().create_filename();
+            string sources_outfile = get_temp_file_manager().create_filename();
+
+            write_log("Writing nodes and dummies to disk", LogLevel::MAJOR);
+            if(add_reverse_complements)
+                n_kmers = write_nodes_and_sources_with_reverse_complements(KMC_db_path, nodes_outfile, sources_outfile, n_threads, ram_gigas, k, expansion, store_counts ? &counts : nullptr);
+            else
+                write_nodes_and_sources(KMC_db_path, nodes_outfile, sources_outfile, n_kmers, n_threads, k, store_counts ? &counts : nullptr);
+
+            // Sorting the k-mers that need dummies lexicographically groups the k-mers with common prefixes, so that
+            // each dummy node is written only once
+            string sources_sortedfile = get_temp_file_manager().create_filename();
+            TempRecordFormat kmer_format = kmer_file_format(k);
+            EM_sort_constant_binary(sources_outfile, sources_sortedfile,
+                [&kmer_format](const char* A, const char* B){
+                    return lex_less(kmer_format.load_kmer(A), kmer_format.load_kmer(B));
+                }, ram_gigas * ((int64_t)1 <<30), kmer_format.kmer_size_in_bytes(), n_threads);
+            get_temp_file_manager().delete_file(sources_outfile);
+            write_log("Writing distinct dummies to disk", LogLevel::MAJOR);
+            string dummies_outfile = get_temp_file_manager().create_filename();
+            write_distinct_dummies(sources_sortedfile, dummies_outfile, k);
+            get_temp_file_manager().delete_file(sources_sortedfile);
+
+            write_log("Sorting dummies on disk", LogLevel::MAJOR);
+            string dummies_sortedfile = get_temp_file_manager().create_filename();
+            TempRecordFormat dummy_format = dummy_file_format(k);
+            EM_sort_constant_binary(dummies_outfile, dummies_sortedfile, 
+                [&dummy_format](const char* A, const char* B){
+                    return dummy_format.node_less(A, B); // The records compare in the same order as the nodes
+                }, ram_gigas * ((int64_t)1 <<30), dummy_format.node_size_in_bytes(), n_threads);
+            
+            write_log("Merging sorted streams", LogLevel::MAJOR);
+            build_bit_vectors_from_sorted_streams(nodes_outfile, dummies_sortedfile, A_bits, C_bits, G_bits, T_bits, suffix_group_starts, dummy_marks, k);
+        }
         
         write_log("Building SBWT structure", LogLevel::MAJOR);
         if(streaming_support){
@@ -234,8 +765,33 @@ public:
             sdsl::bit_vector empty;
             nodeboss = nodeboss_t(A_bits, C_bits, G_bits, T_bits, empty, k, n_kmers, precalc_k);
         }
+        nodeboss.set_dummy_marks(dummy_marks);
+        if(store_counts){
+            uint32_t max_count = 0;
+            for(uint32_t c : counts) max_count = max(max_count, c);
+            sdsl::int_vector<> counts_iv(counts.size(), 0, max((int64_t)1, (int64_t)(64 - __builtin_clzll((uint64_t)max_count | 1))));
+            for(int64_t i = 0; i < (int64_t)counts.size(); i++) counts_iv[i] = counts[i];
+            nodeboss.set_counts(counts_iv);
+        }
             
     }
 };
 
+// Builds with NodeBOSSKMCConstructor<nodeboss_t, w> for the smallest w out of 32, 64, 128, ... and MAX_KMER_LENGTH
+// that is at least k. This way, small k get the single-word k-mer type even if MAX_KMER_LENGTH is large.
+template<typename nodeboss_t, int64_t max_len = 32>
+void build_with_kmc(const vector<string>& input_files, nodeboss_t& nodeboss, int64_t k, int64_t n_threads, int64_t ram_gigas, bool streaming_support, int64_t min_abundance, int64_t max_abundance, int64_t precalc_k, bool store_counts = false, bool add_reverse_complements = false){
+    if constexpr(max_len >= MAX_KMER_LENGTH){
+        if(k > MAX_KMER_LENGTH) throw std::runtime_error("The k-mer length " + to_string(k) + " is larger than the maximum " + to_string(MAX_KMER_LENGTH) + ". Recompile with a larger -DMAX_KMER_LENGTH.");
+        NodeBOSSKMCConstructor<nodeboss_t, MAX_KMER_LENGTH> builder;
+        builder.build(input_files, nodeboss, k, n_threads, ram_gigas, streaming_support, min_abundance, max_abundance, precalc_k, store_counts, add_reverse_complements);
+    } else if(k <= max_len){
+        write_log("Using k-mers of at most " + to_string(max_len) + " characters in the construction", LogLevel::MINOR);
+        NodeBOSSKMCConstructor<nodeboss_t, max_len> builder;
+        builder.build(input_files, nodeboss, k, n_threads, ram_gigas, streaming_support, min_abundance, max_abundance, precalc_k, store_counts, add_reverse_complements);
+    } else{
+        build_with_kmc<nodeboss_t, max_len * 2>(input_files, nodeboss, k, n_threads, ram_gigas, streaming_support, min_abundance, max_abundance, precalc_k, store_counts, add_reverse_complements);
+    }
+}
+
 }
\ No newline at end of file
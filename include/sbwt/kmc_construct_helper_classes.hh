@@ -7,6 +7,10 @@
 #include <set>
 #include <unordered_map>
 #include <stdexcept>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
 
 class CKMCFile; // Defined in KMC
 class CKmerAPI; // Defined in KMC
@@ -15,28 +19,120 @@ namespace sbwt{
 
 namespace KMC_construction_helper_classes{
 
+// The classes are templates on the maximum k-mer length so that the construction can use the
+// narrowest k-mer type that fits k. See build_with_kmc in kmc_construct.hh.
 
-typedef Kmer<MAX_KMER_LENGTH> kmer_t;
-
+template<int64_t max_len>
 struct Node{
+    typedef Kmer<max_len> kmer_t;
+
     kmer_t kmer;
     char edge_flags;
 
-    Node();
-    Node(kmer_t kmer);
+    Node() : kmer(), edge_flags(0) {}
+    Node(kmer_t kmer) : kmer(kmer), edge_flags(0) {}
 
     static inline int64_t size_in_bytes(){
         return kmer_t::size_in_bytes() + sizeof(char); // char is the edge flags
     }
 
-    void set(char c);
-    bool has(char c) const;
-    bool operator==(const Node &other) const;
-    bool operator!=(const Node &other) const;
-    bool operator<(const Node &other) const;
-    string to_string() const;
-    void serialize(char* buf);
-    void load(const char* buf);
+    void set(char c){
+        if(c == 'A') edge_flags |= 1 << 0;
+        else if(c == 'C') edge_flags |= 1 << 1;
+        else if(c == 'G') edge_flags |= 1 << 2;
+        else if(c == 'T') edge_flags |= 1 << 3;
+    }
+
+    bool has(char c) const{
+        if(c == 'A') return edge_flags & (1 << 0);
+        else if(c == 'C') return edge_flags & (1 << 1);
+        else if(c == 'G') return edge_flags & (1 << 2);
+        else if(c == 'T') return edge_flags & (1 << 3);
+        return false;
+    }
+
+    bool operator==(const Node &other) const{
+        return this->kmer == other.kmer && this->edge_flags == other.edge_flags;
+    }
+
+    bool operator!=(const Node &other) const{
+        return !(*this == other);
+    }
+
+    bool operator<(const Node &other) const{
+        if(this->kmer < other.kmer) return true;
+        if(this->kmer == other.kmer && this->edge_flags < other.edge_flags) return true;
+        return false;
+    }
+
+    string to_string() const{
+        string S = kmer.to_string() + ": ";
+        S += has('A') ? '1' : '0';
+        S += has('C') ? '1' : '0';
+        S += has('G') ? '1' : '0';
+        S += has('T') ? '1' : '0';
+        return S;
+    }
+
+    void serialize(char* buf){
+        kmer.serialize(buf);
+        buf[size_in_bytes()-1] = edge_flags;
+    }
+
+    void load(const char* buf){
+        kmer.load(buf);
+        edge_flags = buf[size_in_bytes()-1];
+    }
+
+};
+
+// Layout of the k-mer and node records of the construction temp files. A k-mer takes ceil(2*max_k/8) bytes
+// instead of the whole data array of Kmer<max_len>. If all k-mers of a file have length max_k, the
+// length is a property of the file and is not stored in the records. Otherwise a length byte follows the
+// characters. A node record is the k-mer record followed by the edge flags. Records of the same format
+// compare with memcmp in the same order as the k-mers and the nodes compare.
+template<int64_t max_len>
+class TempRecordFormat{
+
+    typedef Kmer<max_len> kmer_t;
+
+    int64_t max_k = 0;
+    bool variable_length = false;
+
+    int64_t packed_bytes() const {return kmer_t::packed_size_in_bytes(max_k);}
+
+public:
+
+    TempRecordFormat() {}
+    TempRecordFormat(int64_t max_k, bool variable_length) : max_k(max_k), variable_length(variable_length) {}
+
+    int64_t kmer_size_in_bytes() const {return packed_bytes() + (variable_length ? 1 : 0);}
+    int64_t node_size_in_bytes() const {return kmer_size_in_bytes() + 1;}
+
+    void serialize_kmer(const kmer_t& x, char* buf) const{
+        x.serialize_packed(buf, packed_bytes());
+        if(variable_length) buf[packed_bytes()] = x.get_k();
+    }
+
+    kmer_t load_kmer(const char* buf) const{
+        kmer_t x;
+        x.load_packed(buf, packed_bytes(), variable_length ? (uint8_t)buf[packed_bytes()] : max_k);
+        return x;
+    }
+
+    void serialize_node(const Node<max_len>& x, char* buf) const{
+        serialize_kmer(x.kmer, buf);
+        buf[kmer_size_in_bytes()] = x.edge_flags;
+    }
+
+    Node<max_len> load_node(const char* buf) const{
+        Node<max_len> x(load_kmer(buf));
+        x.edge_flags = buf[kmer_size_in_bytes()];
+        return x;
+    }
+
+    bool kmer_less(const char* A, const char* B) const {return memcmp(A, B, kmer_size_in_bytes()) < 0;}
+    bool node_less(const char* A, const char* B) const {return memcmp(A, B, node_size_in_bytes()) < 0;}
 
 };
 
@@ -59,6 +155,7 @@ public:
 };
 
 // Also gives reverse complements if asked
+template<int64_t max_len>
 class Kmer_stream_from_KMC_DB{
 
 private:
@@ -76,6 +173,7 @@ private:
     uint64_t _total_kmers;
 
     bool add_revcomps;
+    uint32_t last_count = 0;
     std::string str;
     std::string str_revcomp;
     bool revcomp_next = false;
@@ -89,32 +187,62 @@ public:
     Kmer_stream_from_KMC_DB(string KMC_db_path, bool add_revcomps);
 
     bool done();
-    Kmer<MAX_KMER_LENGTH> next();
+    Kmer<max_len> next();
+
+    // The abundance of the k-mer returned by the last call to next(). A reverse complement added by this class has the same abundance as its k-mer.
+    int64_t get_last_count() const {return last_count;}
 
     ~Kmer_stream_from_KMC_DB();
 };
 
+template<int64_t max_len>
 class SimpleSortedKmerDB{
 
     private:
 
     string filename;
+    TempRecordFormat<max_len> format;
+    int64_t record_size = 0; // Bytes from the start of a k-mer record to the next. The k-mer is at the start of the record.
+    bool has_counts = false; // Whether a uint32_t count follows the k-mer in each record
     int64_t cursor = 0;
     int64_t n_kmers = 0;
     seq_io::Buffered_ifstream<> in;
     vector<int64_t> char_block_starts;
+    vector<char> kmer_load_buf;
+
+    // Sets n_kmers and char_block_starts by reading the whole file
+    void index_records(){
+        n_kmers = std::filesystem::file_size(filename) / record_size;
+        in.open(filename, ios::binary);
+        for(int64_t i = 0; i < n_kmers; i++){
+            in.read(kmer_load_buf.data(), record_size);
+            Kmer<max_len> kmer = format.load_kmer(kmer_load_buf.data());
+            char_block_starts[kmer.last()] = min(char_block_starts[kmer.last()], i);
+        }
+
+        for(char c : "ACGT"){
+            char_block_starts[c] = min(char_block_starts[c], n_kmers); // One past end
+        }
+
+        in.open(filename, ios::binary);
+    }
 
     public:
 
-    // From KMC database. KMC database must be sorted!!
-    SimpleSortedKmerDB(Kmer_stream_from_KMC_DB& sorted_kmc_db, string filename) : filename(filename), char_block_starts(256, INT64_MAX) {
+    // From KMC database of k-mers of length k, or another stream with the same interface. KMC database must be sorted!! If store_counts is true, the abundances of the k-mers are written to the file too, and get_last_count() gives them.
+    template<typename kmer_stream_t>
+    SimpleSortedKmerDB(kmer_stream_t& sorted_kmc_db, string filename, int64_t k, bool store_counts = false) : filename(filename), format(k, false), record_size(format.kmer_size_in_bytes() + (store_counts ? sizeof(uint32_t) : 0)), has_counts(store_counts), char_block_starts(256, INT64_MAX), kmer_load_buf(record_size) {
         seq_io::Buffered_ofstream<> out(filename);
-        char kmer_write_buf[Kmer<MAX_KMER_LENGTH>::size_in_bytes()];
+        vector<char> record_write_buf(record_size);
 
         while(!sorted_kmc_db.done()){
-            Kmer<MAX_KMER_LENGTH> kmer = sorted_kmc_db.next();
-            kmer.serialize(kmer_write_buf);
-            out.write(kmer_write_buf, Kmer<MAX_KMER_LENGTH>::size_in_bytes());
+            Kmer<max_len> kmer = sorted_kmc_db.next();
+            format.serialize_kmer(kmer, record_write_buf.data());
+            if(has_counts){
+                uint32_t count = sorted_kmc_db.get_last_count();
+                memcpy(record_write_buf.data() + format.kmer_size_in_bytes(), &count, sizeof(uint32_t));
+            }
+            out.write(record_write_buf.data(), record_size);
 
             char_block_starts[kmer.last()] = min(char_block_starts[kmer.last()], n_kmers);
 
@@ -129,9 +257,22 @@ class SimpleSortedKmerDB{
         in.open(filename, ios::binary);
     }
 
+    // Reads an existing file of sorted records in place. Each record is a k-mer of the given format followed by
+    // record_size - format.kmer_size_in_bytes() bytes of other data. If has_counts is true, the other data starts
+    // with the count of the k-mer as a uint32_t. The file is not deleted by this class.
+    SimpleSortedKmerDB(string filename, TempRecordFormat<max_len> format, int64_t record_size, bool has_counts) : filename(filename), format(format), record_size(record_size), has_counts(has_counts), char_block_starts(256, INT64_MAX), kmer_load_buf(record_size) {
+        if(has_counts && record_size < format.kmer_size_in_bytes() + (int64_t)sizeof(uint32_t))
+            throw std::runtime_error("Error: the records are too short to have counts");
+        index_records();
+    }
+
     // Clones the object
     SimpleSortedKmerDB(const SimpleSortedKmerDB& other){
         filename = other.filename;
+        format = other.format;
+        record_size = other.record_size;
+        has_counts = other.has_counts;
+        kmer_load_buf.resize(record_size);
         cursor = other.cursor;
         n_kmers = other.n_kmers;
         in.open(filename, ios::binary);
@@ -142,30 +283,178 @@ class SimpleSortedKmerDB{
         return char_block_starts[c];
     }
 
+    // One past the last k-mer that ends in c
+    int64_t get_char_block_end(char c){
+        int64_t end = n_kmers;
+        for(char d : {'A','C','G','T'}) if(d > c) end = min(end, char_block_starts[d]);
+        return end;
+    }
+
+    int64_t size() const{
+        return n_kmers;
+    }
+
+    int64_t get_cursor() const{
+        return cursor;
+    }
+
     bool done(){
         return cursor >= n_kmers;
     }
 
-    void seek_to_char_block(char c){
-        cursor = char_block_starts[c];
+    // Moves the cursor to the k-mer at the given position in colexicographic order
+    void seek(int64_t pos){
+        cursor = pos;
         in.open(filename, ios::binary);
-        in.seekg(cursor * Kmer<MAX_KMER_LENGTH>::size_in_bytes());
+        in.seekg(cursor * record_size);
     }
 
-    Kmer<MAX_KMER_LENGTH> next(){
-        char kmer_load_buf[Kmer<MAX_KMER_LENGTH>::size_in_bytes()];
-        in.read(kmer_load_buf, Kmer<MAX_KMER_LENGTH>::size_in_bytes());
-
-        Kmer<MAX_KMER_LENGTH> x;
-        x.load(kmer_load_buf);
+    void seek_to_char_block(char c){
+        seek(char_block_starts[c]);
+    }
 
+    Kmer<max_len> next(){
+        in.read(kmer_load_buf.data(), record_size);
         cursor++;
-        return x;
+        return format.load_kmer(kmer_load_buf.data());
+    }
+
+    // The abundance of the k-mer returned by the last call to next()
+    int64_t get_last_count() const{
+        if(!has_counts) throw std::runtime_error("Error: the k-mer file does not have counts");
+        uint32_t count;
+        memcpy(&count, kmer_load_buf.data() + format.kmer_size_in_bytes(), sizeof(uint32_t));
+        return count;
+    }
+
+};
+
+// Random access to the k-mers of a sorted KMC database in the KMC1 layout, which is what kmc_tools sort
+// writes: the suffix file has a 4-byte marker followed by fixed-size records of the k-mer without its
+// lut_prefix_length first characters and the counter, and the prefix file has a 4-byte marker followed
+// by the index of the first record of every prefix. The records are read from the suffix file without
+// copying the database. Copies of the object share the prefix table and have their own cursor.
+// The k-mers are returned reversed, like in Kmer_stream_from_KMC_DB, so that they are in colex order.
+template<int64_t max_len>
+class SortedKMCDatabase{
+
+    private:
+
+    string suffix_filename;
+    std::shared_ptr<const vector<int64_t>> lut; // lut[p] = index of the first record with prefix p, followed by the number of records
+    int64_t k = 0;
+    int64_t lut_prefix_length = 0;
+    int64_t suffix_bytes = 0;
+    int64_t counter_bytes = 0;
+    int64_t n_kmers = 0;
+    vector<int64_t> char_block_starts;
+
+    int64_t cursor = 0;
+    int64_t prefix = 0; // Prefix of the record at the cursor
+    uint32_t last_count = 0;
+    seq_io::Buffered_ifstream<> in;
+    vector<char> record_buf;
+    string str;
+
+    int64_t record_bytes() const {return suffix_bytes + counter_bytes;}
+
+    public:
+
+    // Throws std::runtime_error if the files are not in the expected layout
+    SortedKMCDatabase(const string& KMC_db_path);
+
+    // Clones the object
+    SortedKMCDatabase(const SortedKMCDatabase& other);
+
+    // Checks that the first n k-mers and counts are the same as those listed by the KMC API
+    bool matches_kmc_listing(const string& KMC_db_path, int64_t n);
+
+    int64_t get_char_block_start(char c) const {return char_block_starts[c];}
+
+    // One past the last k-mer that ends in c
+    int64_t get_char_block_end(char c) const{
+        int64_t end = n_kmers;
+        for(char d : {'A','C','G','T'}) if(d > c) end = min(end, char_block_starts[d]);
+        return end;
+    }
+
+    int64_t size() const {return n_kmers;}
+
+    int64_t get_cursor() const {return cursor;}
+
+    bool done() const {return cursor >= n_kmers;}
+
+    // Moves the cursor to the k-mer at the given position in colexicographic order
+    void seek(int64_t pos);
+
+    void seek_to_char_block(char c) {seek(char_block_starts[c]);}
+
+    Kmer<max_len> next();
+
+    // The abundance of the k-mer returned by the last call to next()
+    int64_t get_last_count() const {return last_count;}
+
+};
+
+// Colex-sorted k-mers in memory, with the same interface as SimpleSortedKmerDB. Does not own the
+// k-mers, so copies are cheap and have their own cursor.
+template<int64_t max_len>
+class InMemorySortedKmerDB{
+
+    private:
+
+    typedef Kmer<max_len> kmer_t;
+
+    const vector<kmer_t>* kmers;
+    const vector<uint32_t>* counts; // Null if there are no counts
+    int64_t cursor = 0;
+    vector<int64_t> char_block_starts;
+
+    public:
+
+    // If counts is not null, counts[i] is the abundance of kmers[i].
+    InMemorySortedKmerDB(const vector<kmer_t>& kmers, const vector<uint32_t>* counts = nullptr) : kmers(&kmers), counts(counts), char_block_starts(256, INT64_MAX) {
+        for(char c : {'A','C','G','T'}){ // First k-mer that ends in c or later
+            char_block_starts[c] = std::partition_point(kmers.begin(), kmers.end(), [c](const kmer_t& x){return x.last() < c;}) - kmers.begin();
+        }
+        for(char c : {'A','C','G','T'}){
+            if(char_block_starts[c] < (int64_t)kmers.size() && kmers[char_block_starts[c]].last() != c)
+                char_block_starts[c] = kmers.size(); // No k-mers end in c
+        }
+    }
+
+    int64_t get_char_block_start(char c) const {return char_block_starts[c];}
+
+    // One past the last k-mer that ends in c
+    int64_t get_char_block_end(char c) const{
+        int64_t end = kmers->size();
+        for(char d : {'A','C','G','T'}) if(d > c) end = min(end, char_block_starts[d]);
+        return end;
+    }
+
+    int64_t size() const {return kmers->size();}
+
+    int64_t get_cursor() const {return cursor;}
+
+    bool done() const {return cursor >= (int64_t)kmers->size();}
+
+    // Moves the cursor to the k-mer at the given position in colexicographic order
+    void seek(int64_t pos) {cursor = pos;}
+
+    void seek_to_char_block(char c) {seek(char_block_starts[c]);}
+
+    kmer_t next() {return (*kmers)[cursor++];}
+
+    // The abundance of the k-mer returned by the last call to next()
+    int64_t get_last_count() const{
+        if(counts == nullptr) throw std::runtime_error("Error: the k-mers do not have counts");
+        return (*counts)[cursor-1];
     }
 
 };
 
 // This stream will always start with an empty k-mer with an empty edge label set
+template<int64_t max_len>
 class Disk_Instream{
 
 private:
@@ -176,37 +465,70 @@ private:
 
     bool all_read = false;
     seq_io::Buffered_ifstream<> in;
+    TempRecordFormat<max_len> format;
     char* in_buffer;
 
-    Node top; // Default-initialized to an empty k-mer and an empty edge set
+    Node<max_len> top; // Default-initialized to an empty k-mer and an empty edge set
 
-    void update_top();
+    void update_top(){
+        in.read(in_buffer, format.node_size_in_bytes());
+        if(in.eof()){
+            all_read = true;
+            return;
+        }
+        top = format.load_node(in_buffer);
+    }
 
 public:
 
-    Disk_Instream(string filename);
-    bool stream_done() const;
-    Node stream_next();
-    Node peek_next();
-    ~Disk_Instream();
+    Disk_Instream(string filename, TempRecordFormat<max_len> format) : format(format) {
+        in.open(filename, ios_base::binary);
+        in_buffer = (char*)malloc(format.node_size_in_bytes());
+    }
+
+    bool stream_done() const{
+        return all_read;
+    }
+
+    Node<max_len> stream_next(){
+        Node<max_len> ret = top;
+        update_top();
+        return ret;
+    }
+
+    Node<max_len> peek_next(){
+        return top;
+    }
+
+    ~Disk_Instream(){
+        free(in_buffer);
+    }
 
 };
 
 // A single sorted stream out of two sorted streams
+template<int64_t max_len>
 class Node_stream_merger{
 
-    Disk_Instream& A;
-    Disk_Instream& B;
+    Disk_Instream<max_len>& A;
+    Disk_Instream<max_len>& B;
 
 public:
 
-    Node_stream_merger(Disk_Instream& A, Disk_Instream& B);
+    Node_stream_merger(Disk_Instream<max_len>& A, Disk_Instream<max_len>& B) : A(A), B(B){}
 
-    bool stream_done();
+    bool stream_done(){
+        return A.stream_done() && B.stream_done();
+    }
 
-    Node stream_next();
+    Node<max_len> stream_next(){
+        if(A.stream_done()) return B.stream_next();
+        if(B.stream_done()) return A.stream_next();
+        if(A.peek_next() < B.peek_next()) return A.stream_next();
+        else return B.stream_next();
+    }
 
 };
 
 } // End of namespace KMC_construction_helper_classes
-} // End of namepace sbwt
\ No newline at end of file
+} // End of namepace sbwt
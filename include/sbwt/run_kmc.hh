@@ -10,8 +10,10 @@ namespace sbwt{
 
 using namespace std;
 
-// Returns the KMC database prefix and the number of distinct k-mers that had abundance within the given bounds
-pair<string, int64_t> run_kmc(const vector<string>& input_files, int64_t k, int64_t n_threads, int64_t ram_gigas, int64_t min_abundance, int64_t max_abundance);
+// Returns the KMC database prefix and the number of distinct k-mers that had abundance within the given bounds.
+// The counts in the database are capped at counter_max. If canonical is true, a k-mer and its reverse complement
+// are counted together as one k-mer, and a palindromic k-mer is counted once per occurrence.
+pair<string, int64_t> run_kmc(const vector<string>& input_files, int64_t k, int64_t n_threads, int64_t ram_gigas, int64_t min_abundance, int64_t max_abundance, int64_t counter_max = 255, bool canonical = false);
 
 // Sort a KMC database
 void sort_kmc_db(const string& input_db_file, const string& output_db_file, int64_t n_threads);
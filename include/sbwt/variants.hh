@@ -10,6 +10,7 @@
 #include "SubsetSplitRank.hh"
 #include "SubsetMatrixRank.hh"
 #include "SubsetConcatRank.hh"
+#include "SubsetInterleavedRank.hh"
 #include <filesystem>
 #include "MEF.hpp"
 
@@ -19,6 +20,7 @@ namespace sbwt{
 typedef SBWT<SubsetMatrixRank<sdsl::bit_vector, sdsl::rank_support_v5<>>> plain_matrix_sbwt_t;
 typedef SBWT<SubsetMatrixRank<sdsl::rrr_vector<>, sdsl::rrr_vector<>::rank_1_type>> rrr_matrix_sbwt_t;
 typedef SBWT<SubsetMatrixRank<mod_ef_vector<>, mod_ef_vector<>::rank_1_type>> mef_matrix_sbwt_t; // Currently does not support extracting all k-mers because mod_ef_vector does not support access.
+typedef SBWT<SubsetInterleavedRank> interleaved_matrix_sbwt_t; // All four bit vectors, their rank counters and the suffix group starts in cache-line blocks.
 
 // splits
 typedef SBWT<SubsetSplitRank<sdsl::bit_vector, sdsl::rank_support_v5<>,
@@ -62,4 +64,13 @@ typedef SBWT<SubsetWT<sdsl::wt_blcd<sdsl::rrr_vector<>,
                                 rrr_vector<>::select_0_type>>
             > rrr_sswt_sbwt_t;
 
+// Copies the optional components of a plain matrix SBWT (the LCS array, the dummy node marks and the
+// counts) to another variant built from the same bit vectors. Components that were not built are empty.
+template<typename sbwt_t>
+void copy_optional_components(sbwt_t& sbwt, const plain_matrix_sbwt_t& plain){
+    sbwt.set_lcs(plain.get_lcs());
+    sbwt.set_dummy_marks(plain.get_dummy_marks());
+    sbwt.set_counts(plain.get_counts());
+}
+
 }
@@ -7,7 +7,7 @@
 
 using namespace std;
 
-static vector<string> commands = {"build", "build-variant", "search", "ascii-export"};
+static vector<string> commands = {"build", "build-variant", "search", "matching-statistics", "ascii-export", "dump-kmers", "serve", "client"};
 
 void print_help(int argc, char** argv){
     (void) argc; // Unused parameter
@@ -42,8 +42,12 @@ int main(int argc, char** argv){
     try{
         if(command == "build") return build_main(argc, argv);
         else if(command == "search") return search_main(argc, argv);
+        else if(command == "matching-statistics") return matching_statistics_main(argc, argv);
         else if(command == "build-variant") return build_from_plain_main(argc, argv);
         else if(command == "ascii-export") return ascii_export_main(argc, argv);
+        else if(command == "dump-kmers") return dump_kmers_main(argc, argv);
+        else if(command == "serve") return serve_main(argc, argv);
+        else if(command == "client") return client_main(argc, argv);
         else{
             throw std::runtime_error("Invalid command: " + command);
             return 1;
@@ -52,28 +52,41 @@ int ascii_export_main(int argc, char** argv){
     write_log("Loading and exporting the index variant " + variant, LogLevel::MAJOR);
     seq_io::Buffered_ofstream<> out(outfile);
 
+    // Only the sets and the metadata are exported, so the optional components are not read
+    SBWTLoadConfig load_config;
+    load_config.streaming_support = false;
+    load_config.precalc = false;
+    load_config.lcs = false;
+    load_config.dummy_marks = false;
+    load_config.counts = false;
+
     if (variant == "plain-matrix"){
         plain_matrix_sbwt_t sbwt;
-        sbwt.load(in.stream);
+        sbwt.load(in.stream, load_config);
         export_sbwt_variant(sbwt, out);
     }
     if (variant == "rrr-matrix"){
         rrr_matrix_sbwt_t sbwt;
-        sbwt.load(in.stream);
+        sbwt.load(in.stream, load_config);
         export_sbwt_variant(sbwt, out);
     }
     if (variant == "mef-matrix"){
         cerr << "Error: Index export does not work for mef-matrix because mef does not implement access to the sets" << endl;
         return 1;
     }
+    if (variant == "interleaved-matrix"){
+        interleaved_matrix_sbwt_t sbwt;
+        sbwt.load(in.stream, load_config);
+        export_sbwt_variant(sbwt, out);
+    }
     if (variant == "plain-split"){
         plain_split_sbwt_t sbwt;
-        sbwt.load(in.stream);
+        sbwt.load(in.stream, load_config);
         export_sbwt_variant(sbwt, out);
     }
     if (variant == "rrr-split"){
         rrr_split_sbwt_t sbwt;
-        sbwt.load(in.stream);
+        sbwt.load(in.stream, load_config);
         export_sbwt_variant(sbwt, out);
     }
     if (variant == "mef-split"){
@@ -82,7 +95,7 @@ int ascii_export_main(int argc, char** argv){
     }
     if (variant == "plain-concat"){
         plain_concat_sbwt_t sbwt;
-        sbwt.load(in.stream);
+        sbwt.load(in.stream, load_config);
         export_sbwt_variant(sbwt, out);
     }
     if (variant == "mef-concat"){
@@ -91,12 +104,12 @@ int ascii_export_main(int argc, char** argv){
     }
     if (variant == "plain-subsetwt"){
         plain_sswt_sbwt_t sbwt;
-        sbwt.load(in.stream);
+        sbwt.load(in.stream, load_config);
         export_sbwt_variant(sbwt, out);
     }
     if (variant == "rrr-subsetwt"){
         rrr_sswt_sbwt_t sbwt;
-        sbwt.load(in.stream);
+        sbwt.load(in.stream, load_config);
         export_sbwt_variant(sbwt, out);
     }
 
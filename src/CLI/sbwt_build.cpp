@@ -11,7 +11,7 @@
 using namespace std;
 
 std::vector<std::string> get_available_variants(){
-    return {"plain-matrix", "rrr-matrix", "mef-matrix", "plain-split", "rrr-split", "mef-split", "plain-concat", "mef-concat", "plain-subsetwt", "rrr-subsetwt"};
+    return {"plain-matrix", "rrr-matrix", "mef-matrix", "interleaved-matrix", "plain-split", "rrr-split", "mef-split", "plain-concat", "mef-concat", "plain-subsetwt", "rrr-subsetwt"};
 }
 
 // Return the format, or throws if not all files have the same format
@@ -41,10 +41,13 @@ int build_main(int argc, char** argv){
         ("i,in-file", "The input sequences as a FASTA or FASTQ file, possibly gzipped. If the file extension is .txt, the file is interpreted as a list of input files, one file on each line. All input files must be in the same format.", cxxopts::value<string>())
         ("o,out-file", "Output file for the constructed index.", cxxopts::value<string>())
         ("k,kmer-length", "The k-mer length.", cxxopts::value<int64_t>())
-        ("p,precalc-length", "Precalculate SBWT intervals of strings of this length. Speeds up query, but takes 4^(p+2) bytes of memory.", cxxopts::value<int64_t>()->default_value("8"))
+        ("p,precalc-length", "Precalculate SBWT intervals of strings of this length. Speeds up query. The table is compressed, but still has 4^p entries, so each increment of p multiplies its size by about four.", cxxopts::value<int64_t>()->default_value("8"))
         ("variant", "The SBWT variant to build. Available variants:" + all_variants_string, cxxopts::value<string>()->default_value("plain-matrix"))
-        ("add-reverse-complements", "Also add the reverse complement of every k-mer to the index. Warning: this creates a temporary reverse-complemented duplicate of each input file before construction. Make sure that the directory at --temp-dir can handle this amount of data. If the input is gzipped, the duplicate will also be compressed, which might take a while.", cxxopts::value<bool>()->default_value("false"))
+        ("mappable", "Write the index in a page-aligned layout that search --mmap can memory-map. Only for the interleaved-matrix variant.", cxxopts::value<bool>()->default_value("false"))
+        ("add-reverse-complements", "Also add the reverse complement of every k-mer to the index. The k-mers are counted in canonical form and expanded to both orientations during construction, so the abundances and counts are those of the input together with its reverse complement.", cxxopts::value<bool>()->default_value("false"))
         ("no-streaming-support", "Save space by not building the streaming query support bit vector. This leads to slower queries.", cxxopts::value<bool>()->default_value("false"))
+        ("counts", "Also store the number of occurrences of each k-mer in the input, capped at --max-abundance. The counts are returned by search --with-counts. Takes about log2 of the largest count bits per k-mer.", cxxopts::value<bool>()->default_value("false"))
+        ("lcs", "Also build the longest common suffix array of the node labels, which is needed by the matching-statistics command. Takes about log2(k) bits per node.", cxxopts::value<bool>()->default_value("false"))
         ("t,n-threads", "Number of parallel threads.", cxxopts::value<int64_t>()->default_value("1"))
         ("a,min-abundance", "Discard all k-mers occurring fewer than this many times. By default we keep all k-mers. Note that we consider a k-mer distinct from its reverse complement.", cxxopts::value<int64_t>()->default_value("1"))
         ("b,max-abundance", "Discard all k-mers occurring more than this many times.", cxxopts::value<int64_t>()->default_value("1000000000"))
@@ -70,6 +73,12 @@ int build_main(int argc, char** argv){
         return 1;
     }
 
+    bool mappable = opts["mappable"].as<bool>();
+    if(mappable && variant != "interleaved-matrix"){
+        cerr << "Error: --mappable is only supported for the interleaved-matrix variant" << endl;
+        return 1;
+    }
+
     string out_file = opts["out-file"].as<string>();
     sbwt::check_writable(out_file);
 
@@ -85,6 +94,8 @@ int build_main(int argc, char** argv){
     bool streaming_support = !(opts["no-streaming-support"].as<bool>());
     bool revcomps = opts["add-reverse-complements"].as<bool>();
     bool verbose = opts["verbose"].as<bool>();
+    bool build_lcs = opts["lcs"].as<bool>();
+    bool store_counts = opts["counts"].as<bool>();
     int64_t n_threads = opts["n-threads"].as<int64_t>();
     int64_t ram_gigas = opts["ram-gigas"].as<int64_t>();
     int64_t k = opts["k"].as<int64_t>();
@@ -104,24 +115,7 @@ int build_main(int argc, char** argv){
         precalc_length = k;
     }
 
-    seq_io::FileFormat fileformat = check_that_all_files_have_the_same_format(input_files);
-    if(revcomps){
-        sbwt::write_log("Creating a reverse-complemented version of each input file to " + temp_dir, sbwt::LogLevel::MAJOR);
-        vector<string> new_files;
-        for(int64_t i = 0; i < input_files.size(); i++){
-            new_files.push_back(sbwt::get_temp_file_manager().create_filename("", fileformat.extension));
-        }
-        if(fileformat.gzipped){
-            seq_io::create_reverse_complement_files<
-                seq_io::Reader<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>>,
-                seq_io::Writer<seq_io::Buffered_ofstream<seq_io::zstr::ofstream>>>(input_files, new_files);
-        } else{
-            seq_io::create_reverse_complement_files<
-                seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>>,
-                seq_io::Writer<seq_io::Buffered_ofstream<std::ofstream>>>(input_files, new_files);
-        }
-        for(string f : new_files) input_files.push_back(f);
-    }
+    check_that_all_files_have_the_same_format(input_files);
 
     write_log("Building SBWT subset sequence using KMC", sbwt::LogLevel::MAJOR);
     sbwt::plain_matrix_sbwt_t::BuildConfig config;
@@ -134,6 +128,8 @@ int build_main(int argc, char** argv){
     config.ram_gigas = ram_gigas;
     config.temp_dir = temp_dir;
     config.precalc_k = 0; // No precalc yet at this point to avoid doing it twice
+    config.store_counts = store_counts;
+    config.add_reverse_complements = revcomps;
 
     sbwt::plain_matrix_sbwt_t matrixboss_plain(config);
 
@@ -153,44 +149,63 @@ int build_main(int argc, char** argv){
     const sdsl::bit_vector& ssupport = matrixboss_plain.get_streaming_support();
     int64_t n_kmers = matrixboss_plain.number_of_kmers();
 
+    if(build_lcs){
+        sbwt::write_log("Building the LCS array", sbwt::LogLevel::MAJOR);
+        matrixboss_plain.build_lcs();
+    }
+
     if (variant == "plain-matrix"){
         matrixboss_plain.do_kmer_prefix_precalc(precalc_length);
         bytes_written = matrixboss_plain.serialize(out.stream);
     }
     if (variant == "rrr-matrix"){
         sbwt::rrr_matrix_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "mef-matrix"){
         sbwt::mef_matrix_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
+    if (variant == "interleaved-matrix"){
+        sbwt::interleaved_matrix_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
+        bytes_written = mappable ? sbwt.serialize_mappable(out.stream) : sbwt.serialize(out.stream);
+    }
     if (variant == "plain-split"){
         sbwt::plain_split_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "rrr-split"){
         sbwt::rrr_split_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "mef-split"){
         sbwt::mef_split_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "plain-concat"){
         sbwt::plain_concat_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "mef-concat"){
         sbwt::mef_concat_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "plain-subsetwt"){
         sbwt::plain_sswt_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "rrr-subsetwt"){
         sbwt::rrr_sswt_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_length);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
 
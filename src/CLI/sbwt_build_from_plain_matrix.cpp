@@ -24,6 +24,8 @@ int build_from_plain_main(int argc, char** argv){
         ("i,in-file", "Index file of a plain matrix SBWT.", cxxopts::value<string>())
         ("o,out-file", "Output file for the constructed variant.", cxxopts::value<string>())
         ("variant", "The SBWT variant to build. Available variants:" + all_variants_string, cxxopts::value<string>()->default_value("plain-matrix"))
+        ("p,precalc-length", "Precalculate SBWT intervals of strings of this length in the new variant. By default, the same length as in the input is used. If this is given, the precalc table of the input is not read.", cxxopts::value<int64_t>()->default_value("-1"))
+        ("mappable", "Write the index in a page-aligned layout that search --mmap can memory-map. Only for the interleaved-matrix variant.", cxxopts::value<bool>()->default_value("false"))
         ("h,help", "Print usage")
     ;
 
@@ -42,6 +44,12 @@ int build_from_plain_main(int argc, char** argv){
         return 1;
     }
 
+    bool mappable = opts["mappable"].as<bool>();
+    if(mappable && variant != "interleaved-matrix"){
+        cerr << "Error: --mappable is only supported for the interleaved-matrix variant" << endl;
+        return 1;
+    }
+
     string out_file = opts["out-file"].as<string>();
     sbwt::check_writable(out_file);
 
@@ -57,7 +65,10 @@ int build_from_plain_main(int argc, char** argv){
 
     sbwt::plain_matrix_sbwt_t matrixboss_plain;
     write_log("Reading input.", sbwt::LogLevel::MAJOR);    
-    matrixboss_plain.load(in.stream);
+    int64_t precalc_length = opts["precalc-length"].as<int64_t>();
+    sbwt::SBWTLoadConfig load_config;
+    load_config.precalc = precalc_length < 0; // The precalc of the new variant is computed from scratch anyway
+    matrixboss_plain.load(in.stream, load_config);
 
     sbwt::write_log("Building variant " + variant, sbwt::LogLevel::MAJOR);
     
@@ -68,49 +79,69 @@ int build_from_plain_main(int argc, char** argv){
     const sdsl::bit_vector& ssupport = matrixboss_plain.get_streaming_support();
     int64_t n_kmers = matrixboss_plain.number_of_kmers();
     int64_t k = matrixboss_plain.get_k();
-    int64_t precalc_k = matrixboss_plain.get_precalc_k();
+    int64_t precalc_k = precalc_length < 0 ? matrixboss_plain.get_precalc_k() : min(precalc_length, k);
+    // The LCS array and the counts are carried over to the variant if the input has them
+    if(!matrixboss_plain.has_dummy_marks()){
+        sbwt::write_log("Computing the dummy node marks", sbwt::LogLevel::MAJOR); // The input is from an older version
+        matrixboss_plain.build_dummy_marks();
+    }
 
     int64_t bytes_written = 0;
     sbwt::throwing_ofstream out(out_file, ios::binary);
 
     sbwt::serialize_string(variant, out.stream);
     if (variant == "plain-matrix"){
+        if(precalc_length >= 0) matrixboss_plain.do_kmer_prefix_precalc(precalc_k);
         bytes_written = matrixboss_plain.serialize(out.stream);
     }
     if (variant == "rrr-matrix"){
         sbwt::rrr_matrix_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "mef-matrix"){
         sbwt::mef_matrix_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
+    if (variant == "interleaved-matrix"){
+        sbwt::interleaved_matrix_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
+        bytes_written = mappable ? sbwt.serialize_mappable(out.stream) : sbwt.serialize(out.stream);
+    }
     if (variant == "plain-split"){
         sbwt::plain_split_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "rrr-split"){
         sbwt::rrr_split_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "mef-split"){
         sbwt::mef_split_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "plain-concat"){
         sbwt::plain_concat_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "mef-concat"){
         sbwt::mef_concat_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "plain-subsetwt"){
         sbwt::plain_sswt_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
     if (variant == "rrr-subsetwt"){
         sbwt::rrr_sswt_sbwt_t sbwt(A_bits, C_bits, G_bits, T_bits, ssupport, k, n_kmers, precalc_k);
+        sbwt::copy_optional_components(sbwt, matrixboss_plain);
         bytes_written = sbwt.serialize(out.stream);
     }
 
@@ -0,0 +1,140 @@
+#include "globals.hh"
+#include "throwing_streams.hh"
+#include "cxxopts.hpp"
+#include "SBWT.hh"
+#include "SeqIO/SeqIO.hh"
+#include "variants.hh"
+#include "commands.hh"
+
+using namespace std;
+using namespace sbwt;
+
+struct DumpOptions{
+    bool skip_dummies = false;
+    bool packed = false;
+    int64_t chunk_size = 0;
+    int64_t n_threads = 1;
+};
+
+// Writes the header of the packed format: k and the number of k-mers as little-endian int64
+static void write_packed_header(seq_io::Buffered_ofstream<>& out, int64_t k, int64_t n_kmers){
+    for(int64_t x : {k, n_kmers}){
+        char bytes[8];
+        for(int64_t i = 0; i < 8; i++) bytes[i] = ((uint64_t)x >> (8*i)) & 0xFF;
+        out.write(bytes, 8);
+    }
+}
+
+template<typename sbwt_t>
+int64_t dump_kmers(const sbwt_t& sbwt, seq_io::Buffered_ofstream<>& out, const DumpOptions& opts){
+    int64_t k = sbwt.get_k();
+    int64_t bytes_per_kmer = opts.packed ? (k + 3) / 4 : k + 1;
+    if(opts.packed) write_packed_header(out, k, sbwt.number_of_kmers());
+
+    int64_t n_written = 0;
+    vector<char> out_buf;
+    sbwt.reconstruct_kmers_in_chunks(opts.chunk_size, opts.n_threads, [&](int64_t first, int64_t n, const char* kmers){
+        (void) first; // Unused parameter
+        out_buf.resize(n * bytes_per_kmer);
+        char* dest = out_buf.data();
+        for(int64_t i = 0; i < n; i++){
+            const char* kmer = kmers + i*k;
+            if(opts.skip_dummies && kmer[0] == '$') continue; // Dummies are padded with '$' from the left
+            if(opts.packed){
+                // Character j goes to bits 2(j%4) and 2(j%4)+1 of byte j/4, with A=0, C=1, G=2, T=3
+                memset(dest, 0, bytes_per_kmer);
+                for(int64_t j = 0; j < k; j++) dest[j/4] |= DNA_to_char_idx(kmer[j]) << (2*(j%4));
+            } else{
+                memcpy(dest, kmer, k);
+                dest[k] = '\n';
+            }
+            dest += bytes_per_kmer;
+            n_written++;
+        }
+        out.write(out_buf.data(), dest - out_buf.data());
+    });
+    return n_written;
+}
+
+template<typename sbwt_t>
+int64_t load_and_dump_kmers(istream& in, seq_io::Buffered_ofstream<>& out, const DumpOptions& opts){
+    // Only the sets and the metadata are needed, so the optional components are not read
+    SBWTLoadConfig load_config;
+    load_config.streaming_support = false;
+    load_config.precalc = false;
+    load_config.lcs = false;
+    load_config.dummy_marks = false;
+    load_config.counts = false;
+
+    sbwt_t sbwt;
+    sbwt.load(in, load_config);
+    return dump_kmers(sbwt, out, opts);
+}
+
+int dump_kmers_main(int argc, char** argv){
+
+    cxxopts::Options options(argv[0], "Write all k-mers of the index in colexicographic order. The k-mers are reconstructed in parallel in chunks, so the memory needed does not grow with the number of k-mers times k.");
+
+    options.add_options()
+        ("o,out-file", "Output filename.", cxxopts::value<string>())
+        ("i,index-file", "Index input file.", cxxopts::value<string>())
+        ("skip-dummies", "Do not write the dummy k-mers, that is, the nodes whose label is padded with '$' characters.", cxxopts::value<bool>()->default_value("false"))
+        ("packed", "Write the k-mers in 2 bits per character instead of one k-mer per line. The file starts with k and the number of k-mers as little-endian int64, followed by ceil(k/4) bytes per k-mer, where character j is in bits 2(j mod 4) and 2(j mod 4)+1 of byte floor(j/4) with A=0, C=1, G=2, T=3. Requires --skip-dummies.", cxxopts::value<bool>()->default_value("false"))
+        ("t,n-threads", "Number of threads.", cxxopts::value<int64_t>()->default_value("1"))
+        ("chunk-size", "Number of k-mers reconstructed by one thread at a time. The memory for the k-mers is about chunk-size * k bytes per thread.", cxxopts::value<int64_t>()->default_value("1000000"))
+        ("h,help", "Print usage")
+    ;
+
+    int64_t old_argc = argc; // Must store this because the parser modifies it
+    auto opts = options.parse(argc, argv);
+
+    if (old_argc == 1 || opts.count("help")){
+        std::cerr << options.help() << std::endl;
+        exit(1);
+    }
+
+    string indexfile = opts["index-file"].as<string>();
+    string outfile = opts["out-file"].as<string>();
+    check_readable(indexfile);
+    check_writable(outfile);
+
+    DumpOptions dump_opts;
+    dump_opts.skip_dummies = opts["skip-dummies"].as<bool>();
+    dump_opts.packed = opts["packed"].as<bool>();
+    dump_opts.n_threads = opts["n-threads"].as<int64_t>();
+    dump_opts.chunk_size = opts["chunk-size"].as<int64_t>();
+    if(dump_opts.packed && !dump_opts.skip_dummies) throw std::runtime_error("--packed requires --skip-dummies because the dummy characters '$' have no 2-bit code");
+    if(dump_opts.n_threads < 1) throw std::runtime_error("Number of threads must be at least 1");
+    if(dump_opts.chunk_size < 1) throw std::runtime_error("Chunk size must be at least 1");
+
+    vector<string> variants = get_available_variants();
+
+    throwing_ifstream in(indexfile, ios::binary);
+    string variant = load_string(in.stream); // read variant type
+    if(std::find(variants.begin(), variants.end(), variant) == variants.end()){
+        cerr << "Error loading index from file: unrecognized variant specified in the file" << endl;
+        return 1;
+    }
+    if(variant == "mef-matrix" || variant == "mef-split" || variant == "mef-concat"){
+        cerr << "Error: dump-kmers does not work for " << variant << " because mef does not implement access to the sets" << endl;
+        return 1;
+    }
+
+    write_log("Loading the index variant " + variant, LogLevel::MAJOR);
+    seq_io::Buffered_ofstream<> out(outfile);
+    int64_t micros_start = cur_time_micros();
+
+    int64_t n_written = 0;
+    if (variant == "plain-matrix") n_written = load_and_dump_kmers<plain_matrix_sbwt_t>(in.stream, out, dump_opts);
+    if (variant == "rrr-matrix") n_written = load_and_dump_kmers<rrr_matrix_sbwt_t>(in.stream, out, dump_opts);
+    if (variant == "interleaved-matrix") n_written = load_and_dump_kmers<interleaved_matrix_sbwt_t>(in.stream, out, dump_opts);
+    if (variant == "plain-split") n_written = load_and_dump_kmers<plain_split_sbwt_t>(in.stream, out, dump_opts);
+    if (variant == "rrr-split") n_written = load_and_dump_kmers<rrr_split_sbwt_t>(in.stream, out, dump_opts);
+    if (variant == "plain-concat") n_written = load_and_dump_kmers<plain_concat_sbwt_t>(in.stream, out, dump_opts);
+    if (variant == "plain-subsetwt") n_written = load_and_dump_kmers<plain_sswt_sbwt_t>(in.stream, out, dump_opts);
+    if (variant == "rrr-subsetwt") n_written = load_and_dump_kmers<rrr_sswt_sbwt_t>(in.stream, out, dump_opts);
+
+    write_log("Wrote " + to_string(n_written) + " k-mers in " + to_string((cur_time_micros() - micros_start) / 1000) + " ms", LogLevel::MAJOR);
+
+    return 0;
+}
@@ -12,23 +12,30 @@
 #include "commands.hh"
 #include <filesystem>
 #include <cstdio>
+#include <thread>
+#include <algorithm>
+#include <iterator>
 
 using namespace std;
 
 using namespace sbwt;
 
-// Assumes values of v are -1 or larger
+// Prints the n values starting at v on one line. Assumes the values are -1 or larger.
 template <typename writer_t>
-inline void print_vector(const vector<int64_t>& v, writer_t& out){
+inline void print_vector(const int64_t* v, int64_t n, writer_t& out){
     // Fast manual integer-to-string conversion
     char buffer[32];
     char newline = '\n';
-    for(int64_t x : v){
+    for(int64_t j = 0; j < n; j++){
+        int64_t x = v[j];
         int64_t i = 0;
         if(x == -1){
             buffer[0] = '1';
             buffer[1] = '-';
             i = 2;
+        } else if(x == 0){
+            buffer[0] = '0';
+            i = 1;
         } else{
             while(x > 0){
                 buffer[i++] = '0' + (x % 10);
@@ -42,71 +49,388 @@ inline void print_vector(const vector<int64_t>& v, writer_t& out){
     out.write(&newline, 1);
 }
 
-template<typename sbwt_t, typename reader_t, typename writer_t>
-int64_t run_queries_streaming(reader_t& reader, writer_t& writer, const sbwt_t& sbwt){
+// Output formats for the ranks of the k-mers of each read. The binary formats write a record per
+// read, with all integers in little-endian byte order:
+//   BINARY: int64 n, followed by the n ranks as int64.
+//   VARINT: varint n, followed by the differences of consecutive ranks (the first one from 0) as zigzag varints.
+//   BITMAP: int64 n, followed by ceil(n/8) bytes. Bit j % 8 of byte j / 8 is 1 iff k-mer j was found.
+//   SPARSE: int64 n, int64 h, followed by h pairs (int64 position, int64 rank) of the k-mers that were found.
+enum class OutputFormat {TEXT, BINARY, VARINT, BITMAP, SPARSE};
+
+OutputFormat parse_output_format(const string& name){
+    if(name == "text") return OutputFormat::TEXT;
+    if(name == "binary") return OutputFormat::BINARY;
+    if(name == "varint") return OutputFormat::VARINT;
+    if(name == "bitmap") return OutputFormat::BITMAP;
+    if(name == "sparse") return OutputFormat::SPARSE;
+    throw std::runtime_error("Unknown output format: " + name);
+}
+
+struct SearchOptions{
+    bool gzip_output = false;
+    int64_t n_threads = 1;
+    bool both_strands = false;
+    OutputFormat output_format = OutputFormat::TEXT;
+    bool summary = false; // Write per-read hit counts instead of ranks
+    double summary_threshold = -1; // Fraction of k-mers that must be found for a read to pass, or negative if not given
+    bool matching_statistics = false; // Write the matching statistics of each read instead of the ranks of its k-mers
+    bool with_counts = false; // Write the abundances of the k-mers that were found instead of their ranks
+};
+
+// Replaces the ranks at v[0..n) with the abundances of the k-mers. Ranks of -1 stay -1.
+template<typename sbwt_t>
+void ranks_to_counts(const sbwt_t& sbwt, int64_t* v, int64_t n){
+    for(int64_t i = 0; i < n; i++) if(v[i] != -1) v[i] = sbwt.get_count(v[i]);
+}
+
+// Counts the hits of one read in summary mode. If a threshold is given, decides as early as
+// possible whether the read passes: as soon as the number of hits reaches the threshold, or
+// the remaining k-mers are not enough to reach it.
+class ReadSummary{
+
+    int64_t n_kmers;
+    int64_t required_hits; // -1 if there is no threshold
+    int64_t hits = 0;
+    int64_t processed = 0;
+
+public:
+
+    ReadSummary(int64_t n_kmers, double threshold) : n_kmers(n_kmers), required_hits(-1){
+        if(threshold >= 0) // At least one hit is required for a positive threshold, even if the read has no k-mers
+            required_hits = max((int64_t)ceil(threshold * n_kmers - 1e-9), (int64_t)(threshold > 0));
+    }
+
+    // Adds the rank of the next k-mer. Returns false if the result is already decided.
+    bool add(int64_t rank){
+        hits += (rank != -1);
+        processed++;
+        return !decided();
+    }
+
+    bool decided() const{
+        return required_hits != -1 && (hits >= required_hits || hits + (n_kmers - processed) < required_hits);
+    }
+
+    // Appends "hits n_kmers" without a threshold, or 1 or 0 depending on whether the read passes
+    void write(vector<int64_t>& out) const{
+        if(required_hits == -1){
+            out.push_back(hits);
+            out.push_back(n_kmers);
+        } else out.push_back(hits >= required_hits);
+    }
+
+};
+
+template <typename writer_t>
+inline void write_int64_le(int64_t x, writer_t& out){
+    char bytes[8];
+    for(int64_t i = 0; i < 8; i++) bytes[i] = ((uint64_t)x >> (8*i)) & 0xFF;
+    out.write(bytes, 8);
+}
+
+template <typename writer_t>
+inline void write_varint(uint64_t x, writer_t& out){
+    char bytes[10];
+    int64_t i = 0;
+    while(x >= 0x80){
+        bytes[i++] = (x & 0x7F) | 0x80;
+        x >>= 7;
+    }
+    bytes[i++] = x;
+    out.write(bytes, i);
+}
+
+// Writes the ranks of the n k-mers of one read starting at v in the given format
+template <typename writer_t>
+void write_read_results(const int64_t* v, int64_t n, OutputFormat format, writer_t& out){
+    switch(format){
+        case OutputFormat::TEXT:
+            print_vector(v, n, out);
+            break;
+        case OutputFormat::BINARY:
+            write_int64_le(n, out);
+            for(int64_t j = 0; j < n; j++) write_int64_le(v[j], out);
+            break;
+        case OutputFormat::VARINT: {
+            write_varint(n, out);
+            int64_t prev = 0;
+            for(int64_t j = 0; j < n; j++){
+                int64_t delta = v[j] - prev;
+                write_varint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63), out); // Zigzag encoding
+                prev = v[j];
+            }
+            break;
+        }
+        case OutputFormat::BITMAP: {
+            write_int64_le(n, out);
+            for(int64_t j = 0; j < n; j += 8){
+                char byte = 0;
+                for(int64_t b = 0; b < 8 && j + b < n; b++) if(v[j+b] != -1) byte |= 1 << b;
+                out.write(&byte, 1);
+            }
+            break;
+        }
+        case OutputFormat::SPARSE: {
+            write_int64_le(n, out);
+            write_int64_le(n - std::count(v, v + n, -1), out);
+            for(int64_t j = 0; j < n; j++){
+                if(v[j] == -1) continue;
+                write_int64_le(j, out);
+                write_int64_le(v[j], out);
+            }
+            break;
+        }
+    }
+}
+
+// Results of the reads processed by one thread in one batch. The results are
+// appended to the same buffers in every batch, so the buffers are only allocated
+// when they need to grow.
+struct ThreadResults{
+    vector<int64_t> values; // Concatenation of the results of all reads
+    vector<int64_t> ends; // The results of read i are at values[ends[i-1]..ends[i]), with ends[-1] = 0
+    int64_t n_queries = 0; // Number of k-mers searched
+};
+
+// Runs query(read, read_length, output_vector, thread_id) for every read in the reader using opts.n_threads threads,
+// and writes the results to the writer in opts.output_format in the same order as the reads are in the input. The query must append its
+// results to output_vector and return the number of k-mers it searched. The reads are read in batches of roughly batch_chars_per_thread * n_threads characters,
+// and each batch is split into n_threads ranges of consecutive reads of roughly equal total length.
+template<typename reader_t, typename writer_t, typename query_t>
+int64_t run_queries_in_batches(reader_t& reader, writer_t& writer, const SearchOptions& opts, const query_t& query){
+
+    const int64_t n_threads = opts.n_threads;
+    const int64_t batch_chars_per_thread = (int64_t)1 << 20;
 
     int64_t total_micros = 0;
     int64_t number_of_queries = 0;
-    while(true){
-        int64_t len = reader.get_next_read_to_buffer();
-        if(len == 0) break;
+    vector<char> seqs; // Concatenation of the reads in the current batch
+    vector<int64_t> starts; // Read i of the batch is at seqs[starts[i]..starts[i+1])
+    vector<ThreadResults> results(n_threads);
+    bool reads_left = true;
+    while(reads_left){
+        seqs.clear();
+        starts.assign(1, 0);
+        while((int64_t)seqs.size() < batch_chars_per_thread * n_threads){
+            int64_t len = reader.get_next_read_to_buffer();
+            if(len == 0){
+                reads_left = false;
+                break;
+            }
+            seqs.insert(seqs.end(), reader.read_buf, reader.read_buf + len);
+            starts.push_back(seqs.size());
+        }
+        int64_t n_reads = (int64_t)starts.size() - 1;
+        if(n_reads == 0) break;
+
+        auto process_range = [&](int64_t read_begin, int64_t read_end, int64_t thread_id){
+            ThreadResults& R = results[thread_id];
+            R.values.clear();
+            R.ends.clear();
+            R.n_queries = 0;
+            for(int64_t i = read_begin; i < read_end; i++){
+                R.n_queries += query(seqs.data() + starts[i], starts[i+1] - starts[i], R.values, thread_id);
+                R.ends.push_back(R.values.size());
+            }
+        };
 
         int64_t t0 = cur_time_micros();
-        vector<int64_t> out_buffer = sbwt.streaming_search(reader.read_buf, len);
+        if(n_threads == 1){
+            process_range(0, n_reads, 0);
+        } else{
+            vector<std::thread> threads;
+            int64_t read_begin = 0;
+            for(int64_t t = 0; t < n_threads; t++){
+                int64_t read_end = n_reads;
+                if(t != n_threads - 1){
+                    // First read that starts at or after the end of the character range of this thread
+                    int64_t char_end = (int64_t)seqs.size() * (t+1) / n_threads;
+                    read_end = std::lower_bound(starts.begin(), starts.begin() + n_reads, char_end) - starts.begin();
+                }
+                threads.emplace_back(process_range, read_begin, read_end, t);
+                read_begin = read_end;
+            }
+            for(std::thread& th : threads) th.join();
+        }
         total_micros += cur_time_micros() - t0;
 
-        number_of_queries += out_buffer.size();
-
-        // Write out
-        print_vector(out_buffer, writer);
+        // Write out in input order
+        for(const ThreadResults& R : results){
+            int64_t begin = 0;
+            for(int64_t end : R.ends){
+                write_read_results(R.values.data() + begin, end - begin, opts.output_format, writer);
+                begin = end;
+            }
+            number_of_queries += R.n_queries;
+        }
     }
     write_log("us/query: " + to_string((double)total_micros / number_of_queries) + " (excluding I/O etc)", LogLevel::MAJOR);
     return number_of_queries;
 }
 
 template<typename sbwt_t, typename reader_t, typename writer_t>
-int64_t run_queries_not_streaming(reader_t& reader, writer_t& writer, const sbwt_t& sbwt){
+int64_t run_queries_streaming(reader_t& reader, writer_t& writer, const sbwt_t& sbwt, const SearchOptions& opts){
+    vector<typename sbwt_t::QueryContext> contexts(opts.n_threads);
+    bool both_strands = opts.both_strands;
+
+    if(opts.summary){
+        int64_t k = sbwt.get_k();
+        double threshold = opts.summary_threshold;
+        vector<vector<int64_t>> ranks(opts.n_threads); // Per-thread buffer for the ranks of one read
+        return run_queries_in_batches(reader, writer, opts, 
+            [&sbwt, &contexts, &ranks, both_strands, k, threshold](const char* read, int64_t len, vector<int64_t>& out, int64_t thread_id){
+                ReadSummary summary(max(len - k + 1, (int64_t)0), threshold);
+                int64_t n_searched = 0;
+                if(both_strands){
+                    // The two strands are scanned in opposite directions, so this can not stop early
+                    ranks[thread_id].clear();
+                    n_searched = sbwt.streaming_search_both_strands(read, len, std::back_inserter(ranks[thread_id]), contexts[thread_id]);
+                    for(int64_t r : ranks[thread_id]) if(!summary.add(r)) break;
+                } else{
+                    n_searched = sbwt.streaming_search_with_callback(read, len, [&summary](int64_t i, int64_t rank){return summary.add(rank);}, contexts[thread_id]);
+                }
+                summary.write(out);
+                return n_searched;
+            }
+        );
+    }
 
-    int64_t total_micros = 0;
-    int64_t number_of_queries = 0;
-    int64_t k = sbwt.get_k();
-    vector<int64_t> out_buffer;
-    while(true){
-        int64_t len = reader.get_next_read_to_buffer();
-        if(len == 0) break;
-
-        for(int64_t i = 0; i < len - k + 1; i++){
-            int64_t t0 = cur_time_micros();
-            int64_t ans = sbwt.search(reader.read_buf + i);
-            total_micros += cur_time_micros() - t0;
-            number_of_queries++;
-            out_buffer.push_back(ans);
+    bool with_counts = opts.with_counts;
+    return run_queries_in_batches(reader, writer, opts, 
+        [&sbwt, &contexts, both_strands, with_counts](const char* read, int64_t len, vector<int64_t>& out, int64_t thread_id){
+            int64_t out_start = out.size();
+            int64_t n_searched = 0;
+            if(both_strands) n_searched = sbwt.streaming_search_both_strands(read, len, std::back_inserter(out), contexts[thread_id]);
+            else n_searched = sbwt.streaming_search(read, len, std::back_inserter(out), contexts[thread_id]);
+            if(with_counts) ranks_to_counts(sbwt, out.data() + out_start, out.size() - out_start);
+            return n_searched;
         }
+    );
+}
 
-        print_vector(out_buffer, writer);
-        out_buffer.clear();
+// Per-thread scratch space for non-streaming queries
+struct NonStreamingQueryContext{
+    vector<const char*> kmers; // Pointers to the k-mers to search
+    vector<int64_t> misses; // Indices of k-mers that were not found
+    vector<int64_t> rc_ranks; // Ranks of the reverse complements of the misses
+    string rc_read; // Reverse complement of the read
+    vector<int64_t> ranks; // Ranks of the k-mers of the read in summary mode
+};
+
+// Searches all k-mers of the read without streaming support and writes their ranks to ranks[0..n_kmers).
+// Returns the number of k-mers.
+template<typename sbwt_t>
+int64_t search_read_not_streaming(const sbwt_t& sbwt, const char* read, int64_t len, int64_t* ranks, NonStreamingQueryContext& ctx, bool both_strands){
+    int64_t n_kmers = max(len - sbwt.get_k() + 1, (int64_t)0);
+    ctx.kmers.resize(n_kmers);
+    for(int64_t i = 0; i < n_kmers; i++) ctx.kmers[i] = read + i;
+    sbwt.search_batch(ctx.kmers.data(), n_kmers, ranks);
+
+    if(both_strands){
+        // Search the reverse complements of the k-mers that were not found. The reverse complement
+        // of the k-mer starting at i is the k-mer starting at n_kmers-1-i in the reverse complement of the read.
+        ctx.rc_read.resize(len);
+        for(int64_t i = 0; i < len; i++) ctx.rc_read[i] = get_rc(read[len-1-i]);
+        ctx.misses.clear();
+        for(int64_t i = 0; i < n_kmers; i++){
+            if(ranks[i] == -1){
+                ctx.kmers[ctx.misses.size()] = ctx.rc_read.c_str() + (n_kmers-1-i);
+                ctx.misses.push_back(i);
+            }
+        }
+        ctx.rc_ranks.resize(ctx.misses.size());
+        sbwt.search_batch(ctx.kmers.data(), ctx.misses.size(), ctx.rc_ranks.data());
+        for(int64_t j = 0; j < (int64_t)ctx.misses.size(); j++) ranks[ctx.misses[j]] = ctx.rc_ranks[j];
     }
-    write_log("us/query: " + to_string((double)total_micros / number_of_queries) + " (excluding I/O etc)", LogLevel::MAJOR);
-    return number_of_queries;
+    return n_kmers;
+}
+
+template<typename sbwt_t, typename reader_t, typename writer_t>
+int64_t run_queries_not_streaming(reader_t& reader, writer_t& writer, const sbwt_t& sbwt, const SearchOptions& opts){
+    int64_t k = sbwt.get_k();
+    vector<NonStreamingQueryContext> contexts(opts.n_threads);
+    bool both_strands = opts.both_strands;
+
+    if(opts.summary){
+        double threshold = opts.summary_threshold;
+        return run_queries_in_batches(reader, writer, opts, 
+            [&sbwt, &contexts, k, both_strands, threshold](const char* read, int64_t len, vector<int64_t>& out, int64_t thread_id){
+                NonStreamingQueryContext& ctx = contexts[thread_id];
+                int64_t n_kmers = max(len - k + 1, (int64_t)0);
+                ReadSummary summary(n_kmers, threshold);
+                int64_t n_searched = 0;
+                if(both_strands){
+                    ctx.ranks.resize(n_kmers);
+                    n_searched = search_read_not_streaming(sbwt, read, len, ctx.ranks.data(), ctx, true);
+                    for(int64_t r : ctx.ranks) if(!summary.add(r)) break;
+                } else{
+                    // Search in chunks so that the batched search still hides memory latency, and stop
+                    // after the first chunk that decides the result
+                    const int64_t chunk_size = 16;
+                    ctx.kmers.resize(chunk_size);
+                    ctx.ranks.resize(chunk_size);
+                    for(int64_t begin = 0; begin < n_kmers && !summary.decided(); begin += chunk_size){
+                        int64_t m = min(chunk_size, n_kmers - begin);
+                        for(int64_t j = 0; j < m; j++) ctx.kmers[j] = read + begin + j;
+                        sbwt.search_batch(ctx.kmers.data(), m, ctx.ranks.data());
+                        n_searched += m;
+                        for(int64_t j = 0; j < m; j++) if(!summary.add(ctx.ranks[j])) break;
+                    }
+                }
+                summary.write(out);
+                return n_searched;
+            }
+        );
+    }
+
+    bool with_counts = opts.with_counts;
+    return run_queries_in_batches(reader, writer, opts, 
+        [&sbwt, &contexts, k, both_strands, with_counts](const char* read, int64_t len, vector<int64_t>& out, int64_t thread_id){
+            int64_t n_kmers = max(len - k + 1, (int64_t)0);
+            int64_t out_start = out.size();
+            out.resize(out_start + n_kmers);
+            int64_t n_searched = search_read_not_streaming(sbwt, read, len, out.data() + out_start, contexts[thread_id], both_strands);
+            if(with_counts) ranks_to_counts(sbwt, out.data() + out_start, n_kmers);
+            return n_searched;
+        }
+    );
 }
 
 template<typename sbwt_t, typename reader_t, typename writer_t>
-int64_t run_file(const string& infile, const string& outfile, const sbwt_t& sbwt){
+int64_t run_queries_matching_statistics(reader_t& reader, writer_t& writer, const sbwt_t& sbwt, const SearchOptions& opts){
+    return run_queries_in_batches(reader, writer, opts, 
+        [&sbwt](const char* read, int64_t len, vector<int64_t>& out, int64_t thread_id){
+            return sbwt.matching_statistics(read, len, std::back_inserter(out));
+        }
+    );
+}
+
+template<typename sbwt_t, typename reader_t, typename writer_t>
+int64_t run_file(const string& infile, const string& outfile, const sbwt_t& sbwt, const SearchOptions& opts){
     reader_t reader(infile);
     writer_t writer(outfile);
-    if(sbwt.has_streaming_query_support()){
+    if(opts.matching_statistics){
+        write_log("Computing matching statistics from input file " + infile + " to output file " + outfile , LogLevel::MAJOR);
+        return run_queries_matching_statistics<sbwt_t, reader_t, writer_t>(reader, writer, sbwt, opts);
+    }
+    else if(sbwt.has_streaming_query_support()){
         write_log("Running streaming queries from input file " + infile + " to output file " + outfile , LogLevel::MAJOR);
-        return run_queries_streaming<sbwt_t, reader_t, writer_t>(reader, writer, sbwt);
+        return run_queries_streaming<sbwt_t, reader_t, writer_t>(reader, writer, sbwt, opts);
     }
     else{
         write_log("Running non-streaming queries from input file " + infile + " to output file " + outfile , LogLevel::MAJOR);
-        return run_queries_not_streaming<sbwt_t, reader_t, writer_t>(reader, writer, sbwt);
+        return run_queries_not_streaming<sbwt_t, reader_t, writer_t>(reader, writer, sbwt, opts);
     }
 }
 
 // Returns number of queries executed
 template<typename sbwt_t>
-int64_t run_queries(const vector<string>& infiles, const vector<string>& outfiles, const sbwt_t& sbwt, bool gzip_output){
+int64_t run_queries(const vector<string>& infiles, const vector<string>& outfiles, const sbwt_t& sbwt, const SearchOptions& opts){
+
+    if(opts.matching_statistics && !sbwt.has_lcs())
+        throw std::runtime_error("The index does not have the LCS array needed for matching statistics. Rebuild it with --lcs.");
+    if(opts.with_counts && !(sbwt.has_counts() && sbwt.has_dummy_marks()))
+        throw std::runtime_error("The index does not have the k-mer counts. Rebuild it with --counts.");
 
     if(infiles.size() != outfiles.size()){
         string count1 = to_string(infiles.size());
@@ -120,55 +444,30 @@ int64_t run_queries(const vector<string>& infiles, const vector<string>& outfile
     typedef seq_io::Buffered_ofstream<seq_io::zstr::ofstream> out_gzip;
     typedef seq_io::Buffered_ofstream<std::ofstream> out_no_gzip;
 
+    bool gzip_output = opts.gzip_output;
     int64_t n_queries_run = 0;
     for(int64_t i = 0; i < infiles.size(); i++){
         bool gzip_input = seq_io::figure_out_file_format(infiles[i]).gzipped;
         if(gzip_input && gzip_output){
-            n_queries_run += run_file<sbwt_t, in_gzip, out_gzip>(infiles[i], outfiles[i], sbwt);
+            n_queries_run += run_file<sbwt_t, in_gzip, out_gzip>(infiles[i], outfiles[i], sbwt, opts);
         }
         if(gzip_input && !gzip_output){
-            n_queries_run += run_file<sbwt_t, in_gzip, out_no_gzip>(infiles[i], outfiles[i], sbwt);
+            n_queries_run += run_file<sbwt_t, in_gzip, out_no_gzip>(infiles[i], outfiles[i], sbwt, opts);
         }
         if(!gzip_input && gzip_output){
-            n_queries_run += run_file<sbwt_t, in_no_gzip, out_gzip>(infiles[i], outfiles[i], sbwt);
+            n_queries_run += run_file<sbwt_t, in_no_gzip, out_gzip>(infiles[i], outfiles[i], sbwt, opts);
         }
         if(!gzip_input && !gzip_output){
-            n_queries_run += run_file<sbwt_t, in_no_gzip, out_no_gzip>(infiles[i], outfiles[i], sbwt);
+            n_queries_run += run_file<sbwt_t, in_no_gzip, out_no_gzip>(infiles[i], outfiles[i], sbwt, opts);
         }
     }
     return n_queries_run;
 
 }
 
-int search_main(int argc, char** argv){
-
-    int64_t micros_start = cur_time_micros();
-
-    set_log_level(LogLevel::MINOR);
-
-    cxxopts::Options options(argv[0], "Query all k-mers of all input reads.");
-
-    options.add_options()
-        ("o,out-file", "Output filename.", cxxopts::value<string>())
-        ("i,index-file", "Index input file.", cxxopts::value<string>())
-        ("q,query-file", "The query in FASTA or FASTQ format, possibly gzipped. Multi-line FASTQ is not supported. If the file extension is .txt, this is interpreted as a list of query files, one per line. In this case, --out-file is also interpreted as a list of output files in the same manner, one line for each input file.", cxxopts::value<string>())
-        ("z,gzip-output", "Writes output in gzipped form. This can shrink the output files by an order of magnitude.", cxxopts::value<bool>()->default_value("false"))
-        ("h,help", "Print usage")
-    ;
-
-    int64_t old_argc = argc; // Must store this because the parser modifies it
-    auto opts = options.parse(argc, argv);
-
-    if (old_argc == 1 || opts.count("help")){
-        std::cerr << options.help() << std::endl;
-        exit(1);
-    }
-
-    string indexfile = opts["index-file"].as<string>();
-    check_readable(indexfile);
-
-    // Interpret input file
-    string queryfile = opts["query-file"].as<string>();
+// Interprets the query and output file arguments. If the query file has the extension .txt, it is a list
+// of query files, one per line, and the output file is then a list of output files in the same manner.
+pair<vector<string>, vector<string>> get_query_and_output_files(const string& queryfile, const string& outfile){
     vector<string> input_files;
     bool multi_file = queryfile.size() >= 4 && queryfile.substr(queryfile.size() - 4) == ".txt";
     if(multi_file){
@@ -178,9 +477,6 @@ int search_main(int argc, char** argv){
     }
     for(string file : input_files) check_readable(file);
 
-    // Interpret output file
-    string outfile = opts["out-file"].as<string>();
-    bool gzip_output = opts["gzip-output"].as<bool>();
     vector<string> output_files;
     if(multi_file){
         output_files = readlines(outfile);
@@ -189,72 +485,206 @@ int search_main(int argc, char** argv){
     }
     for(string file : output_files) check_writable(file);
 
+    return {input_files, output_files};
+}
+
+// Loads the index and runs the queries. Returns the number of queries executed. If use_mmap is true,
+// the index is memory-mapped instead of read, which requires an index written with --mappable.
+int64_t run_queries_on_index_file(const string& indexfile, const vector<string>& input_files, const vector<string>& output_files, const SearchOptions& search_opts, bool use_mmap){
     vector<string> variants = get_available_variants();
 
     throwing_ifstream in(indexfile, ios::binary);
     string variant = load_string(in.stream); // read variant type
     if(std::find(variants.begin(), variants.end(), variant) == variants.end()){
-        cerr << "Error loading index from file: unrecognized variant specified in the file" << endl;
-        return 1;
+        throw std::runtime_error("Error loading index from file: unrecognized variant specified in the file");
     }
 
+    if(use_mmap && variant != "interleaved-matrix")
+        throw std::runtime_error("Memory-mapped loading is only supported for the interleaved-matrix variant");
+
     write_log("Loading the index variant " + variant, LogLevel::MAJOR);
     int64_t number_of_queries = 0;
 
+    // Matching statistics need only the rank data and the LCS array, and k-mer search does not need the LCS array
+    SBWTLoadConfig load_config;
+    load_config.streaming_support = !search_opts.matching_statistics;
+    load_config.precalc = !search_opts.matching_statistics;
+    load_config.lcs = search_opts.matching_statistics;
+    load_config.dummy_marks = search_opts.with_counts; // Only needed for k-mer ids
+    load_config.counts = search_opts.with_counts;
+    load_config.n_threads = search_opts.n_threads;
+    int64_t index_offset = in.stream.tellg(); // The index starts after the variant name
+
     if (variant == "plain-matrix"){
         plain_matrix_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "rrr-matrix"){
         rrr_matrix_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "mef-matrix"){
         mef_matrix_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
+    }
+    if (variant == "interleaved-matrix"){
+        interleaved_matrix_sbwt_t sbwt;
+        if(use_mmap) sbwt.load_mmap(indexfile, index_offset);
+        else sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "plain-split"){
         plain_split_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "rrr-split"){
         rrr_split_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "mef-split"){
         mef_split_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "plain-concat"){
         plain_concat_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "mef-concat"){
         mef_concat_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "plain-subsetwt"){
         plain_sswt_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
     if (variant == "rrr-subsetwt"){
         rrr_sswt_sbwt_t sbwt;
-        sbwt.load(in.stream);
-        number_of_queries += run_queries(input_files, output_files, sbwt, gzip_output);
+        sbwt.load(indexfile, load_config, index_offset);
+        number_of_queries += run_queries(input_files, output_files, sbwt, search_opts);
     }
 
+    return number_of_queries;
+}
+
+int search_main(int argc, char** argv){
+
+    int64_t micros_start = cur_time_micros();
+
+    set_log_level(LogLevel::MINOR);
+
+    cxxopts::Options options(argv[0], "Query all k-mers of all input reads.");
+
+    options.add_options()
+        ("o,out-file", "Output filename.", cxxopts::value<string>())
+        ("i,index-file", "Index input file.", cxxopts::value<string>())
+        ("q,query-file", "The query in FASTA or FASTQ format, possibly gzipped. Multi-line FASTQ is not supported. If the file extension is .txt, this is interpreted as a list of query files, one per line. In this case, --out-file is also interpreted as a list of output files in the same manner, one line for each input file.", cxxopts::value<string>())
+        ("z,gzip-output", "Writes output in gzipped form. This can shrink the output files by an order of magnitude.", cxxopts::value<bool>()->default_value("false"))
+        ("r,both-strands", "For each k-mer, report the rank of the k-mer if it is found, otherwise the rank of its reverse complement if that is found, otherwise -1. Use this to get strand-agnostic results from an index that was built without --add-reverse-complements.", cxxopts::value<bool>()->default_value("false"))
+        ("t,n-threads", "Number of parallel threads. The output is written in the same order as the input regardless of the number of threads.", cxxopts::value<int64_t>()->default_value("1"))
+        ("s,summary", "Instead of the ranks, write for each read the number of k-mers found and the number of k-mers in the read. With --summary-threshold, write 1 if the read passes the threshold and 0 otherwise.", cxxopts::value<bool>()->default_value("false"))
+        ("summary-threshold", "Fraction of the k-mers of a read that must be found for the read to pass in --summary mode. The scan of a read stops as soon as the result is decided.", cxxopts::value<double>())
+        ("output-format", "Format of the output. text: one line of space-separated ranks per read. binary: for each read, the number of k-mers n and the n ranks as little-endian int64. varint: for each read, n and the differences of consecutive ranks as zigzag varints. bitmap: for each read, n as int64 and a bitmap of ceil(n/8) bytes marking the k-mers that were found. sparse: for each read, n and the number of found k-mers h as int64, followed by h pairs (position, rank) as int64.", cxxopts::value<string>()->default_value("text"))
+        ("mmap", "Memory-map the index instead of reading it into memory. Loading is then almost instant, and processes that map the same index share its memory. Requires an interleaved-matrix index built with --mappable.", cxxopts::value<bool>()->default_value("false"))
+        ("with-counts", "Instead of the rank of each k-mer, report the number of times it occurred in the input of the index, or -1 if it is not found. Requires an index built with --counts.", cxxopts::value<bool>()->default_value("false"))
+        ("h,help", "Print usage")
+    ;
+
+    int64_t old_argc = argc; // Must store this because the parser modifies it
+    auto opts = options.parse(argc, argv);
+
+    if (old_argc == 1 || opts.count("help")){
+        std::cerr << options.help() << std::endl;
+        exit(1);
+    }
+
+    string indexfile = opts["index-file"].as<string>();
+    check_readable(indexfile);
+
+    vector<string> input_files, output_files;
+    std::tie(input_files, output_files) = get_query_and_output_files(opts["query-file"].as<string>(), opts["out-file"].as<string>());
+
+    SearchOptions search_opts;
+    search_opts.with_counts = opts["with-counts"].as<bool>();
+    search_opts.gzip_output = opts["gzip-output"].as<bool>();
+    search_opts.both_strands = opts["both-strands"].as<bool>();
+    search_opts.n_threads = opts["n-threads"].as<int64_t>();
+    search_opts.output_format = parse_output_format(opts["output-format"].as<string>());
+    search_opts.summary = opts["summary"].as<bool>();
+    if(opts.count("summary-threshold")){
+        if(!search_opts.summary) throw std::runtime_error("--summary-threshold requires --summary");
+        search_opts.summary_threshold = opts["summary-threshold"].as<double>();
+        if(search_opts.summary_threshold < 0 || search_opts.summary_threshold > 1) throw std::runtime_error("--summary-threshold must be between 0 and 1");
+    }
+    if(search_opts.summary && search_opts.output_format != OutputFormat::TEXT && search_opts.output_format != OutputFormat::BINARY)
+        throw std::runtime_error("--summary supports only the text and binary output formats");
+    if(search_opts.with_counts && search_opts.summary) throw std::runtime_error("--with-counts can not be combined with --summary");
+    if(search_opts.n_threads < 1) throw std::runtime_error("Number of threads must be at least 1");
+
+    int64_t number_of_queries = run_queries_on_index_file(indexfile, input_files, output_files, search_opts, opts["mmap"].as<bool>());
+
     int64_t total_micros = cur_time_micros() - micros_start;
     write_log("us/query end-to-end: " + to_string((double)total_micros / number_of_queries), LogLevel::MAJOR);
 
     return 0;
 
 }
+
+int matching_statistics_main(int argc, char** argv){
+
+    int64_t micros_start = cur_time_micros();
+
+    set_log_level(LogLevel::MINOR);
+
+    cxxopts::Options options(argv[0], "Compute the matching statistics of all input reads: for each position i of a read, the length of the longest suffix of the read up to i that occurs in some k-mer of the index, capped at k. Requires an index built with --lcs.");
+
+    options.add_options()
+        ("o,out-file", "Output filename.", cxxopts::value<string>())
+        ("i,index-file", "Index input file. Must have been built with --lcs.", cxxopts::value<string>())
+        ("q,query-file", "The query in FASTA or FASTQ format, possibly gzipped. Multi-line FASTQ is not supported. If the file extension is .txt, this is interpreted as a list of query files, one per line. In this case, --out-file is also interpreted as a list of output files in the same manner, one line for each input file.", cxxopts::value<string>())
+        ("z,gzip-output", "Writes output in gzipped form.", cxxopts::value<bool>()->default_value("false"))
+        ("t,n-threads", "Number of parallel threads. The output is written in the same order as the input regardless of the number of threads.", cxxopts::value<int64_t>()->default_value("1"))
+        ("output-format", "Format of the output. text: one line of space-separated values per read. binary: for each read, its length n and the n values as little-endian int64. varint: for each read, n and the differences of consecutive values as zigzag varints.", cxxopts::value<string>()->default_value("text"))
+        ("mmap", "Memory-map the index instead of reading it into memory. Loading is then almost instant, and processes that map the same index share its memory. Requires an interleaved-matrix index built with --mappable.", cxxopts::value<bool>()->default_value("false"))
+        ("h,help", "Print usage")
+    ;
+
+    int64_t old_argc = argc; // Must store this because the parser modifies it
+    auto opts = options.parse(argc, argv);
+
+    if (old_argc == 1 || opts.count("help")){
+        std::cerr << options.help() << std::endl;
+        exit(1);
+    }
+
+    string indexfile = opts["index-file"].as<string>();
+    check_readable(indexfile);
+
+    vector<string> input_files, output_files;
+    std::tie(input_files, output_files) = get_query_and_output_files(opts["query-file"].as<string>(), opts["out-file"].as<string>());
+
+    SearchOptions search_opts;
+    search_opts.matching_statistics = true;
+    search_opts.gzip_output = opts["gzip-output"].as<bool>();
+    search_opts.n_threads = opts["n-threads"].as<int64_t>();
+    search_opts.output_format = parse_output_format(opts["output-format"].as<string>());
+    if(search_opts.output_format != OutputFormat::TEXT && search_opts.output_format != OutputFormat::BINARY && search_opts.output_format != OutputFormat::VARINT)
+        throw std::runtime_error("Matching statistics support only the text, binary and varint output formats");
+    if(search_opts.n_threads < 1) throw std::runtime_error("Number of threads must be at least 1");
+
+    int64_t number_of_queries = run_queries_on_index_file(indexfile, input_files, output_files, search_opts, opts["mmap"].as<bool>());
+
+    int64_t total_micros = cur_time_micros() - micros_start;
+    write_log("us/character end-to-end: " + to_string((double)total_micros / number_of_queries), LogLevel::MAJOR);
+
+    return 0;
+
+}
@@ -0,0 +1,546 @@
+#include <string>
+#include <cstring>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <set>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include "cxxopts.hpp"
+#include "globals.hh"
+#include "SBWT.hh"
+#include "SeqIO/SeqIO.hh"
+#include "SeqIO/buffered_streams.hh"
+#include "variants.hh"
+#include "commands.hh"
+
+/*
+
+A query server that keeps an index in memory and answers queries over a Unix domain socket,
+and a client for it. The protocol is binary, with all integers as little-endian int64.
+A connection carries any number of requests, each answered before the next one is read:
+
+  QUERY request:    type = 1, flags (bit 0: both strands, as in search -r), n_reads, and for each
+                    read its length followed by its characters. The lengths and the characters
+                    together may take at most --max-request-mb megabytes.
+  QUERY response:   status = 0, and for each read the number of k-mers n followed by the n ranks.
+  SHUTDOWN request: type = 2. The server answers status = 0, finishes the requests it is serving,
+                    closes all connections and exits. Requests still being received are cut off.
+  Error response:   status = 1, the length of a message and the message. The server closes the connection.
+
+The workers serve one request at a time, not one connection, so idle connections do not hold up
+the others. Connections waiting for their next request are polled by the main thread.
+
+*/
+
+using namespace std;
+using namespace sbwt;
+
+namespace serve_protocol{
+    const int64_t QUERY = 1;
+    const int64_t SHUTDOWN = 2;
+    const int64_t FLAG_BOTH_STRANDS = 1;
+    const int64_t STATUS_OK = 0;
+    const int64_t STATUS_ERROR = 1;
+}
+
+// Reads exactly n bytes. Returns false if the connection was closed before any byte was read,
+// and throws if it was closed in the middle.
+static bool read_fully(int fd, char* buf, int64_t n){
+    int64_t done = 0;
+    while(done < n){
+        ssize_t r = read(fd, buf + done, n - done);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0){
+            if(done == 0 && r == 0) return false;
+            throw std::runtime_error("Connection closed in the middle of a message");
+        }
+        done += r;
+    }
+    return true;
+}
+
+static void write_fully(int fd, const char* buf, int64_t n){
+    int64_t done = 0;
+    while(done < n){
+        ssize_t r = write(fd, buf + done, n - done);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) throw std::runtime_error("Error writing to socket");
+        done += r;
+    }
+}
+
+static int64_t read_int64(int fd){
+    int64_t x = 0;
+    if(!read_fully(fd, (char*)&x, sizeof(x))) throw std::runtime_error("Connection closed in the middle of a message");
+    return x;
+}
+
+// Buffers the response of one request so that it is sent with few system calls
+class ResponseWriter{
+    vector<char> buf;
+public:
+    void write_int64(int64_t x){
+        const char* p = (const char*)&x;
+        buf.insert(buf.end(), p, p + sizeof(x));
+    }
+    void write_int64s(const int64_t* v, int64_t n){
+        buf.insert(buf.end(), (const char*)v, (const char*)(v + n));
+    }
+    void write_string(const string& s){
+        write_int64(s.size());
+        buf.insert(buf.end(), s.begin(), s.end());
+    }
+    void send(int fd){
+        write_fully(fd, buf.data(), buf.size());
+        buf.clear();
+    }
+};
+
+static sockaddr_un make_socket_address(const string& path){
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path is too long: " + path);
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+// Returns a socket connected to the server at the given path
+static int connect_to_server(const string& path){
+    sockaddr_un addr = make_socket_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1) throw std::runtime_error("Error creating socket");
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1){
+        close(fd);
+        throw std::runtime_error("Could not connect to a server at " + path);
+    }
+    return fd;
+}
+
+template<typename sbwt_t>
+class QueryServer{
+
+    const sbwt_t& sbwt;
+    string socket_path;
+    int64_t n_threads;
+    int64_t max_request_bytes;
+    int listen_fd = -1;
+    int wakeup_pipe[2] = {-1, -1}; // Written to when the poll loop has to look at returned connections or stop
+
+    std::mutex queue_mutex; // Protects the three containers below
+    std::condition_variable queue_cv;
+    std::queue<int> ready; // Connections with a request to serve. -1 tells a worker to exit
+    std::set<int> in_service; // Connections that are ready or being served by a worker
+    vector<int> returned; // Connections served by a worker that wait for their next request
+    std::atomic<bool> shutting_down{false};
+
+    // Per-worker scratch space
+    struct Worker{
+        typename sbwt_t::QueryContext context;
+        vector<char> reads;
+        vector<int64_t> lengths;
+        vector<int64_t> ranks;
+        vector<const char*> kmers;
+        string rc_kmer;
+    };
+
+    // Appends the ranks of the k-mers of the read to w.ranks
+    void query_read(const char* read, int64_t len, bool both_strands, Worker& w){
+        if(sbwt.has_streaming_query_support()){
+            if(both_strands) sbwt.streaming_search_both_strands(read, len, std::back_inserter(w.ranks), w.context);
+            else sbwt.streaming_search(read, len, std::back_inserter(w.ranks), w.context);
+            return;
+        }
+        int64_t k = sbwt.get_k();
+        int64_t n_kmers = max(len - k + 1, (int64_t)0);
+        int64_t start = w.ranks.size();
+        w.ranks.resize(start + n_kmers);
+        w.kmers.resize(n_kmers);
+        for(int64_t i = 0; i < n_kmers; i++) w.kmers[i] = read + i;
+        sbwt.search_batch(w.kmers.data(), n_kmers, w.ranks.data() + start);
+        if(both_strands){
+            w.rc_kmer.resize(k);
+            for(int64_t i = 0; i < n_kmers; i++){
+                if(w.ranks[start + i] != -1) continue;
+                for(int64_t j = 0; j < k; j++) w.rc_kmer[j] = get_rc(read[i + k - 1 - j]);
+                w.ranks[start + i] = sbwt.search(w.rc_kmer);
+            }
+        }
+    }
+
+    // Returns false if the connection should be closed
+    bool handle_request(int fd, Worker& w, ResponseWriter& out){
+        int64_t type = 0;
+        if(!read_fully(fd, (char*)&type, sizeof(type))) return false; // Client closed the connection
+
+        if(type == serve_protocol::SHUTDOWN){
+            out.write_int64(serve_protocol::STATUS_OK);
+            out.send(fd);
+            stop_accepting();
+            return false;
+        }
+        if(type != serve_protocol::QUERY) throw std::runtime_error("Unknown request type " + to_string(type));
+
+        int64_t flags = read_int64(fd);
+        int64_t n_reads = read_int64(fd);
+        if(n_reads < 0) throw std::runtime_error("Invalid number of reads");
+        w.reads.clear();
+        w.lengths.clear();
+        int64_t request_bytes = 0;
+        for(int64_t i = 0; i < n_reads; i++){
+            int64_t len = read_int64(fd);
+            if(len < 0) throw std::runtime_error("Invalid read length");
+            request_bytes += (int64_t)sizeof(len) + min(len, max_request_bytes); // min: no overflow
+            if(request_bytes > max_request_bytes) throw std::runtime_error("Request is larger than the limit of " + to_string(max_request_bytes) + " bytes");
+            w.reads.resize(w.reads.size() + len);
+            if(len > 0 && !read_fully(fd, w.reads.data() + w.reads.size() - len, len)) throw std::runtime_error("Connection closed in the middle of a message");
+            w.lengths.push_back(len);
+        }
+
+        out.write_int64(serve_protocol::STATUS_OK);
+        int64_t offset = 0;
+        for(int64_t len : w.lengths){
+            w.ranks.clear();
+            query_read(w.reads.data() + offset, len, flags & serve_protocol::FLAG_BOTH_STRANDS, w);
+            out.write_int64(w.ranks.size());
+            out.write_int64s(w.ranks.data(), w.ranks.size());
+            offset += len;
+        }
+        out.send(fd);
+        return true;
+    }
+
+    // Serves one request. Returns false if the connection should be closed.
+    bool serve_request(int fd, Worker& w){
+        ResponseWriter out;
+        try{
+            return handle_request(fd, w, out);
+        } catch(const std::exception& e){
+            write_log(string("Closing a connection after an error: ") + e.what(), LogLevel::MAJOR);
+            try{
+                ResponseWriter err;
+                err.write_int64(serve_protocol::STATUS_ERROR);
+                err.write_string(e.what());
+                err.send(fd);
+            } catch(const std::exception&){} // The client is gone
+        }
+        return false;
+    }
+
+    void worker_loop(){
+        Worker w;
+        while(true){
+            int fd;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_cv.wait(lock, [this]{return !ready.empty();});
+                fd = ready.front();
+                ready.pop();
+            }
+            if(fd == -1) return;
+            bool keep = serve_request(fd, w);
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                in_service.erase(fd);
+                if(keep && !shutting_down) returned.push_back(fd);
+                else close(fd);
+            }
+            if(keep) wake_up_poll_loop();
+        }
+    }
+
+    void wake_up_poll_loop(){
+        char c = 0;
+        if(write(wakeup_pipe[1], &c, 1) < 0){} // The pipe is non-blocking. If it is full, the loop wakes up anyway.
+    }
+
+    void stop_accepting(){
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            shutting_down = true;
+        }
+        wake_up_poll_loop();
+    }
+
+public:
+
+    QueryServer(const sbwt_t& sbwt, const string& socket_path, int64_t n_threads, int64_t max_request_bytes)
+        : sbwt(sbwt), socket_path(socket_path), n_threads(n_threads), max_request_bytes(max_request_bytes) {}
+
+    // Serves until a SHUTDOWN request is received
+    void run(){
+        sockaddr_un addr = make_socket_address(socket_path);
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(listen_fd == -1) throw std::runtime_error("Error creating socket");
+        unlink(socket_path.c_str()); // Remove a stale socket file from an earlier server
+        if(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == -1) throw std::runtime_error("Could not bind socket " + socket_path);
+        if(listen(listen_fd, 128) == -1) throw std::runtime_error("Could not listen on socket " + socket_path);
+
+        if(pipe(wakeup_pipe) == -1) throw std::runtime_error("Error creating a pipe");
+        for(int fd : wakeup_pipe) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        vector<std::thread> workers;
+        for(int64_t t = 0; t < n_threads; t++) workers.emplace_back(&QueryServer::worker_loop, this);
+
+        write_log("Listening on " + socket_path + " with " + to_string(n_threads) + " threads", LogLevel::MAJOR);
+        vector<int> idle; // Connections waiting for their next request
+        vector<pollfd> poll_fds;
+        while(!shutting_down){
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                idle.insert(idle.end(), returned.begin(), returned.end());
+                returned.clear();
+            }
+            poll_fds = {{listen_fd, POLLIN, 0}, {wakeup_pipe[0], POLLIN, 0}};
+            for(int fd : idle) poll_fds.push_back({fd, POLLIN, 0});
+            if(poll(poll_fds.data(), poll_fds.size(), -1) == -1){
+                if(errno == EINTR) continue;
+                throw std::runtime_error("Error polling the connections");
+            }
+            if(poll_fds[1].revents != 0){
+                char buf[256];
+                while(read(wakeup_pipe[0], buf, sizeof(buf)) > 0); // Drain
+            }
+            if(shutting_down) break;
+
+            // Hand the connections with a request, or a hangup, to the workers
+            vector<int> still_idle;
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                for(int64_t i = 2; i < (int64_t)poll_fds.size(); i++){
+                    if(poll_fds[i].revents != 0){
+                        ready.push(poll_fds[i].fd);
+                        in_service.insert(poll_fds[i].fd);
+                        queue_cv.notify_one();
+                    } else still_idle.push_back(poll_fds[i].fd);
+                }
+            }
+            idle.swap(still_idle);
+
+            if(poll_fds[0].revents != 0){
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if(fd != -1) idle.push_back(fd);
+                else if(errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) throw std::runtime_error("Error accepting a connection");
+            }
+        }
+
+        close(listen_fd);
+        unlink(socket_path.c_str());
+        for(int fd : idle) close(fd);
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            for(int fd : returned) close(fd);
+            returned.clear();
+            // Unblock the workers that wait for the rest of a request. The requests that have
+            // been received are still answered.
+            for(int fd : in_service) shutdown(fd, SHUT_RD);
+            for(int64_t t = 0; t < n_threads; t++) ready.push(-1); // After the connections that are already queued
+            queue_cv.notify_all();
+        }
+        for(std::thread& t : workers) t.join();
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+        write_log("Server stopped", LogLevel::MAJOR);
+    }
+
+};
+
+template<typename sbwt_t>
+void load_and_serve(istream& in, const string& socket_path, int64_t n_threads, int64_t max_request_bytes){
+    sbwt_t sbwt;
+    SBWTLoadConfig load_config;
+    load_config.lcs = false; // Not needed for k-mer queries
+    load_config.dummy_marks = false;
+    load_config.counts = false;
+    sbwt.load(in, load_config);
+    QueryServer<sbwt_t>(sbwt, socket_path, n_threads, max_request_bytes).run();
+}
+
+int serve_main(int argc, char** argv){
+
+    set_log_level(LogLevel::MINOR);
+
+    cxxopts::Options options(argv[0], "Load an index once and answer k-mer queries from sbwt client over a Unix domain socket, until a client sends a shutdown request.");
+
+    options.add_options()
+        ("i,index-file", "Index input file.", cxxopts::value<string>())
+        ("s,socket", "Path of the Unix domain socket to listen on. An existing file at the path is replaced.", cxxopts::value<string>())
+        ("t,n-threads", "Number of requests served in parallel. Any number of clients can be connected at the same time.", cxxopts::value<int64_t>()->default_value("1"))
+        ("max-request-mb", "Largest query request accepted, in megabytes. Larger requests are answered with an error. The request of a client batch takes about the length of its reads.", cxxopts::value<int64_t>()->default_value("1024"))
+        ("h,help", "Print usage")
+    ;
+
+    int64_t old_argc = argc; // Must store this because the parser modifies it
+    auto opts = options.parse(argc, argv);
+
+    if (old_argc == 1 || opts.count("help")){
+        std::cerr << options.help() << std::endl;
+        exit(1);
+    }
+
+    string indexfile = opts["index-file"].as<string>();
+    check_readable(indexfile);
+    string socket_path = opts["socket"].as<string>();
+    int64_t n_threads = opts["n-threads"].as<int64_t>();
+    if(n_threads < 1) throw std::runtime_error("Number of threads must be at least 1");
+    int64_t max_request_mb = opts["max-request-mb"].as<int64_t>();
+    if(max_request_mb < 1) throw std::runtime_error("Maximum request size must be at least 1 megabyte");
+    int64_t max_request_bytes = max_request_mb * ((int64_t)1 << 20);
+
+    signal(SIGPIPE, SIG_IGN); // A client that disconnects must not kill the server
+
+    vector<string> variants = get_available_variants();
+
+    throwing_ifstream in(indexfile, ios::binary);
+    string variant = load_string(in.stream); // read variant type
+    if(std::find(variants.begin(), variants.end(), variant) == variants.end()){
+        cerr << "Error loading index from file: unrecognized variant specified in the file" << endl;
+        return 1;
+    }
+
+    write_log("Loading the index variant " + variant, LogLevel::MAJOR);
+
+    if (variant == "plain-matrix") load_and_serve<plain_matrix_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "rrr-matrix") load_and_serve<rrr_matrix_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "mef-matrix") load_and_serve<mef_matrix_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "interleaved-matrix") load_and_serve<interleaved_matrix_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "plain-split") load_and_serve<plain_split_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "rrr-split") load_and_serve<rrr_split_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "mef-split") load_and_serve<mef_split_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "plain-concat") load_and_serve<plain_concat_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "mef-concat") load_and_serve<mef_concat_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "plain-subsetwt") load_and_serve<plain_sswt_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+    if (variant == "rrr-subsetwt") load_and_serve<rrr_sswt_sbwt_t>(in.stream, socket_path, n_threads, max_request_bytes);
+
+    return 0;
+}
+
+// Reads a response to a query request and writes one line of ranks per read
+template<typename writer_t>
+void receive_query_response(int fd, int64_t n_reads, writer_t& out){
+    int64_t status = read_int64(fd);
+    if(status != serve_protocol::STATUS_OK){
+        int64_t len = read_int64(fd);
+        string msg(len, '\0');
+        read_fully(fd, msg.data(), len);
+        throw std::runtime_error("Server error: " + msg);
+    }
+    vector<int64_t> ranks;
+    string line;
+    for(int64_t i = 0; i < n_reads; i++){
+        int64_t n = read_int64(fd);
+        ranks.resize(n);
+        if(n > 0 && !read_fully(fd, (char*)ranks.data(), n * sizeof(int64_t))) throw std::runtime_error("Connection closed by the server");
+        line.clear();
+        for(int64_t r : ranks){
+            line += to_string(r);
+            line += ' ';
+        }
+        line += '\n';
+        out.write(line.data(), line.size());
+    }
+}
+
+template<typename reader_t>
+int64_t run_client_queries(int fd, const string& infile, const string& outfile, bool both_strands, int64_t batch_size){
+    reader_t reader(infile);
+    seq_io::Buffered_ofstream<std::ofstream> out(outfile);
+    int64_t n_reads_total = 0;
+    vector<char> request;
+    auto append = [&request](int64_t x){request.insert(request.end(), (const char*)&x, (const char*)&x + sizeof(x));};
+    bool reads_left = true;
+    while(reads_left){
+        // Build one request of up to batch_size reads. The number of reads is filled in at the end.
+        request.clear();
+        append(serve_protocol::QUERY);
+        append(both_strands ? serve_protocol::FLAG_BOTH_STRANDS : 0);
+        append(0);
+        int64_t n_reads = 0;
+        while(n_reads < batch_size){
+            int64_t len = reader.get_next_read_to_buffer();
+            if(len == 0){
+                reads_left = false;
+                break;
+            }
+            append(len);
+            request.insert(request.end(), reader.read_buf, reader.read_buf + len);
+            n_reads++;
+        }
+        if(n_reads == 0) break;
+        memcpy(request.data() + 2 * sizeof(int64_t), &n_reads, sizeof(n_reads));
+        write_fully(fd, request.data(), request.size());
+        receive_query_response(fd, n_reads, out);
+        n_reads_total += n_reads;
+    }
+    return n_reads_total;
+}
+
+int client_main(int argc, char** argv){
+
+    set_log_level(LogLevel::MINOR);
+
+    cxxopts::Options options(argv[0], "Query all k-mers of all input reads using a server started with sbwt serve. The output is the same as from sbwt search in the text format.");
+
+    options.add_options()
+        ("s,socket", "Path of the Unix domain socket of the server.", cxxopts::value<string>())
+        ("q,query-file", "The query in FASTA or FASTQ format, possibly gzipped. Multi-line FASTQ is not supported.", cxxopts::value<string>())
+        ("o,out-file", "Output filename.", cxxopts::value<string>())
+        ("r,both-strands", "Report the rank of the reverse complement of a k-mer if the k-mer itself is not found, as in sbwt search -r.", cxxopts::value<bool>()->default_value("false"))
+        ("b,batch-size", "Number of reads sent in one request.", cxxopts::value<int64_t>()->default_value("10000"))
+        ("shutdown", "Ask the server to stop. Queries given at the same time are run first.", cxxopts::value<bool>()->default_value("false"))
+        ("h,help", "Print usage")
+    ;
+
+    int64_t old_argc = argc; // Must store this because the parser modifies it
+    auto opts = options.parse(argc, argv);
+
+    if (old_argc == 1 || opts.count("help")){
+        std::cerr << options.help() << std::endl;
+        exit(1);
+    }
+
+    string socket_path = opts["socket"].as<string>();
+    bool shutdown = opts["shutdown"].as<bool>();
+    int64_t batch_size = opts["batch-size"].as<int64_t>();
+    if(batch_size < 1) throw std::runtime_error("Batch size must be at least 1");
+    if(!opts.count("query-file") && !shutdown) throw std::runtime_error("Give a query file, --shutdown, or both");
+
+    signal(SIGPIPE, SIG_IGN); // Report a closed connection as an error instead of dying
+
+    int fd = connect_to_server(socket_path);
+    try{
+        if(opts.count("query-file")){
+            string infile = opts["query-file"].as<string>();
+            string outfile = opts["out-file"].as<string>();
+            check_readable(infile);
+            check_writable(outfile);
+            int64_t micros_start = cur_time_micros();
+            bool both_strands = opts["both-strands"].as<bool>();
+            int64_t n_reads = 0;
+            if(seq_io::figure_out_file_format(infile).gzipped)
+                n_reads = run_client_queries<seq_io::Reader<seq_io::Buffered_ifstream<seq_io::zstr::ifstream>>>(fd, infile, outfile, both_strands, batch_size);
+            else
+                n_reads = run_client_queries<seq_io::Reader<seq_io::Buffered_ifstream<std::ifstream>>>(fd, infile, outfile, both_strands, batch_size);
+            write_log("Queried " + to_string(n_reads) + " reads in " + to_string((cur_time_micros() - micros_start) / 1000) + " ms", LogLevel::MAJOR);
+        }
+        if(shutdown){
+            int64_t type = serve_protocol::SHUTDOWN;
+            write_fully(fd, (const char*)&type, sizeof(type));
+            if(read_int64(fd) != serve_protocol::STATUS_OK) throw std::runtime_error("The server did not accept the shutdown request");
+        }
+    } catch(...){
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    return 0;
+}
@@ -8,67 +8,13 @@
 #include <set>
 #include <unordered_map>
 #include <stdexcept>
+#include <filesystem>
+#include <algorithm>
 
 namespace sbwt{
 
 namespace KMC_construction_helper_classes{
 
-Node::Node() : kmer(), edge_flags(0) {}
-Node::Node(kmer_t kmer) : kmer(kmer), edge_flags(0) {}
-
-static inline int64_t size_in_bytes(){
-    return kmer_t::size_in_bytes() + sizeof(char); // char is the edge flags
-}
-
-void Node::set(char c){
-    if(c == 'A') edge_flags |= 1 << 0;
-    else if(c == 'C') edge_flags |= 1 << 1;
-    else if(c == 'G') edge_flags |= 1 << 2;
-    else if(c == 'T') edge_flags |= 1 << 3;
-}
-
-bool Node::has(char c) const{
-    if(c == 'A') return edge_flags & (1 << 0);
-    else if(c == 'C') return edge_flags & (1 << 1);
-    else if(c == 'G') return edge_flags & (1 << 2);
-    else if(c == 'T') return edge_flags & (1 << 3);
-    return false;
-}
-
-bool Node::operator==(const Node &other) const{
-    return this->kmer == other.kmer && this->edge_flags == other.edge_flags;
-}
-
-bool Node::operator!=(const Node &other) const{
-    return !(*this == other);
-}
-
-bool Node::operator<(const Node &other) const{
-    if(this->kmer < other.kmer) return true;
-    if(this->kmer == other.kmer && this->edge_flags < other.edge_flags) return true;
-    return false;
-}
-
-string Node::to_string() const{
-    string S = kmer.to_string() + ": ";
-    S += has('A') ? '1' : '0';
-    S += has('C') ? '1' : '0';
-    S += has('G') ? '1' : '0';
-    S += has('T') ? '1' : '0';
-    return S;
-}
-
-void Node::serialize(char* buf){
-    kmer.serialize(buf);
-    buf[size_in_bytes()-1] = edge_flags;
-}
-
-void Node::load(const char* buf){
-    kmer.load(buf);
-    edge_flags = buf[size_in_bytes()-1];
-}
-
-
 Argv::Argv(vector<string> v){
     array = (char**)malloc(sizeof(char*) * v.size());
     // Copy contents of v into array
@@ -88,7 +34,8 @@ Argv::~Argv(){
     free(array);
 }
 
-char Kmer_stream_from_KMC_DB::get_rc(char c){
+template<int64_t max_len>
+char Kmer_stream_from_KMC_DB<max_len>::get_rc(char c){
     switch(c){
         case 'A': return 'T';
         case 'T': return 'A';
@@ -98,13 +45,15 @@ char Kmer_stream_from_KMC_DB::get_rc(char c){
     }   
 }
 
-void Kmer_stream_from_KMC_DB::reverse_complement(string& S){
+template<int64_t max_len>
+void Kmer_stream_from_KMC_DB<max_len>::reverse_complement(string& S){
     std::reverse(S.begin(), S.end());
     for(char& c : S) c = get_rc(c);
 }   
 
 
-Kmer_stream_from_KMC_DB::Kmer_stream_from_KMC_DB(string KMC_db_path, bool add_revcomps) : add_revcomps(add_revcomps) {
+template<int64_t max_len>
+Kmer_stream_from_KMC_DB<max_len>::Kmer_stream_from_KMC_DB(string KMC_db_path, bool add_revcomps) : add_revcomps(add_revcomps) {
     kmer_database = new CKMCFile();
     if (!kmer_database->OpenForListing(KMC_db_path)){
         throw std::runtime_error("Error opening KMC database " + KMC_db_path);
@@ -114,19 +63,22 @@ Kmer_stream_from_KMC_DB::Kmer_stream_from_KMC_DB(string KMC_db_path, bool add_re
     kmer_object = new CKmerAPI(_kmer_length);
 }
 
-Kmer_stream_from_KMC_DB::~Kmer_stream_from_KMC_DB(){
+template<int64_t max_len>
+Kmer_stream_from_KMC_DB<max_len>::~Kmer_stream_from_KMC_DB(){
     delete kmer_database;
     delete kmer_object;
 }
 
-bool Kmer_stream_from_KMC_DB::done(){
+template<int64_t max_len>
+bool Kmer_stream_from_KMC_DB<max_len>::done(){
     return (!add_revcomps || !revcomp_next) && kmer_database->Eof();
 }
 
-Kmer<MAX_KMER_LENGTH> Kmer_stream_from_KMC_DB::next(){
+template<int64_t max_len>
+Kmer<max_len> Kmer_stream_from_KMC_DB<max_len>::next(){
     if(add_revcomps && revcomp_next){
         revcomp_next = false;
-        return Kmer<MAX_KMER_LENGTH>(str_revcomp);
+        return Kmer<max_len>(str_revcomp);
     }
 
     //float counter_f;
@@ -137,6 +89,7 @@ Kmer<MAX_KMER_LENGTH> Kmer_stream_from_KMC_DB::next(){
     else {			*/
         kmer_database->ReadNextKmer(*kmer_object, counter_i);
     //}
+    last_count = counter_i;
 
     kmer_object->to_string(str);
     if(add_revcomps){
@@ -147,54 +100,129 @@ Kmer<MAX_KMER_LENGTH> Kmer_stream_from_KMC_DB::next(){
 
     std::reverse(str.begin(), str.end()); // Return reverses so that they are in colex order
 
-    return Kmer<MAX_KMER_LENGTH>(str);
-
-}
-
-void Disk_Instream::update_top(){
-    in.read(in_buffer, Node::size_in_bytes());
-    if(in.eof()){
-        all_read = true;
-        return;
+    return Kmer<max_len>(str);
+
+}
+
+template<int64_t max_len>
+SortedKMCDatabase<max_len>::SortedKMCDatabase(const string& KMC_db_path) : suffix_filename(KMC_db_path + ".kmc_suf"), char_block_starts(256, INT64_MAX){
+    CKMCFile db;
+    if(!db.OpenForListing(KMC_db_path)) throw std::runtime_error("Error opening KMC database " + KMC_db_path);
+    uint32 kmer_length, mode, counter_size, lut_prefix_len, signature_len, min_count;
+    uint64 max_count, total_kmers;
+    db.Info(kmer_length, mode, counter_size, lut_prefix_len, signature_len, min_count, max_count, total_kmers);
+    db.Close();
+
+    k = kmer_length;
+    lut_prefix_length = lut_prefix_len;
+    counter_bytes = counter_size;
+    n_kmers = total_kmers;
+    if(mode != 0 || lut_prefix_length > k || (k - lut_prefix_length) % 4 != 0 || lut_prefix_length > 16)
+        throw std::runtime_error("Unsupported KMC database layout");
+    suffix_bytes = (k - lut_prefix_length) / 4;
+
+    // The table of the first records of the prefixes follows the marker. The entry after the table
+    // is replaced with the number of records, which is also what the KMC API does.
+    int64_t n_prefixes = (int64_t)1 << (2*lut_prefix_length);
+    if((int64_t)std::filesystem::file_size(KMC_db_path + ".kmc_pre") < 4 + (n_prefixes + 1) * 8 ||
+       (int64_t)std::filesystem::file_size(suffix_filename) != 8 + n_kmers * record_bytes())
+        throw std::runtime_error("Unsupported KMC database layout");
+    vector<int64_t> table(n_prefixes + 1);
+    seq_io::Buffered_ifstream<> pre_in(KMC_db_path + ".kmc_pre", ios::binary);
+    char marker[4];
+    pre_in.read(marker, 4);
+    pre_in.read((char*)table.data(), n_prefixes * sizeof(int64_t));
+    table[n_prefixes] = n_kmers;
+    for(int64_t p = 0; p < n_prefixes; p++)
+        if(table[p] < 0 || table[p] > table[p+1]) throw std::runtime_error("Unsupported KMC database layout");
+    if(table[0] != 0) throw std::runtime_error("Unsupported KMC database layout");
+    lut = std::make_shared<const vector<int64_t>>(std::move(table));
+
+    record_buf.resize(record_bytes());
+    in.open(suffix_filename, ios::binary);
+    seek(0);
+
+    // The k-mers are reversed, so the blocks of the last characters are the blocks of the first characters in KMC
+    for(char c : {'A','C','G','T'}){
+        int64_t lo = 0, hi = n_kmers;
+        while(lo < hi){ // First k-mer that ends in c or later
+            int64_t mid = lo + (hi - lo) / 2;
+            seek(mid);
+            if(next().last() < c) lo = mid + 1;
+            else hi = mid;
+        }
+        char_block_starts[c] = lo;
     }
-    top.load(in_buffer);
-}
-
-Disk_Instream::Disk_Instream(string filename) {
-    in.open(filename, ios_base::binary);
-    in_buffer = (char*)malloc(Node::size_in_bytes());
-}
-
-bool Disk_Instream::stream_done() const{
-    return all_read;
-}
-
-Node Disk_Instream::stream_next(){
-    Node ret = top;
-    update_top();
-    return ret;
-}
-
-Node Disk_Instream::peek_next(){
-    return top;
-}
-
-Disk_Instream::~Disk_Instream(){
-    free(in_buffer);
-}
-
-Node_stream_merger::Node_stream_merger(Disk_Instream& A, Disk_Instream& B) : A(A), B(B){}
-
-bool Node_stream_merger::stream_done(){
-    return A.stream_done() && B.stream_done();
-}
-
-Node Node_stream_merger::stream_next(){
-    if(A.stream_done()) return B.stream_next();
-    if(B.stream_done()) return A.stream_next();
-    if(A.peek_next() < B.peek_next()) return A.stream_next();
-    else return B.stream_next();
-}
+    for(char c : {'A','C','G','T'}){
+        if(char_block_starts[c] < n_kmers){
+            seek(char_block_starts[c]);
+            if(next().last() != c) char_block_starts[c] = n_kmers; // No k-mers end in c
+        }
+    }
+    seek(0);
+}
+
+template<int64_t max_len>
+SortedKMCDatabase<max_len>::SortedKMCDatabase(const SortedKMCDatabase& other) :
+    suffix_filename(other.suffix_filename), lut(other.lut), k(other.k), lut_prefix_length(other.lut_prefix_length),
+    suffix_bytes(other.suffix_bytes), counter_bytes(other.counter_bytes), n_kmers(other.n_kmers),
+    char_block_starts(other.char_block_starts), record_buf(other.record_buf.size()) {
+    in.open(suffix_filename, ios::binary);
+    seek(other.cursor);
+}
+
+template<int64_t max_len>
+bool SortedKMCDatabase<max_len>::matches_kmc_listing(const string& KMC_db_path, int64_t n){
+    Kmer_stream_from_KMC_DB<max_len> listing(KMC_db_path, false);
+    int64_t start = cursor;
+    seek(0);
+    bool match = true;
+    for(int64_t i = 0; i < n && !done() && match; i++){
+        if(listing.done()) match = false;
+        else match = (next() == listing.next() && get_last_count() == listing.get_last_count());
+    }
+    seek(start);
+    return match;
+}
+
+template<int64_t max_len>
+void SortedKMCDatabase<max_len>::seek(int64_t pos){
+    cursor = pos;
+    prefix = std::upper_bound(lut->begin(), lut->end() - 1, pos) - lut->begin() - 1;
+    in.seekg(4 + pos * record_bytes());
+}
+
+template<int64_t max_len>
+Kmer<max_len> SortedKMCDatabase<max_len>::next(){
+    static const char ACGT[] = {'A','C','G','T'};
+    while(cursor >= (*lut)[prefix+1]) prefix++; // Skip empty prefixes
+    in.read(record_buf.data(), record_bytes());
+
+    // Most significant bits first, in the order of KMC, and then reversed
+    str.resize(k);
+    int64_t j = 0;
+    for(int64_t i = lut_prefix_length - 1; i >= 0; i--) str[j++] = ACGT[(prefix >> (2*i)) & 3];
+    for(int64_t b = 0; b < suffix_bytes; b++)
+        for(int64_t i = 3; i >= 0; i--) str[j++] = ACGT[((uint8_t)record_buf[b] >> (2*i)) & 3];
+    last_count = 0;
+    for(int64_t b = 0; b < counter_bytes; b++) last_count |= (uint32_t)(uint8_t)record_buf[suffix_bytes + b] << (8*b); // Little-endian
+    std::reverse(str.begin(), str.end());
+
+    cursor++;
+    return Kmer<max_len>(str);
+}
+
+// The k-mer widths that build_with_kmc dispatches to
+template class Kmer_stream_from_KMC_DB<32>;
+template class Kmer_stream_from_KMC_DB<64>;
+template class Kmer_stream_from_KMC_DB<128>;
+template class SortedKMCDatabase<32>;
+template class SortedKMCDatabase<64>;
+template class SortedKMCDatabase<128>;
+#if MAX_KMER_LENGTH != 32 && MAX_KMER_LENGTH != 64 && MAX_KMER_LENGTH != 128
+template class Kmer_stream_from_KMC_DB<MAX_KMER_LENGTH>;
+template class SortedKMCDatabase<MAX_KMER_LENGTH>;
+#endif
 
 } // End of namespace KMC_construction_helper_classes
 } // End of namepace sbwt
\ No newline at end of file
@@ -652,7 +652,7 @@ using namespace std;
 using namespace kmc_tools;
 
 // See header for description
-pair<string, int64_t> run_kmc(const vector<string>& input_files, int64_t k, int64_t n_threads, int64_t ram_gigas, int64_t min_abundance, int64_t max_abundance){
+pair<string, int64_t> run_kmc(const vector<string>& input_files, int64_t k, int64_t n_threads, int64_t ram_gigas, int64_t min_abundance, int64_t max_abundance, int64_t counter_max, bool canonical){
 
     write_log("Running KMC counter", LogLevel::MAJOR);
 
@@ -675,7 +675,7 @@ pair<string, int64_t> run_kmc(const vector<string>& input_files, int64_t k, int6
         .SetNThreads(n_threads)
         .SetMaxRamGB(ram_gigas)
         .SetInputFileType(format.format == seq_io::FASTA ? KMC::InputFileType::MULTILINE_FASTA : KMC::InputFileType::FASTQ)
-        .SetCanonicalKmers(false)
+        .SetCanonicalKmers(canonical)
         .SetTmpPath(get_temp_file_manager().get_dir());
 
     KMC::Runner kmc;
@@ -688,6 +688,7 @@ pair<string, int64_t> run_kmc(const vector<string>& input_files, int64_t k, int6
         .SetMaxRamGB(ramForStage2)
         .SetCutoffMin(min_abundance)
         .SetCutoffMax(max_abundance)
+        .SetCounterMax(counter_max)
         .SetOutputFileName(KMC_db_file_prefix)
         .SetStrictMemoryMode(true);
 
@@ -6,6 +6,11 @@
 #include "commands.hh"
 #include "variants.hh"
 #include <gtest/gtest.h>
+#include <thread>
+#include <chrono>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 using namespace sbwt;
 
@@ -109,6 +114,192 @@ TEST(CLI, end_to_end_build_and_query){
     ASSERT_EQ(read_gzipped_file(o3 + ".gz"), correct_answer);
     ASSERT_EQ(read_gzipped_file(o4 + ".gz"), correct_answer);
 
+    // Multithreaded search must give the same output in the same order
+    string output_file_list_mt = get_temp_file_manager().create_filename("",".txt");
+    write_to_file(o1 + ".mt\n" + o2 + ".mt\n" + o3 + ".mt\n" + o4 + ".mt\n", output_file_list_mt);
+
+    vector<string> args_mt = {"search", "-o", output_file_list_mt, "-i", indexfile, "-q", input_file_list, "-t", "3"}; 
+    Argv ARGS_mt(args_mt);
+
+    search_main(ARGS_mt.size, ARGS_mt.array);
+
+    ASSERT_TRUE(files_are_equal(answer_file, o1 + ".mt"));
+    ASSERT_TRUE(files_are_equal(answer_file, o2 + ".mt"));
+    ASSERT_TRUE(files_are_equal(answer_file, o3 + ".mt"));
+    ASSERT_TRUE(files_are_equal(answer_file, o4 + ".mt"));
+
+    // Binary output formats must decode to the same ranks
+    vector<vector<int64_t>> correct_ranks;
+    {
+        stringstream lines(correct_answer);
+        string line;
+        while(getline(lines, line)){
+            stringstream values(line);
+            correct_ranks.push_back({});
+            int64_t x;
+            while(values >> x) correct_ranks.back().push_back(x);
+        }
+    }
+
+    for(string format : {"binary", "varint", "bitmap", "sparse"}){
+        string out_bin = get_temp_file_manager().create_filename("",".bin");
+        vector<string> args_bin = {"search", "-o", out_bin, "-i", indexfile, "-q", q1, "--output-format", format};
+        Argv ARGS_bin(args_bin);
+        search_main(ARGS_bin.size, ARGS_bin.array);
+
+        throwing_ifstream in(out_bin, ios::binary);
+        auto read_int64 = [&](){
+            unsigned char bytes[8];
+            in.stream.read((char*)bytes, 8);
+            uint64_t x = 0;
+            for(int64_t i = 0; i < 8; i++) x |= (uint64_t)bytes[i] << (8*i);
+            return (int64_t)x;
+        };
+        auto read_varint = [&](){
+            uint64_t x = 0;
+            for(int64_t shift = 0; ; shift += 7){
+                uint64_t byte = (unsigned char)in.stream.get();
+                x |= (byte & 0x7F) << shift;
+                if(byte < 0x80) return x;
+            }
+        };
+
+        for(const vector<int64_t>& ranks : correct_ranks){
+            int64_t n = format == "varint" ? read_varint() : read_int64();
+            ASSERT_EQ(n, ranks.size());
+            if(format == "binary"){
+                for(int64_t x : ranks) ASSERT_EQ(read_int64(), x);
+            } else if(format == "varint"){
+                int64_t prev = 0;
+                for(int64_t x : ranks){
+                    uint64_t z = read_varint();
+                    prev += (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+                    ASSERT_EQ(prev, x);
+                }
+            } else if(format == "bitmap"){
+                for(int64_t j = 0; j < n; j += 8){
+                    char byte = in.stream.get();
+                    for(int64_t b = 0; b < 8 && j + b < n; b++) ASSERT_EQ((byte >> b) & 1, ranks[j+b] != -1);
+                }
+            } else{
+                int64_t n_hits = read_int64();
+                ASSERT_EQ(n_hits, n - std::count(ranks.begin(), ranks.end(), -1));
+                for(int64_t h = 0; h < n_hits; h++){
+                    int64_t pos = read_int64();
+                    ASSERT_EQ(read_int64(), ranks[pos]);
+                }
+            }
+        }
+        in.stream.peek();
+        ASSERT_TRUE(in.stream.eof());
+    }
+
+    // Summary mode, with and without a threshold
+    string expected_summary, expected_passes;
+    for(const vector<int64_t>& ranks : correct_ranks){
+        int64_t n = ranks.size();
+        int64_t hits = n - std::count(ranks.begin(), ranks.end(), -1);
+        expected_summary += to_string(hits) + " " + to_string(n) + " \n";
+        expected_passes += string(hits * 2 >= n ? "1" : "0") + " \n";
+    }
+    for(bool threshold : {false, true}){
+        string out_summary = get_temp_file_manager().create_filename("",".txt");
+        vector<string> args_summary = {"search", "-o", out_summary, "-i", indexfile, "-q", q1, "--summary"};
+        if(threshold){
+            args_summary.push_back("--summary-threshold");
+            args_summary.push_back("0.5");
+        }
+        Argv ARGS_summary(args_summary);
+        search_main(ARGS_summary.size, ARGS_summary.array);
+
+        string expected_file = get_temp_file_manager().create_filename("",".txt");
+        write_to_file(threshold ? expected_passes : expected_summary, expected_file);
+        ASSERT_TRUE(files_are_equal(expected_file, out_summary));
+    }
 
 }
 
+
+TEST(CLI, serve_and_client){
+    vector<string> seqs = {"ACTAGTGTAGCTACAAA","ATGTGCTGATGCTAGCATTTTTTT","GTGTACTAGTGTGTAGTCGAT"};
+    vector<string> queries = {"GGAGAACTAGTGTAGCTACAAAGAGAG", "AGTGTGTAGCAAAATGTGCTGATGCTAGCAAAAAAAA", "CTCTACACACTTC", "ACG", "TTTTTTTAANNCTAGCATCAGC"};
+
+    string seqfile = get_temp_file_manager().create_filename("",".fna");
+    string queryfile = get_temp_file_manager().create_filename("",".fna");
+    {
+        seq_io::Writer<std::ofstream> w1(seqfile);
+        for(string S : seqs) w1.write_sequence(S.c_str(), S.size());
+        seq_io::Writer<std::ofstream> w2(queryfile);
+        for(string S : queries) w2.write_sequence(S.c_str(), S.size());
+    }
+
+    for(bool streaming_support : {true, false}){
+        string indexfile = get_temp_file_manager().create_filename("",".sbwt");
+        vector<string> build_args = {"build","-i",seqfile,"-o",indexfile,"-k","6","--temp-dir",get_temp_file_manager().get_dir()};
+        if(!streaming_support) build_args.push_back("--no-streaming-support");
+        Argv build_argv(build_args);
+        build_main(build_argv.size, build_argv.array);
+
+        string socket_path = get_temp_file_manager().create_filename("",".sock");
+        vector<string> serve_args = {"serve", "-i", indexfile, "-s", socket_path, "-t", "2"};
+        Argv serve_argv(serve_args);
+        std::thread server([&](){serve_main(serve_argv.size, serve_argv.array);});
+
+        // Wait for the server to start listening
+        auto connect_to_socket = [&](){
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, socket_path.c_str());
+            if(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) return fd;
+            close(fd);
+            return -1;
+        };
+        while(true){
+            int fd = connect_to_socket();
+            if(fd != -1){
+                close(fd);
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        // More idle clients than threads must not keep the others or the shutdown waiting
+        vector<int> idle_fds;
+        for(int64_t i = 0; i < 3; i++) idle_fds.push_back(connect_to_socket());
+
+        // A request over the size limit is answered with an error
+        int big_fd = connect_to_socket();
+        int64_t big_request[4] = {1, 0, 1, (int64_t)1 << 40}; // QUERY, no flags, one read of 2^40 characters
+        ASSERT_EQ(write(big_fd, big_request, sizeof(big_request)), (ssize_t)sizeof(big_request));
+        int64_t status = 0;
+        ASSERT_EQ(read(big_fd, &status, sizeof(status)), (ssize_t)sizeof(status));
+        ASSERT_EQ(status, 1);
+        close(big_fd);
+
+        for(bool both_strands : {false, true}){
+            string out_search = get_temp_file_manager().create_filename("",".txt");
+            string out_client = get_temp_file_manager().create_filename("",".txt");
+
+            vector<string> search_args = {"search", "-o", out_search, "-i", indexfile, "-q", queryfile};
+            vector<string> client_args = {"client", "-o", out_client, "-s", socket_path, "-q", queryfile, "--batch-size", "2"};
+            if(both_strands){
+                search_args.push_back("-r");
+                client_args.push_back("-r");
+            }
+            Argv search_argv(search_args);
+            search_main(search_argv.size, search_argv.array);
+            Argv client_argv(client_args);
+            client_main(client_argv.size, client_argv.array);
+
+            ASSERT_TRUE(files_are_equal(out_search, out_client));
+        }
+
+        vector<string> shutdown_args = {"client", "-s", socket_path, "--shutdown"};
+        Argv shutdown_argv(shutdown_args);
+        client_main(shutdown_argv.size, shutdown_argv.array);
+        server.join(); // Returns even though the idle clients are still connected
+        for(int fd : idle_fds) close(fd);
+    }
+}
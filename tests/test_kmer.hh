@@ -105,6 +105,36 @@ TEST(KMER, serialization){
     ASSERT_TRUE(loaded2.get_k() == S.size());    
 }
 
+TEST(KMER, packed_serialization){
+    int64_t max_k = 100;
+    int64_t n_bytes = Kmer<255>::packed_size_in_bytes(max_k);
+    vector<string> strings;
+    vector<vector<char>> records;
+    for(int64_t i = 0; i < 200; i++){
+        string S = debug_test_get_random_DNA_string(rand() % (max_k + 1));
+        Kmer<255> kmer(S);
+        vector<char> buf(n_bytes + 1);
+        kmer.serialize_packed(buf.data(), n_bytes);
+        buf[n_bytes] = S.size(); // Length after the characters, as in variable-length temp files
+
+        Kmer<255> loaded;
+        loaded.load_packed(buf.data(), n_bytes, S.size());
+        ASSERT_TRUE(loaded == kmer);
+        ASSERT_EQ(loaded.to_string(), S);
+
+        strings.push_back(S);
+        records.push_back(buf);
+    }
+
+    // The records compare with memcmp in colex order
+    for(int64_t i = 0; i < (int64_t)strings.size(); i++){
+        for(int64_t j = 0; j < (int64_t)strings.size(); j++){
+            bool record_less = memcmp(records[i].data(), records[j].data(), n_bytes + 1) < 0;
+            ASSERT_EQ(record_less, Kmer<255>(strings[i]) < Kmer<255>(strings[j]));
+        }
+    }
+}
+
 bool colex_compare(std::string A, std::string B){
     std::reverse(A.begin(), A.end());
     std::reverse(B.begin(), B.end());
@@ -115,8 +115,11 @@ TEST_F(TEST_LARGE, streaming_queries){
 }
 
 TEST_F(TEST_LARGE, dummy_node_marks){
-    // This test is really weak but it's something
+    // The marks stored in construction must match the ones computed from the graph
     sdsl::bit_vector marks = matrixboss.compute_dummy_node_marks();
+    matrixboss_t without_marks = matrixboss;
+    without_marks.build_dummy_marks();
+    ASSERT_EQ(without_marks.get_dummy_marks(), marks);
     int64_t n_marks = 0;
     for(bool x : marks) n_marks += x;
     logger << "dummy node marks test: " << matrixboss.number_of_subsets() << " " << matrixboss.number_of_kmers() + n_marks << endl;
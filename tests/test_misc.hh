@@ -1,6 +1,10 @@
 #include "setup_tests.hh"
 #include "kmc_construct.hh"
 #include "globals.hh"
+#include "SubsetInterleavedRank.hh"
+#include "SuffixGroupStartSupport.hh"
+#include "SmallerValueSupport.hh"
+#include "dna_encoding.hh"
 #include <gtest/gtest.h>
 
 using namespace sbwt;
@@ -69,4 +73,73 @@ void create_rc_file_test(const string& file_extension){
 TEST(MISC, create_rc_files){
     create_rc_file_test(".fna");
     create_rc_file_test(".fq");
-}
\ No newline at end of file
+}
+
+TEST(MISC, interleaved_subset_rank_and_suffix_group_starts){
+    int64_t n = 1000;
+    sdsl::bit_vector A(n,0), C(n,0), G(n,0), T(n,0), starts(n,0);
+    srand(1234);
+    for(int64_t i = 0; i < n; i++){
+        A[i] = rand() % 2; C[i] = rand() % 2; G[i] = rand() % 2; T[i] = rand() % 2;
+        starts[i] = (i == 0 || rand() % 100 == 0); // Long runs of zeros to cross block boundaries
+    }
+
+    SubsetInterleavedRank sr(A, C, G, T, starts);
+    SuffixGroupStartSupport support(starts);
+    int64_t counts[4] = {0,0,0,0};
+    int64_t last_start = 0;
+    for(int64_t i = 0; i <= n; i++){
+        ASSERT_EQ(sr.rank(i, 'A'), counts[0]);
+        ASSERT_EQ(sr.rank(i, 'C'), counts[1]);
+        ASSERT_EQ(sr.rank(i, 'G'), counts[2]);
+        ASSERT_EQ(sr.rank(i, 'T'), counts[3]);
+        if(i == n) break;
+        ASSERT_EQ(sr.contains(i, 'A'), (bool)A[i]);
+        ASSERT_EQ(sr.contains(i, 'T'), (bool)T[i]);
+        if(starts[i]) last_start = i;
+        ASSERT_EQ(sr.suffix_group_start_in_block(i), last_start / 64 == i / 64 ? last_start : -1);
+        ASSERT_EQ(support.group_start(starts, i), last_start);
+        counts[0] += A[i]; counts[1] += C[i]; counts[2] += G[i]; counts[3] += T[i];
+    }
+}
+
+TEST(MISC, smaller_value_support){
+    srand(2345);
+    for(int64_t n : {0, 1, 63, 64, 65, 1000}){
+        sdsl::int_vector<> A(n, 0, 4);
+        for(int64_t i = 0; i < n; i++) A[i] = (rand() % 20 == 0) ? rand() % 4 : 4 + rand() % 12; // Small values are rare, to cross blocks
+        SmallerValueSupport support(A);
+        for(int64_t i = 0; i < n; i++){
+            for(uint64_t x = 0; x <= 16; x++){
+                int64_t prev = i;
+                while(prev >= 0 && A[prev] >= x) prev--;
+                int64_t next = i;
+                while(next < n && A[next] >= x) next++;
+                ASSERT_EQ(support.prev_smaller(A, i, x), prev);
+                ASSERT_EQ(support.next_smaller(A, i, x), next);
+            }
+        }
+        ASSERT_EQ(support.next_smaller(A, n, 1), n);
+    }
+}
+
+TEST(MISC, encode_DNA){
+    string alphabet = "ACGTNacgt-";
+    srand(4321);
+    for(int64_t len = 0; len < 200; len++){ // Covers the vectorized blocks and the scalar tail
+        string S;
+        for(int64_t i = 0; i < len; i++) S += (rand() % 4 == 0) ? alphabet[rand() % alphabet.size()] : "ACGT"[rand() % 4];
+        vector<uint8_t> codes(len);
+        vector<uint64_t> invalid_mask((len + 63) / 64, ~(uint64_t)0); // Garbage that should be overwritten
+        encode_DNA(S.c_str(), len, codes.data(), invalid_mask.data());
+        for(int64_t i = 0; i < len; i++){
+            bool invalid = (invalid_mask[i / 64] >> (i % 64)) & 1;
+            ASSERT_EQ(invalid, DNA_to_char_idx(S[i]) == -1);
+            if(!invalid) ASSERT_EQ(codes[i], DNA_to_char_idx(S[i]));
+            else ASSERT_EQ(codes[i], 0);
+            ASSERT_EQ(has_invalid_chars(invalid_mask.data(), 0, i+1), S.substr(0,i+1).find_first_not_of("ACGT") != string::npos);
+        }
+    }
+    uint8_t codes[3] = {1,2,3}; // CGT
+    ASSERT_EQ(pack_char_indices(codes, 3), (uint64_t)(1 | (2 << 2) | (3 << 4)));
+}
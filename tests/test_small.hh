@@ -12,6 +12,7 @@
 #include "SubsetMatrixSelectSupport.hh"
 #include "SubsetWT.hh"
 #include "suffix_group_optimization.hh"
+#include "dna_encoding.hh"
 #include <gtest/gtest.h>
 #include <set>
 
@@ -40,6 +41,27 @@ void check_all_queries(const nodeboss_t& nodeboss, const set<string>& true_kmers
     // Check NN...N
     string NNN(nodeboss.get_k(), 'N');
     ASSERT_EQ(nodeboss.search(NNN), -1);
+
+    // Check that batched search agrees with single searches
+    vector<string> batch(true_kmers.begin(), true_kmers.end());
+    batch.push_back(NNN);
+    batch.push_back(string(nodeboss.get_k(), 'A'));
+    vector<const char*> batch_ptrs;
+    for(const string& kmer : batch) batch_ptrs.push_back(kmer.c_str());
+    vector<int64_t> batch_result(batch.size());
+    nodeboss.search_batch(batch_ptrs.data(), batch.size(), batch_result.data());
+    for(int64_t i = 0; i < (int64_t)batch.size(); i++){
+        ASSERT_EQ(batch_result[i], nodeboss.search(batch[i]));
+    }
+
+    // Check the search entry points that take encoded k-mers
+    vector<uint8_t> codes(nodeboss.get_k());
+    vector<uint64_t> invalid_mask((nodeboss.get_k() + 63) / 64);
+    for(const string& kmer : batch){
+        encode_DNA(kmer.c_str(), kmer.size(), codes.data(), invalid_mask.data());
+        if(has_invalid_chars(invalid_mask.data(), 0, kmer.size())) continue;
+        ASSERT_EQ(nodeboss.search_char_indices(codes.data()), nodeboss.search(kmer));
+    }
 }
 
 // Queries all 4^k k-mers and checks that the membership queries give the right answers
@@ -55,6 +77,22 @@ void check_streaming_queries(const nodeboss_t& nodeboss, const set<string>& true
         //logger << kmer << " " << result[i] << endl;
     }
 
+    // Check that writing into a caller-provided buffer gives the same result
+    vector<int64_t> buffer(result.size() + 1, -2);
+    int64_t n_written = nodeboss.streaming_search(input.c_str(), input.size(), buffer.data());
+    ASSERT_EQ(n_written, result.size());
+    for(int64_t i = 0; i < n_written; i++) ASSERT_EQ(buffer[i], result[i]);
+    ASSERT_EQ(buffer.back(), -2); // Nothing written past the end
+
+    // Check that a context with buffers left over from a longer input gives the same result
+    typename nodeboss_t::QueryContext context;
+    string longer = input + "N" + input;
+    vector<int64_t> with_context;
+    nodeboss.streaming_search(longer.c_str(), longer.size(), std::back_inserter(with_context), context);
+    with_context.clear();
+    nodeboss.streaming_search(input.c_str(), input.size(), std::back_inserter(with_context), context);
+    ASSERT_EQ(with_context, result);
+
     // Check NN...N
     string NNN(100, 'N');
     for(int64_t x : nodeboss.streaming_search(NNN)){
@@ -62,6 +100,16 @@ void check_streaming_queries(const nodeboss_t& nodeboss, const set<string>& true
     }
 }
 
+// Checks that the two indexes have the same graph, streaming support and dummy marks
+void assert_same_sbwt(const plain_matrix_sbwt_t& a, const plain_matrix_sbwt_t& b){
+    ASSERT_EQ(a.get_subset_rank_structure().A_bits, b.get_subset_rank_structure().A_bits);
+    ASSERT_EQ(a.get_subset_rank_structure().C_bits, b.get_subset_rank_structure().C_bits);
+    ASSERT_EQ(a.get_subset_rank_structure().G_bits, b.get_subset_rank_structure().G_bits);
+    ASSERT_EQ(a.get_subset_rank_structure().T_bits, b.get_subset_rank_structure().T_bits);
+    ASSERT_EQ(a.get_streaming_support(), b.get_streaming_support());
+    ASSERT_EQ(a.get_dummy_marks(), b.get_dummy_marks());
+}
+
 void run_small_testcase(const vector<string>& strings, int64_t k){
     plain_matrix_sbwt_t index_im;
     build_nodeboss_in_memory(strings, index_im, k, false); 
@@ -93,6 +141,8 @@ void run_small_testcase(const vector<string>& strings, int64_t k){
     ASSERT_EQ(index_im.get_subset_rank_structure().G_bits, index_kmc.get_subset_rank_structure().G_bits);
     ASSERT_EQ(index_im.get_subset_rank_structure().T_bits, index_kmc.get_subset_rank_structure().T_bits);
 
+    ASSERT_EQ(index_im.get_dummy_marks(), index_kmc.get_dummy_marks());
+
     set<string> true_kmers = get_all_kmers(strings, k);
     check_all_queries(index_im, true_kmers);
     check_all_queries(index_kmc, true_kmers);
@@ -170,6 +220,35 @@ void test_get_kmer(){
 
 }
 
+TEST(TEST_RECONSTRUCT, chunked){
+    plain_matrix_sbwt_t sbwt;
+    vector<string> strings = {"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA"};
+    int64_t k = 6;
+    build_nodeboss_in_memory(strings, sbwt, k, false); 
+    string kmers_concat = sbwt.reconstruct_all_kmers();
+
+    // Labels from get_kmer, which walks back from each node independently
+    vector<char> buf(k);
+    for(int64_t i = 0; i < sbwt.number_of_subsets(); i++){
+        sbwt.get_kmer(i, buf.data());
+        ASSERT_EQ(kmers_concat.substr(i*k, k), string(buf.data(), buf.data()+k));
+    }
+
+    for(int64_t chunk_size : {1, 3, 7, 1000}){
+        for(int64_t n_threads : {1, 3}){
+            string chunked;
+            int64_t expected_first = 0;
+            sbwt.reconstruct_kmers_in_chunks(chunk_size, n_threads, [&](int64_t first, int64_t n, const char* kmers){
+                ASSERT_EQ(first, expected_first); // Chunks come in order
+                ASSERT_LE(n, chunk_size);
+                chunked.append(kmers, n*k);
+                expected_first += n;
+            });
+            ASSERT_EQ(chunked, kmers_concat);
+        }
+    }
+}
+
 TEST(TEST_GET_KMER, fast){
     plain_matrix_sbwt_t sbwt;
     vector<string> strings = {"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA"};
@@ -228,9 +307,297 @@ TEST(TEST_PARTIAL_SEARCH, all){
     //test_partial_search<mef_concat_sbwt_t>();
     test_partial_search<plain_sswt_sbwt_t>();
     test_partial_search<rrr_sswt_sbwt_t>();
+    test_partial_search<interleaved_matrix_sbwt_t>();
 }
 
 
+TEST(TEST_STREAMING_SEARCH, both_strands){
+    plain_matrix_sbwt_t sbwt;
+    vector<string> strings = {"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA"};
+    int64_t k = 6;
+    build_nodeboss_in_memory(strings, sbwt, k, true); // No reverse complements in the index
+    set<string> true_kmers = get_all_kmers(strings, k);
+
+    string query = "ACGCTAGCCATCACGGGNNTAATGCTGTAGCTACAGCATTAGGTCGA";
+    vector<int64_t> result = sbwt.streaming_search_both_strands(query);
+    ASSERT_EQ(result.size(), query.size() - k + 1);
+
+    // The same with a reused query context and a caller-provided buffer
+    plain_matrix_sbwt_t::QueryContext context;
+    vector<int64_t> first_result;
+    sbwt.streaming_search_both_strands(strings[0].c_str(), strings[0].size(), std::back_inserter(first_result), context); // Leaves stuff in the context
+    vector<int64_t> buffer(result.size());
+    ASSERT_EQ(sbwt.streaming_search_both_strands(query.c_str(), query.size(), buffer.data(), context), result.size());
+    ASSERT_EQ(buffer, result);
+    for(int64_t i = 0; i < (int64_t)result.size(); i++){
+        string kmer = query.substr(i, k);
+        string rc_kmer = get_rc(kmer);
+        if(true_kmers.count(kmer)) ASSERT_EQ(result[i], sbwt.search(kmer));
+        else if(true_kmers.count(rc_kmer)) ASSERT_EQ(result[i], sbwt.search(rc_kmer));
+        else ASSERT_EQ(result[i], -1);
+    }
+}
+
+TEST(TEST_PRECALC, compact_table){
+    plain_matrix_sbwt_t sbwt;
+    vector<string> strings = {"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA", "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"};
+    int64_t k = 6;
+    build_nodeboss_in_memory(strings, sbwt, k, true);
+    set<string> true_kmers = get_all_kmers(strings, k);
+
+    for(int64_t p = 1; p <= k; p++){
+        sbwt.do_kmer_prefix_precalc(p);
+        ASSERT_EQ(sbwt.get_precalc().size(), (int64_t)1 << (2*p));
+        for(int64_t data = 0; data < sbwt.get_precalc().size(); data++){
+            string prefix;
+            for(int64_t i = 0; i < p; i++) prefix += char_idx_to_DNA((data >> (2*i)) & 0x3);
+            ASSERT_EQ(sbwt.get_precalc()[data], sbwt.update_sbwt_interval(prefix, {0, sbwt.number_of_subsets()-1}));
+        }
+        check_all_queries(sbwt, true_kmers);
+
+        // Serialization round trip
+        stringstream ss;
+        sbwt.serialize(ss);
+        plain_matrix_sbwt_t loaded;
+        loaded.load(ss);
+        ASSERT_EQ(loaded.get_precalc_k(), p);
+        check_all_queries(loaded, true_kmers);
+    }
+}
+
+TEST(TEST_MATCHING_STATISTICS, brute_force){
+    plain_matrix_sbwt_t sbwt;
+    vector<string> strings = {"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA", "AAAAAAAAAAAAAAAAAA"};
+    int64_t k = 6;
+    build_nodeboss_in_memory(strings, sbwt, k, true);
+    set<string> true_kmers = get_all_kmers(strings, k);
+
+    // All substrings of length up to k of the k-mers
+    set<string> substrings;
+    for(const string& kmer : true_kmers)
+        for(int64_t i = 0; i < k; i++)
+            for(int64_t len = 1; i + len <= k; len++) substrings.insert(kmer.substr(i, len));
+
+    // Compare the LCS array against the reconstructed labels
+    ASSERT_THROW(sbwt.matching_statistics("ACGT"), std::runtime_error);
+    sbwt.build_lcs();
+    string labels = sbwt.reconstruct_all_kmers();
+    ASSERT_EQ(sbwt.get_lcs().size(), sbwt.number_of_subsets());
+    ASSERT_EQ(sbwt.get_lcs()[0], 0);
+    for(int64_t i = 1; i < sbwt.number_of_subsets(); i++){
+        int64_t common = 0;
+        while(common < k && labels[i*k + k-1-common] == labels[(i-1)*k + k-1-common]) common++;
+        ASSERT_EQ(sbwt.get_lcs()[i], common);
+    }
+
+    vector<string> queries = {"ACGCTAGCCATCACGGGNNTAATGCTGTAGCTACAGCATTAGGTCGA", "TGGCTCGTGTAGTCGAAAAAAAAAAAAA", "", "N", "GGGG", "CCCGTGATGGCTATAATGCTGTAGC"};
+    for(const string& query : queries){
+        vector<int64_t> ms = sbwt.matching_statistics(query);
+        ASSERT_EQ(ms.size(), query.size());
+        for(int64_t i = 0; i < (int64_t)query.size(); i++){
+            int64_t expected = 0;
+            while(expected < min(k, i+1) && substrings.count(query.substr(i - expected, expected + 1))) expected++;
+            ASSERT_EQ(ms[i], expected);
+        }
+    }
+
+    // The LCS array is serialized with the index and can be moved to other variants
+    stringstream ss;
+    sbwt.serialize(ss);
+    plain_matrix_sbwt_t loaded;
+    loaded.load(ss);
+    ASSERT_EQ(loaded.matching_statistics(queries[0]), sbwt.matching_statistics(queries[0]));
+
+    const auto& M = sbwt.get_subset_rank_structure();
+    interleaved_matrix_sbwt_t other(M.A_bits, M.C_bits, M.G_bits, M.T_bits, sbwt.get_streaming_support(), k, sbwt.number_of_kmers(), 0);
+    other.set_lcs(sbwt.get_lcs());
+    ASSERT_EQ(other.matching_statistics(queries[0]), sbwt.matching_statistics(queries[0]));
+}
+
+TEST(TEST_MMAP, load_mmap){
+    plain_matrix_sbwt_t plain;
+    vector<string> strings = {"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA", "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"};
+    int64_t k = 6;
+    build_nodeboss_in_memory(strings, plain, k, true);
+    plain.build_lcs();
+    set<string> true_kmers = get_all_kmers(strings, k);
+
+    const auto& M = plain.get_subset_rank_structure();
+    interleaved_matrix_sbwt_t sbwt(M.A_bits, M.C_bits, M.G_bits, M.T_bits, plain.get_streaming_support(), k, plain.number_of_kmers(), 3);
+    sbwt.set_lcs(plain.get_lcs());
+    sbwt.set_dummy_marks(plain.get_dummy_marks());
+    sdsl::int_vector<> counts(plain.number_of_kmers());
+    for(int64_t i = 0; i < (int64_t)counts.size(); i++) counts[i] = i % 7 + 1;
+    sdsl::util::bit_compress(counts);
+    sbwt.set_counts(counts);
+
+    // Write something before the index to check that the sections are aligned by their position in the file
+    string filename = get_temp_file_manager().create_filename("", ".sbwt");
+    int64_t offset;
+    {
+        throwing_ofstream out(filename, ios::binary);
+        serialize_string("interleaved-matrix", out.stream);
+        offset = out.stream.tellp();
+        sbwt.serialize_mappable(out.stream);
+    }
+
+    interleaved_matrix_sbwt_t mapped;
+    mapped.load_mmap(filename, offset);
+    ASSERT_TRUE(mapped.has_streaming_query_support());
+    ASSERT_EQ(mapped.get_streaming_support().size(), 0); // The marks are only in the blocks
+    check_all_queries(mapped, true_kmers);
+    ASSERT_EQ(mapped.get_dummy_marks(), plain.get_dummy_marks());
+    ASSERT_EQ(mapped.get_counts(), counts);
+    for(const string& kmer : true_kmers) ASSERT_EQ(mapped.search_id(kmer), plain.search_id(kmer));
+
+    // Copies share the mapping
+    interleaved_matrix_sbwt_t copy = mapped;
+    mapped = interleaved_matrix_sbwt_t();
+    check_all_queries(copy, true_kmers);
+
+    // The same file can also be read into memory
+    interleaved_matrix_sbwt_t loaded;
+    {
+        throwing_ifstream in(filename, ios::binary);
+        ASSERT_EQ(load_string(in.stream), "interleaved-matrix");
+        loaded.load(in.stream);
+    }
+    ASSERT_EQ(loaded.get_streaming_support(), plain.get_streaming_support());
+    check_all_queries(loaded, true_kmers);
+
+    string query = "ACGCTAGCCATCACGGGNNTAATGCTGTAGCTACAGCATTAGGTCGA";
+    ASSERT_EQ(copy.matching_statistics(query), plain.matching_statistics(query));
+    ASSERT_EQ(loaded.matching_statistics(query), plain.matching_statistics(query));
+
+    // Only the interleaved variant has the layout, and the normal format can not be mapped
+    stringstream ss;
+    ASSERT_THROW(plain.serialize_mappable(ss), std::runtime_error);
+    string normal_file = get_temp_file_manager().create_filename("", ".sbwt");
+    sbwt.serialize(normal_file);
+    ASSERT_THROW(mapped.load_mmap(normal_file), std::runtime_error);
+}
+
+TEST(TEST_SECTIONED_FORMAT, partial_loading){
+    plain_matrix_sbwt_t sbwt;
+    vector<string> strings = {"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA"};
+    int64_t k = 5;
+    build_nodeboss_in_memory(strings, sbwt, k, true);
+    sbwt.do_kmer_prefix_precalc(3);
+    sbwt.build_lcs();
+    set<string> true_kmers = get_all_kmers(strings, k);
+    string query = "ACGCTAGCCATCACGGGNNTAATGCTGTAGCTACAGCATTAGGTCGA";
+
+    string filename = get_temp_file_manager().create_filename("", ".sbwt");
+    int64_t offset;
+    {
+        throwing_ofstream out(filename, ios::binary);
+        serialize_string("plain-matrix", out.stream);
+        offset = out.stream.tellp();
+        sbwt.serialize(out.stream);
+    }
+
+    for(int64_t streaming = 0; streaming <= 1; streaming++){
+        for(int64_t precalc = 0; precalc <= 1; precalc++){
+            for(int64_t lcs = 0; lcs <= 1; lcs++){
+                for(int64_t n_threads : {1, 3}){
+                    SBWTLoadConfig config;
+                    config.streaming_support = streaming;
+                    config.precalc = precalc;
+                    config.lcs = lcs;
+                    config.dummy_marks = !lcs; // Both with and without, without doubling the combinations
+                    config.n_threads = n_threads;
+
+                    plain_matrix_sbwt_t loaded;
+                    loaded.load(filename, config, offset);
+                    ASSERT_EQ(loaded.has_streaming_query_support(), (bool)streaming);
+                    ASSERT_EQ(loaded.get_precalc_k(), precalc ? 3 : 0);
+                    ASSERT_EQ(loaded.has_lcs(), (bool)lcs);
+                    ASSERT_EQ(loaded.has_dummy_marks(), !lcs);
+                    check_all_queries(loaded, true_kmers);
+                    if(lcs) ASSERT_EQ(loaded.matching_statistics(query), sbwt.matching_statistics(query));
+
+                    // The same from a stream that can not seek
+                    throwing_ifstream in(filename, ios::binary);
+                    ASSERT_EQ(load_string(in.stream), "plain-matrix");
+                    stringstream data;
+                    data << in.stream.rdbuf();
+                    string bytes = data.str();
+                    MemoryStreamBuf buf(bytes.data(), bytes.data() + bytes.size()); // Does not implement seeking
+                    std::istream unseekable(&buf);
+                    plain_matrix_sbwt_t loaded2;
+                    loaded2.load(unseekable, config);
+                    ASSERT_EQ(loaded2.has_streaming_query_support(), (bool)streaming);
+                    ASSERT_EQ(loaded2.get_precalc_k(), precalc ? 3 : 0);
+                    check_all_queries(loaded2, true_kmers);
+                }
+            }
+        }
+    }
+
+    // Serializing to a stream that can not seek gives the same bytes
+    struct UnseekableSink : public std::streambuf{
+        string data;
+        std::streamsize xsputn(const char* s, std::streamsize n) override {data.append(s, n); return n;}
+        int_type overflow(int_type c) override {if(c != traits_type::eof()) data.push_back(c); return traits_type::not_eof(c);}
+    } sink;
+    std::ostream unseekable_out(&sink);
+    int64_t written = sbwt.serialize(unseekable_out);
+    throwing_ifstream in(filename, ios::binary);
+    stringstream data;
+    data << in.stream.rdbuf();
+    ASSERT_EQ(sink.data, data.str().substr(offset));
+    ASSERT_EQ(written, (int64_t)sink.data.size());
+}
+
+TEST(TEST_DUMMY_MARKS, dense_ids){
+    plain_matrix_sbwt_t sbwt;
+    vector<string> strings = {"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA"};
+    int64_t k = 5;
+    build_nodeboss_in_memory(strings, sbwt, k, true);
+    ASSERT_TRUE(sbwt.has_dummy_marks());
+
+    // The stored marks must be the nodes whose label is padded with '$'
+    string kmers_concat = sbwt.reconstruct_all_kmers();
+    const sdsl::bit_vector& marks = sbwt.get_dummy_marks();
+    ASSERT_EQ(marks.size(), sbwt.number_of_subsets());
+    for(int64_t i = 0; i < sbwt.number_of_subsets(); i++) ASSERT_EQ((bool)marks[i], kmers_concat[i*k] == '$');
+    plain_matrix_sbwt_t without_marks = sbwt;
+    without_marks.set_dummy_marks(sdsl::bit_vector());
+    ASSERT_FALSE(without_marks.has_dummy_marks());
+    ASSERT_THROW(without_marks.search_id("ACGTA"), std::runtime_error);
+    ASSERT_EQ(without_marks.compute_dummy_node_marks(), marks);
+    without_marks.build_dummy_marks();
+    ASSERT_EQ(without_marks.get_dummy_marks(), marks);
+
+    // Computing the marks does not need the streaming support or access to the subset bits
+    const auto& srs = sbwt.get_subset_rank_structure();
+    mef_matrix_sbwt_t mef(srs.A_bits, srs.C_bits, srs.G_bits, srs.T_bits, sdsl::bit_vector(), k, sbwt.number_of_kmers(), 0);
+    mef.build_dummy_marks();
+    ASSERT_EQ(mef.get_dummy_marks(), marks);
+
+    // The ids of the k-mers are 0, 1, ..., n_kmers-1 in colex order
+    set<string> true_kmers = get_all_kmers(strings, k);
+    ASSERT_EQ(sbwt.number_of_kmers(), true_kmers.size());
+    vector<pair<string, int64_t>> colex_sorted;
+    for(const string& kmer : true_kmers) colex_sorted.push_back({string(kmer.rbegin(), kmer.rend()), sbwt.search_id(kmer)});
+    std::sort(colex_sorted.begin(), colex_sorted.end());
+    for(int64_t i = 0; i < (int64_t)colex_sorted.size(); i++) ASSERT_EQ(colex_sorted[i].second, i);
+    ASSERT_EQ(sbwt.search_id("AAAAA"), -1);
+
+    string query = "ACGCTAGCCATCACGGGNNTAATGCTGTAGCTACAGCATTAGGTCGATGGCTCGTGTA";
+    vector<int64_t> ids = sbwt.streaming_search_ids(query);
+    ASSERT_EQ(ids.size(), query.size() - k + 1);
+    for(int64_t i = 0; i < (int64_t)ids.size(); i++) ASSERT_EQ(ids[i], sbwt.search_id(query.substr(i, k)));
+
+    // The marks are serialized with the index
+    string filename = get_temp_file_manager().create_filename("", ".sbwt");
+    sbwt.serialize(filename);
+    plain_matrix_sbwt_t loaded;
+    loaded.load(filename);
+    ASSERT_EQ(loaded.get_dummy_marks(), marks);
+    ASSERT_EQ(loaded.streaming_search_ids(query), ids);
+}
+
 TEST(TEST_GET_KMER, all){
     // mef variants are commented out because they don't compile because the mef bit vector
     // does not support access currently.
@@ -245,6 +612,7 @@ TEST(TEST_GET_KMER, all){
     //test_get_kmer<mef_concat_sbwt_t>();
     test_get_kmer<plain_sswt_sbwt_t>();
     test_get_kmer<rrr_sswt_sbwt_t>();
+    test_get_kmer<interleaved_matrix_sbwt_t>();
 }
 
 TEST(TEST_KMC_CONSTRUCT, not_all_dummies_needed){
@@ -277,6 +645,235 @@ TEST(TEST_KMC_CONSTRUCT, multiple_input_files){
     ASSERT_EQ(index1.get_streaming_support(), index2.get_streaming_support());
 }
 
+TEST(TEST_KMC_CONSTRUCT, parallel_node_generation){
+    // The k-mers are split into ranges by suffix that are processed in parallel. The result must not depend on the
+    // number of threads, or on whether the graph is built in memory or through temporary files.
+    vector<vector<string>> inputs;
+    vector<string> random_strings;
+    for(int64_t i = 0; i < 20; i++) random_strings.push_back(generate_random_kmer(100));
+    inputs.push_back(random_strings);
+    inputs.push_back({"CCCGTGATGGCTA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA"});
+    inputs.push_back({"ACACCACAACCCAAAC"}); // Not all characters occur
+    inputs.push_back({"AAAAAAAAAAAAAAA"}); // Cyclic, one k-mer
+    for(const vector<string>& strings : inputs){
+        for(int64_t k : {3, 6}){
+            string filename = get_temp_file_manager().create_filename("",".fna");
+            write_seqs_to_fasta_file(strings, filename);
+            NodeBOSSKMCConstructor<plain_matrix_sbwt_t> X;
+            X.in_memory_fast_path = false;
+            plain_matrix_sbwt_t reference;
+            X.build({filename}, reference, k, 1, 2, true, 1, 1e9, 2, true);
+            for(int64_t n_threads : {1, 2, 3, 8}) for(bool in_memory : {false, true}){
+                X.in_memory_fast_path = in_memory;
+                plain_matrix_sbwt_t index;
+                X.build({filename}, index, k, n_threads, 2, true, 1, 1e9, 2, true);
+                ASSERT_EQ(index.get_counts(), reference.get_counts());
+                assert_same_sbwt(index, reference);
+            }
+        }
+    }
+}
+
+TEST(TEST_KMC_CONSTRUCT, in_memory_budget){
+    // If the dummies do not fit in the RAM budget, the in-memory build gives up and leaves the KMC database
+    vector<string> strings;
+    for(int64_t i = 0; i < 20; i++) strings.push_back(generate_random_kmer(100));
+    string filename = get_temp_file_manager().create_filename("",".fna");
+    write_seqs_to_fasta_file(strings, filename);
+    int64_t k = 12; // Large enough that the first k-mers of the strings have no predecessors, so there are dummies
+    NodeBOSSKMCConstructor<plain_matrix_sbwt_t> X;
+    X.in_memory_fast_path = false;
+    plain_matrix_sbwt_t reference;
+    X.build({filename}, reference, k, 1, 2, true, 1, 1e9, 2);
+
+    string db_path; int64_t n_kmers;
+    std::tie(db_path, n_kmers) = run_kmc({filename}, k, 2, 2, 1, 1e9);
+    sdsl::bit_vector A, C, G, T, sgs, dummy_marks;
+    ASSERT_EQ(X.build_bit_vectors_in_memory(db_path, n_kmers, 2, nullptr, A, C, G, T, sgs, dummy_marks, k, n_kmers * (int64_t)(sizeof(Kmer<MAX_KMER_LENGTH>) + 1) + 1), -1);
+    ASSERT_TRUE(std::filesystem::exists(db_path + ".kmc_suf"));
+    ASSERT_EQ(X.build_bit_vectors_in_memory(db_path, n_kmers, 2, nullptr, A, C, G, T, sgs, dummy_marks, k, (int64_t)1 << 30), n_kmers);
+    ASSERT_FALSE(std::filesystem::exists(db_path + ".kmc_suf"));
+    ASSERT_EQ(A, reference.get_subset_rank_structure().A_bits);
+    ASSERT_EQ(C, reference.get_subset_rank_structure().C_bits);
+    ASSERT_EQ(G, reference.get_subset_rank_structure().G_bits);
+    ASSERT_EQ(T, reference.get_subset_rank_structure().T_bits);
+    ASSERT_EQ(sgs, reference.get_streaming_support());
+    ASSERT_EQ(dummy_marks, reference.get_dummy_marks());
+}
+
+TEST(TEST_KMC_CONSTRUCT, kmer_width_dispatch){
+    // build_with_kmc uses the narrowest k-mer type that fits k. The result must be the same as with the widest type.
+    vector<string> strings;
+    for(int64_t i = 0; i < 20; i++) strings.push_back(generate_random_kmer(100));
+    string filename = get_temp_file_manager().create_filename("",".fna");
+    write_seqs_to_fasta_file(strings, filename);
+    for(int64_t k : {5, 31, 32, 33, 64, 65, 100}){
+        if(k > MAX_KMER_LENGTH) continue;
+        plain_matrix_sbwt_t reference, index;
+        NodeBOSSKMCConstructor<plain_matrix_sbwt_t, MAX_KMER_LENGTH> X;
+        X.build({filename}, reference, k, 2, 2, true, 1, 1e9, 2);
+        build_with_kmc({filename}, index, k, 2, 2, true, 1, 1e9, 2);
+        assert_same_sbwt(index, reference);
+    }
+    plain_matrix_sbwt_t index;
+    ASSERT_THROW(build_with_kmc({filename}, index, MAX_KMER_LENGTH + 1, 1, 2, true, 1, 1e9, 2), std::runtime_error);
+}
+
+TEST(TEST_KMC_CONSTRUCT, distinct_dummies){
+    typedef KMC_construction_helper_classes::Node<MAX_KMER_LENGTH> Node;
+    NodeBOSSKMCConstructor<plain_matrix_sbwt_t> X;
+    vector<kmer_t> sources;
+    for(int64_t i = 0; i < 200; i++) sources.push_back(kmer_t(generate_random_kmer(6)));
+    std::sort(sources.begin(), sources.end(), X.lex_less);
+
+    // All prefixes of all k-mers, with duplicates
+    set<string> expected;
+    for(const kmer_t& z : sources) X.for_each_prefix_node(z, [&](Node& node){expected.insert(node.to_string());});
+
+    string sources_file = get_temp_file_manager().create_filename();
+    auto kmer_format = X.kmer_file_format(6);
+    {
+        throwing_ofstream out(sources_file, ios::binary);
+        vector<char> buf(kmer_format.kmer_size_in_bytes());
+        for(const kmer_t& z : sources){
+            kmer_format.serialize_kmer(z, buf.data());
+            out.write(buf.data(), kmer_format.kmer_size_in_bytes());
+        }
+    }
+    string dummies_file = get_temp_file_manager().create_filename();
+    X.write_distinct_dummies(sources_file, dummies_file, 6);
+
+    vector<string> written;
+    auto dummy_format = X.dummy_file_format(6);
+    throwing_ifstream in(dummies_file, ios::binary);
+    vector<char> buf(dummy_format.node_size_in_bytes());
+    while(in.stream.read(buf.data(), dummy_format.node_size_in_bytes())){
+        written.push_back(dummy_format.load_node(buf.data()).to_string());
+    }
+    ASSERT_EQ(written.size(), expected.size()); // Every dummy exactly once
+    ASSERT_EQ(set<string>(written.begin(), written.end()), expected);
+}
+
+TEST(TEST_KMC_CONSTRUCT, sorted_kmc_database_random_access){
+    vector<string> strings;
+    for(int64_t i = 0; i < 20; i++) strings.push_back(generate_random_kmer(100));
+    string filename = get_temp_file_manager().create_filename("",".fna");
+    write_seqs_to_fasta_file(strings, filename);
+    for(int64_t k : {3, 4, 13}){
+        string db_path; int64_t n_kmers;
+        std::tie(db_path, n_kmers) = run_kmc({filename}, k, 1, 2, 1, 1e9);
+
+        // Sequential listing through the KMC API
+        vector<Kmer<MAX_KMER_LENGTH>> kmers;
+        vector<int64_t> counts;
+        KMC_construction_helper_classes::Kmer_stream_from_KMC_DB<MAX_KMER_LENGTH> listing(db_path, false);
+        while(!listing.done()){
+            kmers.push_back(listing.next());
+            counts.push_back(listing.get_last_count());
+        }
+
+        KMC_construction_helper_classes::SortedKMCDatabase<MAX_KMER_LENGTH> db(db_path);
+        ASSERT_EQ(db.size(), n_kmers);
+        ASSERT_EQ(db.size(), kmers.size());
+        ASSERT_TRUE(db.matches_kmc_listing(db_path, n_kmers));
+        for(int64_t i = 0; i < n_kmers; i++){
+            ASSERT_EQ(db.next(), kmers[i]);
+            ASSERT_EQ(db.get_last_count(), counts[i]);
+        }
+        ASSERT_TRUE(db.done());
+        for(int64_t rep = 0; rep < 100; rep++){
+            int64_t i = rand() % n_kmers;
+            KMC_construction_helper_classes::SortedKMCDatabase<MAX_KMER_LENGTH> copy(db);
+            copy.seek(i);
+            ASSERT_EQ(copy.next(), kmers[i]);
+        }
+        for(char c : {'A','C','G','T'}){
+            for(int64_t i = 0; i < n_kmers; i++){
+                bool in_block = i >= db.get_char_block_start(c) && i < db.get_char_block_end(c);
+                ASSERT_EQ(in_block, kmers[i].last() == c);
+            }
+        }
+
+        // The uncompressed copy keeps the counts in its records
+        KMC_construction_helper_classes::Kmer_stream_from_KMC_DB<MAX_KMER_LENGTH> listing_again(db_path, false);
+        KMC_construction_helper_classes::SimpleSortedKmerDB<MAX_KMER_LENGTH> uncompressed(listing_again, get_temp_file_manager().create_filename(), k, true);
+        ASSERT_EQ(uncompressed.size(), n_kmers);
+        for(int64_t i = 0; i < n_kmers; i++){
+            ASSERT_EQ(uncompressed.next(), kmers[i]);
+            ASSERT_EQ(uncompressed.get_last_count(), counts[i]);
+        }
+        std::filesystem::remove(db_path + ".kmc_pre");
+        std::filesystem::remove(db_path + ".kmc_suf");
+    }
+}
+
+TEST(TEST_KMC_CONSTRUCT, counts){
+    vector<string> strings = {"CCCGTGATGGCTAAAAAAAAAAA", "TAATGCTGTAGC", "TGGCTCGTGTAGTCGA", "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"};
+    int64_t k = 4;
+    string filename = get_temp_file_manager().create_filename("",".fna");
+    write_seqs_to_fasta_file(strings, filename);
+
+    map<string, int64_t> true_counts;
+    for(const string& S : strings)
+        for(int64_t i = 0; i + k <= (int64_t)S.size(); i++) true_counts[S.substr(i, k)]++;
+
+    NodeBOSSKMCConstructor<plain_matrix_sbwt_t> X;
+    plain_matrix_sbwt_t sbwt;
+    X.build({filename}, sbwt, k, 1, 2, true, 1, 1e9, 2, true);
+    ASSERT_TRUE(sbwt.has_counts());
+    ASSERT_EQ(sbwt.get_counts().size(), sbwt.number_of_kmers());
+    ASSERT_GT(true_counts["AAAA"], 255); // Larger than the default counter limit of KMC
+    for(auto [kmer, count] : true_counts) ASSERT_EQ(sbwt.get_count(sbwt.search(kmer)), count);
+    ASSERT_EQ(sbwt.get_count(-1), 0);
+    ASSERT_EQ(sbwt.get_count(0), 0); // The root is a dummy node
+
+    // The counts are serialized with the index and can be left out on load
+    string index_filename = get_temp_file_manager().create_filename("", ".sbwt");
+    sbwt.serialize(index_filename);
+    plain_matrix_sbwt_t loaded;
+    loaded.load(index_filename);
+    ASSERT_EQ(loaded.get_counts(), sbwt.get_counts());
+    SBWTLoadConfig config;
+    config.counts = false;
+    loaded.load(index_filename, config);
+    ASSERT_FALSE(loaded.has_counts());
+    ASSERT_THROW(loaded.get_count(0), std::runtime_error);
+
+    // Without store_counts, no counts are kept
+    plain_matrix_sbwt_t without_counts;
+    X.build({filename}, without_counts, k, 1, 2, true, 1, 1e9, 2);
+    ASSERT_FALSE(without_counts.has_counts());
+}
+
+TEST(TEST_KMC_CONSTRUCT, add_reverse_complements){
+    // Adding the reverse complements in the construction must give the same index and counts as building from the
+    // input together with its reverse complement. Even k have palindromes, which are counted once per occurrence by KMC.
+    vector<string> strings = {"ACGTACGTTTGCAATTGCAAGCTTAAAAAAAAAAA", "TAATGCTGTAGCATGCAT", "GAATTCGAATTCTGGCTCGTGTAGTCGA"};
+    for(int64_t i = 0; i < 10; i++) strings.push_back(generate_random_kmer(100));
+    vector<string> strings_and_rcs = strings;
+    for(const string& S : strings) strings_and_rcs.push_back(get_rc(S));
+    string filename = get_temp_file_manager().create_filename("",".fna");
+    string rc_filename = get_temp_file_manager().create_filename("",".fna");
+    write_seqs_to_fasta_file(strings, filename);
+    write_seqs_to_fasta_file(strings_and_rcs, rc_filename);
+
+    for(int64_t k : {3, 4, 6}){
+        for(auto [min_abundance, max_abundance] : vector<pair<int64_t, int64_t>>{{1, 1e9}, {2, 1e9}, {3, 6}}){
+            NodeBOSSKMCConstructor<plain_matrix_sbwt_t> X;
+            plain_matrix_sbwt_t reference;
+            X.build({rc_filename}, reference, k, 1, 2, true, min_abundance, max_abundance, 2, true);
+            for(int64_t n_threads : {1, 3}) for(bool in_memory : {false, true}){
+                X.in_memory_fast_path = in_memory;
+                plain_matrix_sbwt_t index;
+                X.build({filename}, index, k, n_threads, 2, true, min_abundance, max_abundance, 2, true, true);
+                ASSERT_EQ(index.number_of_kmers(), reference.number_of_kmers());
+                ASSERT_EQ(index.get_counts(), reference.get_counts());
+                assert_same_sbwt(index, reference);
+            }
+        }
+    }
+}
+
 
 TEST(TEST_IM_CONSTRUCTION, redundant_dummies){
     vector<string> strings = {"AAAA", "ACCC", "ACCG", "CCCG", "TTTT"};
@@ -333,7 +930,7 @@ TEST(TEST_IM_CONSTRUCTION, test_serialization){
     true_kmers = true_kmers2;
 
     vector<string> filenames;
-    for(int64_t i = 0; i < 10; i++){ // Create temp file for each of the 10 variants
+    for(int64_t i = 0; i < 11; i++){ // Create temp file for each of the 11 variants
         filenames.push_back(get_temp_file_manager().create_filename());
     }
 
@@ -349,6 +946,7 @@ TEST(TEST_IM_CONSTRUCTION, test_serialization){
         mef_concat_sbwt_t v8;
         plain_sswt_sbwt_t v9;
         rrr_sswt_sbwt_t v10;
+        interleaved_matrix_sbwt_t v11;
 
         build_nodeboss_in_memory(strings, v1, k, true);
         build_nodeboss_in_memory(strings, v2, k, true);
@@ -360,6 +958,7 @@ TEST(TEST_IM_CONSTRUCTION, test_serialization){
         build_nodeboss_in_memory(strings, v8, k, true);
         build_nodeboss_in_memory(strings, v9, k, true);
         build_nodeboss_in_memory(strings, v10, k, true);
+        build_nodeboss_in_memory(strings, v11, k, true);
 
         v1.do_kmer_prefix_precalc(2);
 
@@ -373,6 +972,7 @@ TEST(TEST_IM_CONSTRUCTION, test_serialization){
         v8.serialize(filenames[7]);
         v9.serialize(filenames[8]);
         v10.serialize(filenames[9]);
+        v11.serialize(filenames[10]);
     }
 
     // Load and query
@@ -387,6 +987,7 @@ TEST(TEST_IM_CONSTRUCTION, test_serialization){
         mef_concat_sbwt_t v8;
         plain_sswt_sbwt_t v9;
         rrr_sswt_sbwt_t v10;
+        interleaved_matrix_sbwt_t v11;
 
         v1.load(filenames[0]);
         v2.load(filenames[1]);
@@ -398,6 +999,7 @@ TEST(TEST_IM_CONSTRUCTION, test_serialization){
         v8.load(filenames[7]);
         v9.load(filenames[8]);
         v10.load(filenames[9]);
+        v11.load(filenames[10]);
 
         check_all_queries(v1, true_kmers);
         check_all_queries(v2, true_kmers);
@@ -409,6 +1011,7 @@ TEST(TEST_IM_CONSTRUCTION, test_serialization){
         check_all_queries(v8, true_kmers);
         check_all_queries(v9, true_kmers);
         check_all_queries(v10, true_kmers);
+        check_all_queries(v11, true_kmers);
 
         vector<string> streaming_query_inputs = strings; // input strings
         streaming_query_inputs.push_back(generate_random_kmer(100));
@@ -424,6 +1027,7 @@ TEST(TEST_IM_CONSTRUCTION, test_serialization){
             check_streaming_queries(v8, true_kmers, S);
             check_streaming_queries(v9, true_kmers, S);
             check_streaming_queries(v10, true_kmers, S);
+            check_streaming_queries(v11, true_kmers, S);
         }
     }
 }
\ No newline at end of file